@@ -0,0 +1,495 @@
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <phosg/Time.hh>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "frame_profile.hh"
+#include "level.hh"
+#include "level_batch.hh"
+#include "level_loader.hh"
+#include "snapshot_ring.hh"
+
+using namespace std;
+
+
+// runs every level in levels.json without rendering anything, feeding the
+// player impulses from a random or scripted policy, and reports how long
+// exec_frame takes on each one (on average, and the median and 99th percentile
+// frames) along with how many entities the level had. then it forks the final
+// state of each level repeatedly and reports how many forks per second it can
+// do, both with fork() (which allocates a new LevelState every time) and by
+// assigning over an existing LevelState (which reuses its memory), and how long
+// it takes to roll back rollback_frames frames with a SnapshotRing and execute
+// them again. finally, it steps a LevelBatch with increasing numbers of threads
+// and reports how many frames per second it gets through. the same seed always
+// produces the same levels and the same impulses, so numbers from different
+// builds can be compared directly. with --json, the results are printed as one
+// JSON object per line instead of as tables, which is easier for scripts to
+// compare. if the engine was built with PROFILE=1, it also prints how the
+// frames in the first part of the benchmark divide their time between
+// exec_frame's phases (see frame_profile.hh).
+
+// every heap allocation in the program goes through here, so we can count how
+// many allocations each frame makes. this is atomic because the batch
+// benchmark allocates on several threads at once
+static atomic<uint64_t> num_allocations(0);
+
+void* operator new(size_t size) {
+  num_allocations.fetch_add(1, memory_order_relaxed);
+  void* ret = malloc(size);
+  if (!ret) {
+    throw bad_alloc();
+  }
+  return ret;
+}
+
+void operator delete(void* ptr) noexcept {
+  free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+  free(ptr);
+}
+
+// how far each rollback goes back. this is about what rollback netplay needs
+// to cover a quarter second of latency at 30 frames per second
+static const size_t rollback_frames = 8;
+
+static uint64_t random_impulse(mt19937& g) {
+  static const uint64_t directions[] = {Impulse::None, Impulse::Left,
+      Impulse::Right, Impulse::Up, Impulse::Down};
+  uint64_t impulse = directions[g() % 5];
+  if ((g() % 4) == 0) {
+    impulse |= Impulse::Push;
+  }
+  return impulse;
+}
+
+// the player's impulses during the main part of the benchmark come from one of
+// these. random changes direction every half second or so, like a human
+// would; scripted walks left, up, right and down in turn (half a second each)
+// and pushes at the end of each leg, so it doesn't depend on the random
+// number generator at all; idle does nothing
+enum class Policy {
+  Idle,
+  Random,
+  Scripted,
+};
+
+static Policy policy_for_name(const char* name) {
+  if (!strcmp(name, "idle")) {
+    return Policy::Idle;
+  } else if (!strcmp(name, "random")) {
+    return Policy::Random;
+  } else if (!strcmp(name, "scripted")) {
+    return Policy::Scripted;
+  }
+  throw invalid_argument("unknown policy");
+}
+
+static const char* name_for_policy(Policy policy) {
+  switch (policy) {
+    case Policy::Idle:
+      return "idle";
+    case Policy::Random:
+      return "random";
+    case Policy::Scripted:
+      return "scripted";
+  }
+  return "unknown";
+}
+
+static uint64_t impulse_for_frame(Policy policy, int64_t frame,
+    uint64_t prev_impulse, mt19937& g) {
+  static const uint64_t directions[] = {Impulse::Left, Impulse::Up,
+      Impulse::Right, Impulse::Down};
+  switch (policy) {
+    case Policy::Idle:
+      return Impulse::None;
+    case Policy::Random:
+      return ((frame % 15) == 0) ? random_impulse(g) : prev_impulse;
+    case Policy::Scripted: {
+      uint64_t impulse = directions[(frame / 15) % 4];
+      if ((frame % 15) == 14) {
+        impulse |= Impulse::Push;
+      }
+      return impulse;
+    }
+  }
+  return Impulse::None;
+}
+
+// returns the given percentile of the frame times. this reorders the vector
+static uint64_t percentile(vector<uint64_t>& values, double fraction) {
+  if (values.empty()) {
+    return 0;
+  }
+  size_t index = min<size_t>(values.size() * fraction, values.size() - 1);
+  nth_element(values.begin(), values.begin() + index, values.end());
+  return values[index];
+}
+
+static uint64_t now_nsecs() {
+  return chrono::duration_cast<chrono::nanoseconds>(
+      chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void print_frame_profile(bool json, const FrameProfile& profile,
+    bool hardware_counters) {
+  uint64_t total_nsecs = 0;
+  for (size_t phase = 0; phase < num_frame_phases; phase++) {
+    total_nsecs += profile.phase_nsecs[phase];
+  }
+  if (!json) {
+    fprintf(stdout, "\n%-16s %12s %8s", "phase", "nsec/frame", "percent");
+    if (hardware_counters) {
+      for (size_t counter = 0; counter < num_hardware_counters; counter++) {
+        fprintf(stdout, " %14s", name_for_hardware_counter(
+            static_cast<HardwareCounter>(counter)));
+      }
+    }
+    fputc('\n', stdout);
+  }
+
+  // hardware counts are per frame, like the times
+  double frames = profile.frames;
+  for (size_t phase = 0; phase < num_frame_phases; phase++) {
+    const char* name = name_for_frame_phase(static_cast<FramePhase>(phase));
+    double nsecs_per_frame = profile.phase_nsecs[phase] / frames;
+    double percent = total_nsecs ? (profile.phase_nsecs[phase] * 100.0 / total_nsecs) : 0.0;
+    if (json) {
+      fprintf(stdout, "{\"section\": \"phase\", \"phase\": \"%s\", "
+          "\"nsecs_per_frame\": %.1f, \"percent\": %.2f", name,
+          nsecs_per_frame, percent);
+      if (hardware_counters) {
+        for (size_t counter = 0; counter < num_hardware_counters; counter++) {
+          fprintf(stdout, ", \"%s_per_frame\": %.1f", name_for_hardware_counter(
+              static_cast<HardwareCounter>(counter)),
+              profile.phase_hardware_counts[phase][counter] / frames);
+        }
+      }
+      fputs("}\n", stdout);
+    } else {
+      fprintf(stdout, "%-16s %12.1f %7.2f%%", name, nsecs_per_frame, percent);
+      if (hardware_counters) {
+        for (size_t counter = 0; counter < num_hardware_counters; counter++) {
+          fprintf(stdout, " %14.1f",
+              profile.phase_hardware_counts[phase][counter] / frames);
+        }
+      }
+      fputc('\n', stdout);
+    }
+  }
+
+  if (json) {
+    fprintf(stdout, "{\"section\": \"counts\", \"frames\": %" PRIu64 ", "
+        "\"collision_tests_per_frame\": %.2f, "
+        "\"path_expansions_per_frame\": %.2f, "
+        "\"distance_field_expansions_per_frame\": %.2f}\n", profile.frames,
+        profile.collision_tests / frames, profile.path_expansions / frames,
+        profile.distance_field_expansions / frames);
+  } else {
+    fprintf(stdout, "\nper frame: %.2f collision tests, %.2f path expansions, "
+        "%.2f distance field expansions\n", profile.collision_tests / frames,
+        profile.path_expansions / frames,
+        profile.distance_field_expansions / frames);
+  }
+}
+
+int main(int argc, char* argv[]) {
+  string levels_filename = "media/levels.json";
+  int64_t num_frames = 3000;
+  int64_t num_forks = 1000;
+  size_t num_batch_environments = 64;
+  int64_t num_batch_steps = 1000;
+  uint64_t seed = 1;
+  Policy policy = Policy::Random;
+  bool json = false;
+  bool hardware_counters = false;
+  for (int x = 1; x < argc; x++) {
+    if (!strncmp(argv[x], "--levels=", 9)) {
+      levels_filename = &argv[x][9];
+    } else if (!strncmp(argv[x], "--frames=", 9)) {
+      num_frames = strtoll(&argv[x][9], NULL, 0);
+    } else if (!strncmp(argv[x], "--forks=", 8)) {
+      num_forks = strtoll(&argv[x][8], NULL, 0);
+    } else if (!strncmp(argv[x], "--batch-envs=", 13)) {
+      num_batch_environments = strtoull(&argv[x][13], NULL, 0);
+    } else if (!strncmp(argv[x], "--batch-steps=", 14)) {
+      num_batch_steps = strtoll(&argv[x][14], NULL, 0);
+    } else if (!strncmp(argv[x], "--seed=", 7)) {
+      seed = strtoull(&argv[x][7], NULL, 0);
+    } else if (!strncmp(argv[x], "--policy=", 9)) {
+      policy = policy_for_name(&argv[x][9]);
+    } else if (!strcmp(argv[x], "--json")) {
+      json = true;
+    } else if (!strcmp(argv[x], "--hardware-counters")) {
+      hardware_counters = true;
+    } else {
+      throw invalid_argument("unknown command-line option");
+    }
+  }
+
+  auto generation_params = load_generation_params(levels_filename);
+
+  // the profile only covers the main part of the benchmark (not forking,
+  // rolling back or batches), so it's collected from each level's run here
+  auto& profiler = FrameProfiler::for_thread();
+  FrameProfile frame_profile;
+  if (hardware_counters && !profiler.enable_hardware_counters()) {
+    fprintf(stderr, "warning: hardware counters are not available\n");
+    hardware_counters = false;
+  }
+
+  if (!json) {
+    fprintf(stdout, "%5s %-24s %7s %9s %7s %9s %12s %11s %9s %9s %13s %13s %11s %10s %11s %15s\n",
+        "level", "name", "blocks", "monsters", "blocks", "monsters",
+        "usec/frame", "frames/sec", "p50 usec", "p99 usec", "allocs/frame",
+        "alloc frames", "last alloc", "forks/sec", "copies/sec",
+        "rollback usec");
+    fprintf(stdout, "%5s %-24s %7s %9s %7s %9s\n", "", "", "start", "start",
+        "end", "end");
+  }
+  // every frame's time goes in here; it's allocated before any frames run so
+  // it doesn't show up in the allocation counts
+  vector<uint64_t> frame_nsecs(num_frames);
+  vector<uint64_t> all_frame_nsecs;
+  all_frame_nsecs.reserve(num_frames * generation_params.size());
+  uint64_t total_usecs = 0;
+  uint64_t total_allocations = 0;
+  uint64_t total_allocating_frames = 0;
+  uint64_t total_fork_usecs = 0;
+  uint64_t total_copy_usecs = 0;
+  uint64_t total_rollback_usecs = 0;
+  for (size_t level_index = 0; level_index < generation_params.size(); level_index++) {
+    mt19937 g(seed + level_index);
+
+    auto params = generation_params[level_index];
+    generate_random_elements(params, g());
+    LevelState game(params, g());
+    size_t initial_blocks = game.get_blocks().size();
+    size_t initial_monsters = game.get_monsters().size();
+
+    // "alloc frames" is the number of frames that allocated anything at all,
+    // and "last alloc" is the last one of them (or -1 if there were none).
+    // the scratch buffers grow during the first few frames that need them,
+    // but after that, a frame shouldn't allocate at all
+    uint64_t impulse = Impulse::None;
+    uint64_t allocations = 0;
+    uint64_t allocating_frames = 0;
+    int64_t last_allocating_frame = -1;
+    profiler.clear();
+    uint64_t start_time = now();
+    for (int64_t frame = 0; frame < num_frames; frame++) {
+      impulse = impulse_for_frame(policy, frame, impulse, g);
+      uint64_t prev_num_allocations = num_allocations;
+      uint64_t frame_start_nsecs = now_nsecs();
+      game.exec_frame(impulse);
+      frame_nsecs[frame] = now_nsecs() - frame_start_nsecs;
+      if (num_allocations != prev_num_allocations) {
+        allocations += num_allocations - prev_num_allocations;
+        allocating_frames++;
+        last_allocating_frame = frame;
+      }
+    }
+    uint64_t usecs = now() - start_time;
+    frame_profile.add(profiler.get_profile());
+    total_usecs += usecs;
+    total_allocations += allocations;
+    total_allocating_frames += allocating_frames;
+    // the starting monster count includes the player; the ending one counts
+    // only monsters (and the player) that are still alive
+    size_t final_blocks = game.get_blocks().size();
+    size_t final_monsters = game.count_monsters_with_flags(0, 0);
+    all_frame_nsecs.insert(all_frame_nsecs.end(), frame_nsecs.begin(),
+        frame_nsecs.end());
+    uint64_t p50_nsecs = percentile(frame_nsecs, 0.50);
+    uint64_t p99_nsecs = percentile(frame_nsecs, 0.99);
+
+    // look at each fork so the compiler can't skip making it
+    size_t fork_check = 0;
+    start_time = now();
+    for (int64_t fork_num = 0; fork_num < num_forks; fork_num++) {
+      LevelState forked = game.fork();
+      fork_check += forked.get_blocks().size();
+    }
+    uint64_t fork_usecs = now() - start_time;
+    total_fork_usecs += fork_usecs;
+
+    LevelState copy = game.fork();
+    start_time = now();
+    for (int64_t fork_num = 0; fork_num < num_forks; fork_num++) {
+      copy = game;
+      fork_check += copy.get_blocks().size();
+    }
+    uint64_t copy_usecs = now() - start_time;
+    total_copy_usecs += copy_usecs;
+    if (fork_check != 2 * num_forks * game.get_blocks().size()) {
+      throw logic_error("forked level does not match the original");
+    }
+
+    // play a few more frames on the copy, saving each one, then repeatedly
+    // roll it back and play the same frames again with different impulses.
+    // each rollback is one restore, rollback_frames frames and as many saves
+    SnapshotRing ring(copy, rollback_frames + 1);
+    vector<int64_t> rollback_impulses(rollback_frames);
+    ring.save(copy);
+    for (auto& rollback_impulse : rollback_impulses) {
+      rollback_impulse = random_impulse(g);
+      copy.exec_frame(rollback_impulse);
+      ring.save(copy);
+    }
+    int64_t rollback_frame = copy.get_frames_executed() - rollback_frames;
+    start_time = now();
+    for (int64_t rollback_num = 0; rollback_num < num_forks; rollback_num++) {
+      rollback_impulses[rollback_num % rollback_frames] = random_impulse(g);
+      ring.resimulate(rollback_frame, copy, rollback_impulses.data(),
+          rollback_frames);
+    }
+    uint64_t rollback_usecs = now() - start_time;
+    total_rollback_usecs += rollback_usecs;
+
+    if (json) {
+      // level names don't contain anything that needs escaping
+      fprintf(stdout, "{\"section\": \"level\", \"level\": %zu, \"name\": \"%s\", "
+          "\"policy\": \"%s\", \"seed\": %" PRIu64 ", \"frames\": %" PRId64 ", "
+          "\"start_blocks\": %zu, \"start_monsters\": %zu, "
+          "\"end_blocks\": %zu, \"end_monsters\": %zu, "
+          "\"usecs_per_frame\": %.3f, \"frames_per_sec\": %.0f, "
+          "\"p50_usecs\": %.3f, \"p99_usecs\": %.3f, "
+          "\"allocs_per_frame\": %.3f, \"alloc_frames\": %" PRIu64 ", "
+          "\"last_alloc_frame\": %" PRId64 ", \"forks_per_sec\": %.0f, "
+          "\"copies_per_sec\": %.0f, \"rollback_usecs\": %.3f}\n",
+          level_index, params.name.c_str(), name_for_policy(policy), seed,
+          num_frames, initial_blocks, initial_monsters, final_blocks,
+          final_monsters, static_cast<double>(usecs) / num_frames,
+          num_frames * 1000000.0 / usecs, p50_nsecs / 1000.0,
+          p99_nsecs / 1000.0, static_cast<double>(allocations) / num_frames,
+          allocating_frames, last_allocating_frame,
+          num_forks * 1000000.0 / fork_usecs,
+          num_forks * 1000000.0 / copy_usecs,
+          static_cast<double>(rollback_usecs) / num_forks);
+    } else {
+      fprintf(stdout, "%5zu %-24s %7zu %9zu %7zu %9zu %12.2f %11.0f %9.2f %9.2f %13.2f %13" PRIu64 " %11" PRId64 " %10.0f %11.0f %15.2f\n",
+          level_index, params.name.c_str(), initial_blocks, initial_monsters,
+          final_blocks, final_monsters, static_cast<double>(usecs) / num_frames,
+          num_frames * 1000000.0 / usecs, p50_nsecs / 1000.0,
+          p99_nsecs / 1000.0, static_cast<double>(allocations) / num_frames,
+          allocating_frames, last_allocating_frame,
+          num_forks * 1000000.0 / fork_usecs,
+          num_forks * 1000000.0 / copy_usecs,
+          static_cast<double>(rollback_usecs) / num_forks);
+    }
+  }
+
+  size_t total_frames = num_frames * generation_params.size();
+  size_t total_forks = num_forks * generation_params.size();
+  uint64_t total_p50_nsecs = percentile(all_frame_nsecs, 0.50);
+  uint64_t total_p99_nsecs = percentile(all_frame_nsecs, 0.99);
+  if (json) {
+    fprintf(stdout, "{\"section\": \"all\", \"policy\": \"%s\", "
+        "\"seed\": %" PRIu64 ", \"frames\": %zu, "
+        "\"usecs_per_frame\": %.3f, \"frames_per_sec\": %.0f, "
+        "\"p50_usecs\": %.3f, \"p99_usecs\": %.3f, "
+        "\"allocs_per_frame\": %.3f, \"alloc_frames\": %" PRIu64 ", "
+        "\"forks_per_sec\": %.0f, \"copies_per_sec\": %.0f, "
+        "\"rollback_usecs\": %.3f}\n",
+        name_for_policy(policy), seed, total_frames,
+        static_cast<double>(total_usecs) / total_frames,
+        total_frames * 1000000.0 / total_usecs, total_p50_nsecs / 1000.0,
+        total_p99_nsecs / 1000.0,
+        static_cast<double>(total_allocations) / total_frames,
+        total_allocating_frames, total_forks * 1000000.0 / total_fork_usecs,
+        total_forks * 1000000.0 / total_copy_usecs,
+        static_cast<double>(total_rollback_usecs) / total_forks);
+  } else {
+    fprintf(stdout, "%5s %-24s %7s %9s %7s %9s %12.2f %11.0f %9.2f %9.2f %13.2f %13" PRIu64 " %11s %10.0f %11.0f %15.2f\n",
+        "all", "", "", "", "", "", static_cast<double>(total_usecs) / total_frames,
+        total_frames * 1000000.0 / total_usecs, total_p50_nsecs / 1000.0,
+        total_p99_nsecs / 1000.0,
+        static_cast<double>(total_allocations) / total_frames,
+        total_allocating_frames, "", total_forks * 1000000.0 / total_fork_usecs,
+        total_forks * 1000000.0 / total_copy_usecs,
+        static_cast<double>(total_rollback_usecs) / total_forks);
+  }
+
+  // the profile is empty unless the engine was built with PROFILE=1
+  if (frame_profile.frames) {
+    print_frame_profile(json, frame_profile, hardware_counters);
+  } else if (hardware_counters) {
+    fprintf(stderr, "warning: the engine was built without PROFILE=1, so "
+        "there are no phase times or hardware counts\n");
+  }
+
+  // now do the batch benchmark. every environment starts on the first level
+  // and has 3000 frames (100 seconds) to finish it
+  if (num_batch_environments) {
+    size_t max_threads = thread::hardware_concurrency();
+    if (max_threads == 0) {
+      max_threads = 1;
+    }
+    vector<size_t> thread_counts;
+    for (size_t num_threads = 1; num_threads < max_threads; num_threads *= 2) {
+      thread_counts.emplace_back(num_threads);
+    }
+    thread_counts.emplace_back(max_threads);
+
+    if (!json) {
+      fprintf(stdout, "\n%7s %5s %12s %8s %9s\n", "threads", "envs",
+          "frames/sec", "speedup", "episodes");
+    }
+    double base_frames_per_sec = 0.0;
+    for (size_t num_threads : thread_counts) {
+      LevelBatch batch(generation_params, num_batch_environments, seed, 0,
+          num_threads, 3000);
+      mt19937 g(seed);
+      vector<uint64_t> impulses(batch.size(), Impulse::None);
+
+      uint64_t episodes = 0;
+      uint64_t start_time = now();
+      for (int64_t step = 0; step < num_batch_steps; step++) {
+        if ((step % 15) == 0) {
+          for (auto& impulse : impulses) {
+            impulse = random_impulse(g);
+          }
+        }
+        batch.step(impulses.data());
+        const uint8_t* results = batch.get_episode_results();
+        for (size_t x = 0; x < batch.size(); x++) {
+          episodes += (results[x] != LevelBatch::EpisodeResult::Playing);
+        }
+      }
+      uint64_t usecs = now() - start_time;
+
+      double frames_per_sec = (num_batch_steps * batch.size() * 1000000.0) / usecs;
+      if (base_frames_per_sec == 0.0) {
+        base_frames_per_sec = frames_per_sec;
+      }
+      if (json) {
+        fprintf(stdout, "{\"section\": \"batch\", \"threads\": %zu, "
+            "\"envs\": %zu, \"frames_per_sec\": %.0f, \"speedup\": %.3f, "
+            "\"episodes\": %" PRIu64 "}\n", batch.get_num_threads(),
+            batch.size(), frames_per_sec, frames_per_sec / base_frames_per_sec,
+            episodes);
+      } else {
+        fprintf(stdout, "%7zu %5zu %12.0f %7.2fx %9" PRIu64 "\n",
+            batch.get_num_threads(), batch.size(), frames_per_sec,
+            frames_per_sec / base_frames_per_sec, episodes);
+      }
+    }
+  }
+
+  return 0;
+}
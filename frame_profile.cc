@@ -0,0 +1,221 @@
+#include "frame_profile.hh"
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <chrono>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+using namespace std;
+
+
+static uint64_t now_nsecs() {
+  return chrono::duration_cast<chrono::nanoseconds>(
+      chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+const char* name_for_frame_phase(FramePhase phase) {
+  switch (phase) {
+    case FramePhase::Impulses:
+      return "impulses";
+    case FramePhase::Pushes:
+      return "pushes";
+    case FramePhase::Decay:
+      return "decay";
+    case FramePhase::Specials:
+      return "specials";
+    case FramePhase::BlockMotion:
+      return "block motion";
+    case FramePhase::MonsterMotion:
+      return "monster motion";
+    case FramePhase::TimedBlocks:
+      return "timed blocks";
+    case FramePhase::Explosions:
+      return "explosions";
+  }
+  return "unknown";
+}
+
+const char* name_for_hardware_counter(HardwareCounter counter) {
+  switch (counter) {
+    case HardwareCounter::Cycles:
+      return "cycles";
+    case HardwareCounter::Instructions:
+      return "instructions";
+    case HardwareCounter::CacheMisses:
+      return "cache misses";
+    case HardwareCounter::BranchMisses:
+      return "branch misses";
+  }
+  return "unknown";
+}
+
+
+
+FrameProfile::FrameProfile() {
+  this->clear();
+}
+
+void FrameProfile::clear() {
+  this->frames = 0;
+  memset(this->phase_nsecs, 0, sizeof(this->phase_nsecs));
+  memset(this->phase_hardware_counts, 0, sizeof(this->phase_hardware_counts));
+  this->collision_tests = 0;
+  this->path_expansions = 0;
+  this->distance_field_expansions = 0;
+}
+
+void FrameProfile::add(const FrameProfile& other) {
+  this->frames += other.frames;
+  for (size_t x = 0; x < num_frame_phases; x++) {
+    this->phase_nsecs[x] += other.phase_nsecs[x];
+    for (size_t y = 0; y < num_hardware_counters; y++) {
+      this->phase_hardware_counts[x][y] += other.phase_hardware_counts[x][y];
+    }
+  }
+  this->collision_tests += other.collision_tests;
+  this->path_expansions += other.path_expansions;
+  this->distance_field_expansions += other.distance_field_expansions;
+}
+
+
+
+FrameProfiler& FrameProfiler::for_thread() {
+  static thread_local FrameProfiler profiler;
+  return profiler;
+}
+
+FrameProfiler::FrameProfiler() : current_phase(FramePhase::Impulses),
+    phase_start_nsecs(0) {
+  memset(this->phase_start_counts, 0, sizeof(this->phase_start_counts));
+  for (size_t x = 0; x < num_hardware_counters; x++) {
+    this->hardware_counter_fds[x] = -1;
+  }
+}
+
+FrameProfiler::~FrameProfiler() {
+  this->disable_hardware_counters();
+}
+
+const FrameProfile& FrameProfiler::get_profile() const {
+  return this->profile;
+}
+
+FrameProfile& FrameProfiler::get_profile() {
+  return this->profile;
+}
+
+void FrameProfiler::clear() {
+  this->profile.clear();
+}
+
+bool FrameProfiler::enable_hardware_counters() {
+  if (this->hardware_counters_enabled()) {
+    return true;
+  }
+
+#ifdef __linux__
+  static const uint64_t configs[num_hardware_counters] = {
+      PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+      PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+
+  // the counters only count this thread, in user mode, which is what most
+  // kernels allow unprivileged processes to do
+  for (size_t x = 0; x < num_hardware_counters; x++) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = configs[x];
+    attr.read_format = PERF_FORMAT_GROUP;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.disabled = (x == 0);
+
+    int fd = syscall(__NR_perf_event_open, &attr, 0, -1,
+        this->hardware_counter_fds[0], 0);
+    if (fd < 0) {
+      this->disable_hardware_counters();
+      return false;
+    }
+    this->hardware_counter_fds[x] = fd;
+  }
+
+  ioctl(this->hardware_counter_fds[0], PERF_EVENT_IOC_RESET,
+      PERF_IOC_FLAG_GROUP);
+  ioctl(this->hardware_counter_fds[0], PERF_EVENT_IOC_ENABLE,
+      PERF_IOC_FLAG_GROUP);
+  return true;
+#else
+  return false;
+#endif
+}
+
+void FrameProfiler::disable_hardware_counters() {
+  // close the group members before the leader
+  for (size_t x = num_hardware_counters; x > 0; x--) {
+    if (this->hardware_counter_fds[x - 1] >= 0) {
+      close(this->hardware_counter_fds[x - 1]);
+      this->hardware_counter_fds[x - 1] = -1;
+    }
+  }
+}
+
+bool FrameProfiler::hardware_counters_enabled() const {
+  return this->hardware_counter_fds[0] >= 0;
+}
+
+void FrameProfiler::read_hardware_counters(uint64_t* counts) const {
+  // with PERF_FORMAT_GROUP, the leader returns the number of counters, then
+  // each counter's value
+  uint64_t data[num_hardware_counters + 1];
+  if (read(this->hardware_counter_fds[0], data, sizeof(data)) != sizeof(data)) {
+    memset(counts, 0, sizeof(uint64_t) * num_hardware_counters);
+    return;
+  }
+  memcpy(counts, &data[1], sizeof(uint64_t) * num_hardware_counters);
+}
+
+void FrameProfiler::begin_frame() {
+  this->current_phase = FramePhase::Impulses;
+  if (this->hardware_counters_enabled()) {
+    this->read_hardware_counters(this->phase_start_counts);
+  }
+  this->phase_start_nsecs = now_nsecs();
+}
+
+void FrameProfiler::begin_phase(FramePhase phase) {
+  this->end_phase();
+  this->current_phase = phase;
+}
+
+void FrameProfiler::end_frame() {
+  this->end_phase();
+  this->profile.frames++;
+}
+
+void FrameProfiler::end_phase() {
+  // the counters are only read once per phase boundary (reading them is a
+  // system call), so the next phase also counts the bookkeeping below. the
+  // clock is cheap to read, so the times don't include it
+  uint64_t end_nsecs = now_nsecs();
+  size_t phase_index = static_cast<size_t>(this->current_phase);
+  this->profile.phase_nsecs[phase_index] += end_nsecs - this->phase_start_nsecs;
+
+  if (this->hardware_counters_enabled()) {
+    uint64_t counts[num_hardware_counters];
+    this->read_hardware_counters(counts);
+    for (size_t x = 0; x < num_hardware_counters; x++) {
+      this->profile.phase_hardware_counts[phase_index][x] +=
+          counts[x] - this->phase_start_counts[x];
+      this->phase_start_counts[x] = counts[x];
+    }
+  }
+  this->phase_start_nsecs = now_nsecs();
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// optional instrumentation for exec_frame. when the engine is built with
+// TREADS_PROFILE defined (make PROFILE=1), exec_frame records how long each of
+// its phases takes, and a few of the hot functions count how much work they
+// do. without TREADS_PROFILE, the PROFILE_* macros below expand to nothing, so
+// there's no cost at all; the FrameProfiler class still exists, but its
+// profile is never updated.
+//
+// each thread has its own profiler (so LevelBatch's threads don't contend on
+// it), and it covers every LevelState that runs on that thread. hardware
+// counters (cycles, instructions, etc.) are off by default because reading
+// them costs a system call per phase; enable_hardware_counters turns them on
+// if the kernel allows it.
+
+// these are the phases of exec_frame, in order (see the comment at the top of
+// exec_frame for what each one does)
+enum class FramePhase {
+  Impulses = 0,
+  Pushes,
+  Decay,
+  Specials,
+  BlockMotion,
+  MonsterMotion,
+  TimedBlocks,
+  Explosions,
+};
+static const size_t num_frame_phases = 8;
+
+const char* name_for_frame_phase(FramePhase phase);
+
+enum HardwareCounter {
+  Cycles = 0,
+  Instructions,
+  CacheMisses,
+  BranchMisses,
+};
+static const size_t num_hardware_counters = 4;
+
+const char* name_for_hardware_counter(HardwareCounter counter);
+
+struct FrameProfile {
+  uint64_t frames;
+  uint64_t phase_nsecs[num_frame_phases];
+  // these are only updated while hardware counters are enabled
+  uint64_t phase_hardware_counts[num_frame_phases][num_hardware_counters];
+
+  // calls to check_stationary_collision and check_moving_collision
+  uint64_t collision_tests;
+  // cells expanded by find_path
+  uint64_t path_expansions;
+  // cells given a distance when the player distance field is rebuilt or
+  // repaired
+  uint64_t distance_field_expansions;
+
+  FrameProfile();
+  void clear();
+  // adds another profile's times and counts to this one
+  void add(const FrameProfile& other);
+};
+
+class FrameProfiler {
+public:
+  // returns the profiler for the calling thread
+  static FrameProfiler& for_thread();
+
+  FrameProfiler(const FrameProfiler&) = delete;
+  FrameProfiler(FrameProfiler&&) = delete;
+  FrameProfiler& operator=(const FrameProfiler&) = delete;
+  FrameProfiler& operator=(FrameProfiler&&) = delete;
+  ~FrameProfiler();
+
+  const FrameProfile& get_profile() const;
+  FrameProfile& get_profile();
+  void clear();
+
+  // opens the hardware counters for this thread. returns false if the kernel
+  // doesn't support them or doesn't allow this process to use them (see
+  // /proc/sys/kernel/perf_event_paranoid), in which case only times and
+  // counts are recorded
+  bool enable_hardware_counters();
+  void disable_hardware_counters();
+  bool hardware_counters_enabled() const;
+
+  // exec_frame calls these (through the macros below) at the start of the
+  // frame, at the start of each phase, and at the end of the frame
+  void begin_frame();
+  void begin_phase(FramePhase phase);
+  void end_frame();
+
+private:
+  FrameProfiler();
+
+  FrameProfile profile;
+
+  FramePhase current_phase;
+  uint64_t phase_start_nsecs;
+  uint64_t phase_start_counts[num_hardware_counters];
+
+  // one perf_event fd per hardware counter, or -1 if it isn't open. the first
+  // one is the group leader, so reading it reads all of them at once
+  int hardware_counter_fds[num_hardware_counters];
+
+  void end_phase();
+  void read_hardware_counters(uint64_t* counts) const;
+};
+
+#ifdef TREADS_PROFILE
+#define PROFILE_BEGIN_FRAME() FrameProfiler::for_thread().begin_frame()
+#define PROFILE_PHASE(phase) \
+    FrameProfiler::for_thread().begin_phase(FramePhase::phase)
+#define PROFILE_END_FRAME() FrameProfiler::for_thread().end_frame()
+#define PROFILE_COUNT(counter, n) \
+    (FrameProfiler::for_thread().get_profile().counter += (n))
+#else
+#define PROFILE_BEGIN_FRAME()
+#define PROFILE_PHASE(phase)
+#define PROFILE_END_FRAME()
+#define PROFILE_COUNT(counter, n)
+#endif
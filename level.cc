@@ -3,33 +3,104 @@
 #include <inttypes.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include <algorithm>
+#include <functional>
+#include <phosg/Hash.hh>
 #include <phosg/Strings.hh>
 #include <random>
 #include <stdexcept>
 #include <string>
 #include <vector>
 
+#include "frame_profile.hh"
+#include "serialization.hh"
+
 using namespace std;
 
 
-static int64_t random_int(int64_t low, int64_t high) {
-  return low + (rand() % (high + 1 - low));
-}
+// with TREADS_VALIDATE, exec_frame records which entities it touched, so
+// validate_frame can check just those (see level.hh)
+#ifdef TREADS_VALIDATE
+#define VALIDATE_TOUCH_BLOCK(block_index) \
+    this->touched_blocks.emplace_back(this->blocks.handle[block_index])
+#define VALIDATE_TOUCH_MONSTER(monster_index) \
+    this->touched_monsters.emplace_back(monster_index)
+#else
+#define VALIDATE_TOUCH_BLOCK(block_index)
+#define VALIDATE_TOUCH_MONSTER(monster_index)
+#endif
 
-static int64_t random_int(const pair<int64_t, int64_t>& bounds) {
-  return random_int(bounds.first, bounds.second);
+static int64_t sgn(int64_t x) {
+    return (0 < x) - (x < 0);
 }
 
-static int64_t dist2(int64_t x1, int64_t y1, int64_t x2, int64_t y2) {
-  int64_t x_delta = x1 - x2;
-  int64_t y_delta = y1 - y2;
-  return (x_delta * x_delta) + (y_delta * y_delta);
-}
+// number of monsters that fit in each cell of the monster cell index before
+// it has to use the overflow list. monsters normally don't overlap each other,
+// so more than four in one cell is rare
+static const size_t monster_cell_slots = 4;
+
+// LineUp formations are matched against the 5x5 cells centered on the block
+// that just stopped. in a formation or a placement of one, bit (y * 5 + x) is
+// the cell at (x, y) in this window, so bit 12 is the block itself
+static const int64_t lineup_window_size = 5;
+static const int64_t lineup_window_center = 12;
+
+// the formations levels use unless they define their own: lines of 5, 4 and
+// 3 blocks, longer ones first, and horizontal before vertical
+static const vector<uint32_t> default_lineup_formations({
+  0x0000001F, 0x00108421,
+  0x0000000F, 0x00008421,
+  0x00000007, 0x00000421,
+});
 
+// returns every placement of the formations over the window that includes
+// the block in the center, in the order exec_frame checks them: formations in
+// order, and within each one, from the placement where the center is the
+// formation's last cell to the one where it's the first. placements that
+// don't fit in the window are skipped, so e.g. a line of 5 is only matched
+// with the block in the middle
+static vector<uint32_t> lineup_placements_for_formations(
+    const vector<uint32_t>& formations) {
+  vector<uint32_t> ret;
+  for (uint32_t formation : formations) {
+    for (int64_t center = lineup_window_size * lineup_window_size - 1;
+         center >= 0; center--) {
+      if (!(formation & (1 << center))) {
+        continue;
+      }
+      int64_t dx = (lineup_window_center % lineup_window_size) -
+          (center % lineup_window_size);
+      int64_t dy = (lineup_window_center / lineup_window_size) -
+          (center / lineup_window_size);
+      uint32_t placement = 0;
+      bool fits = true;
+      for (int64_t z = 0; fits && (z < lineup_window_size * lineup_window_size); z++) {
+        if (!(formation & (1 << z))) {
+          continue;
+        }
+        int64_t x = (z % lineup_window_size) + dx;
+        int64_t y = (z / lineup_window_size) + dy;
+        fits = (x >= 0) && (x < lineup_window_size) && (y >= 0) &&
+            (y < lineup_window_size);
+        placement |= fits ? (1 << (y * lineup_window_size + x)) : 0;
+      }
+      if (fits) {
+        ret.emplace_back(placement);
+      }
+    }
+  }
+  return ret;
+}
 
-static int64_t sgn(int64_t x) {
-    return (0 < x) - (x < 0);
+// the placements of the default formations are the same for every level, so
+// they're only computed once
+static shared_ptr<const vector<uint32_t>> default_lineup_placements() {
+  static const shared_ptr<const vector<uint32_t>> placements =
+      make_shared<const vector<uint32_t>>(
+        lineup_placements_for_formations(default_lineup_formations));
+  return placements;
 }
 
 static const vector<Impulse> all_directions({
@@ -237,6 +308,138 @@ static string name_for_flags(int64_t f, const char* (*name_for_flag)(int64_t)) {
 
 
 
+LevelRNG::LevelRNG() : num_draws(0) { }
+
+void LevelRNG::seed(uint64_t seed) {
+  this->engine.seed(seed);
+  this->num_draws = 0;
+}
+
+void LevelRNG::restore(uint64_t seed, uint64_t num_draws) {
+  this->engine.seed(seed);
+  this->engine.discard(num_draws);
+  this->num_draws = num_draws;
+}
+
+uint64_t LevelRNG::get_num_draws() const {
+  return this->num_draws;
+}
+
+
+
+static const uint32_t null_slot = 0xFFFFFFFF;
+
+EntityHandle::EntityHandle() : slot(null_slot), generation(0) { }
+
+EntityHandle::EntityHandle(uint32_t slot, uint32_t generation) : slot(slot),
+    generation(generation) { }
+
+bool EntityHandle::is_null() const {
+  return this->slot == null_slot;
+}
+
+string EntityHandle::str() const {
+  if (this->is_null()) {
+    return "<EntityHandle: null>";
+  }
+  return string_printf("<EntityHandle: slot=%" PRIu32 " generation=%" PRIu32 ">",
+      this->slot, this->generation);
+}
+
+bool EntityHandle::operator==(const EntityHandle& other) const {
+  return (this->slot == other.slot) && (this->generation == other.generation);
+}
+
+bool EntityHandle::operator!=(const EntityHandle& other) const {
+  return !this->operator==(other);
+}
+
+void HandleMap::clear() {
+  this->slot_indexes.clear();
+  this->slot_generations.clear();
+  this->free_slots.clear();
+}
+
+void HandleMap::reserve(size_t count) {
+  this->slot_indexes.reserve(count);
+  this->slot_generations.reserve(count);
+  this->free_slots.reserve(count);
+}
+
+EntityHandle HandleMap::add(size_t index) {
+  uint32_t slot;
+  if (!this->free_slots.empty()) {
+    slot = this->free_slots.back();
+    this->free_slots.pop_back();
+    this->slot_indexes[slot] = index;
+  } else {
+    if (this->slot_indexes.size() >= null_slot) {
+      throw runtime_error("too many entities");
+    }
+    slot = this->slot_indexes.size();
+    this->slot_indexes.emplace_back(index);
+    this->slot_generations.emplace_back(0);
+  }
+  return EntityHandle(slot, this->slot_generations[slot]);
+}
+
+void HandleMap::remove(EntityHandle handle) {
+  if (this->index_for(handle) < 0) {
+    throw logic_error("removed handle does not exist");
+  }
+  this->slot_indexes[handle.slot] = -1;
+  this->slot_generations[handle.slot]++;
+  this->free_slots.emplace_back(handle.slot);
+}
+
+void HandleMap::move(EntityHandle handle, size_t index) {
+  if (this->index_for(handle) < 0) {
+    throw logic_error("moved handle does not exist");
+  }
+  this->slot_indexes[handle.slot] = index;
+}
+
+int64_t HandleMap::index_for(EntityHandle handle) const {
+  if ((handle.slot >= this->slot_indexes.size()) ||
+      (this->slot_generations[handle.slot] != handle.generation)) {
+    return -1;
+  }
+  return this->slot_indexes[handle.slot];
+}
+
+void HandleMap::serialize(BinaryWriter& w) const {
+  w.put_vector(this->slot_indexes);
+  w.put_vector(this->slot_generations);
+  w.put_vector(this->free_slots);
+}
+
+void HandleMap::deserialize(BinaryReader& r) {
+  r.get_vector(this->slot_indexes);
+  r.get_vector(this->slot_generations);
+  r.get_vector(this->free_slots);
+  if (this->slot_generations.size() != this->slot_indexes.size()) {
+    throw runtime_error("saved handle map is inconsistent");
+  }
+  for (uint32_t slot : this->free_slots) {
+    if (slot >= this->slot_indexes.size()) {
+      throw runtime_error("saved handle map is inconsistent");
+    }
+  }
+}
+
+// reads one column of a table, which must have the same number of entries as
+// the table's other columns
+template <typename T>
+static void deserialize_column(BinaryReader& r, vector<T>& column,
+    size_t size) {
+  r.get_vector(column);
+  if (column.size() != size) {
+    throw runtime_error("saved table is inconsistent");
+  }
+}
+
+
+
 const char* Monster::name_for_flag(int64_t f) {
   switch (f) {
     case 0:
@@ -298,105 +501,158 @@ const char* Monster::name_for_movement_policy(MovementPolicy policy) {
   }
 }
 
-Monster::Monster(int64_t x, int64_t y, int64_t flags) :
-    death_frame(-1), x(x), y(y), x_speed(0), y_speed(0), move_speed(4),
-    push_speed(8), block_destroy_rate(0.02), integrity(0),
-    facing_direction(Impulse::Up), control_impulse(0), flags(flags),
-    movement_policy(MovementPolicy::Random) {
+size_t MonsterTable::size() const {
+  return this->x.size();
+}
+
+void MonsterTable::clear() {
+  this->x.clear();
+  this->y.clear();
+  this->x_speed.clear();
+  this->y_speed.clear();
+  this->flags.clear();
+  this->death_frame.clear();
+  this->integrity.clear();
+  this->facing_direction.clear();
+  this->control_impulse.clear();
+  this->move_speed.clear();
+  this->push_speed.clear();
+  this->block_destroy_rate.clear();
+  this->movement_policy.clear();
+  this->special_mask.clear();
+  this->special_frames_remaining.clear();
+  this->handle.clear();
+  this->handles.clear();
+  this->time_stop_holder_count = 0;
+}
+
+size_t MonsterTable::add(int64_t x, int64_t y, int64_t flags) {
+  this->x.emplace_back(x);
+  this->y.emplace_back(y);
+  this->x_speed.emplace_back(0);
+  this->y_speed.emplace_back(0);
+  this->flags.emplace_back(flags);
+  this->death_frame.emplace_back(-1);
+  this->integrity.emplace_back(0);
+  this->facing_direction.emplace_back(Impulse::Up);
+  this->special_mask.emplace_back(0);
+  this->control_impulse.emplace_back(0);
+  this->move_speed.emplace_back(4);
+  this->push_speed.emplace_back(8);
+  this->block_destroy_rate.emplace_back(0.02);
+  this->movement_policy.emplace_back(Monster::MovementPolicy::Random);
+  this->special_frames_remaining.emplace_back();
+
   // players always have integrity = 1.0 so they can move at the level start
-  if (this->has_flags(Flag::IsPlayer)) {
-    this->integrity = 1.0;
-    this->movement_policy = MovementPolicy::Player;
+  size_t index = this->x.size() - 1;
+  this->handle.emplace_back(this->handles.add(index));
+  if (flags & Monster::Flag::IsPlayer) {
+    this->integrity[index] = 1.0;
+    this->movement_policy[index] = Monster::MovementPolicy::Player;
   }
+  return index;
 }
 
-string Monster::str() const {
-  string flags_str = name_for_flags(this->flags, this->name_for_flag);
+int64_t MonsterTable::index_for_handle(EntityHandle handle) const {
+  return this->handles.index_for(handle);
+}
+
+string MonsterTable::str(size_t index) const {
+  string flags_str = name_for_flags(this->flags[index], Monster::name_for_flag);
   return string_printf("<Monster: x=%" PRId64 " y=%" PRId64 " x_speed=%" PRId64
       " y_speed=%" PRId64 " move_speed=%" PRId64 " push_speed=%" PRId64
       " facing_direction=%" PRIu64 " control_impulse=%" PRIu64 " flags=%s>",
-      this->x, this->y, this->x_speed, this->y_speed, this->move_speed,
-      this->push_speed, static_cast<int64_t>(this->facing_direction),
-      this->control_impulse, flags_str.c_str());
+      this->x[index], this->y[index], this->x_speed[index], this->y_speed[index],
+      this->move_speed[index], this->push_speed[index],
+      static_cast<int64_t>(this->facing_direction[index]),
+      this->control_impulse[index], flags_str.c_str());
 }
 
-bool Monster::has_special(BlockSpecial special) const {
-  return this->special_to_frames_remaining.count(special);
+bool MonsterTable::has_special(size_t index, BlockSpecial special) const {
+  size_t slot = Monster::timed_special_slot(special);
+  return (slot < Monster::num_timed_specials) &&
+      (this->special_mask[index] & (1 << slot));
 }
 
-void Monster::add_special(BlockSpecial special, int64_t frames) {
+void MonsterTable::add_special(size_t index, BlockSpecial special,
+    int64_t frames) {
+  auto monster = (*this)[index];
+  bool had_special = monster.has_special(special);
   switch (special) {
     case BlockSpecial::TimeStop:
+      if (!had_special) {
+        this->time_stop_holder_count++;
+      }
+      break;
     case BlockSpecial::ThrowBombs:
-      // these don't affect the monster's flags/params at all
+      // this doesn't affect the monster's flags/params at all
       break;
     case BlockSpecial::Invincibility:
-      this->set_flags(Monster::Flag::Invincible);
+      monster.set_flags(Monster::Flag::Invincible);
       break;
-    case BlockSpecial::Speed: {
-      auto emplace_ret = this->special_to_frames_remaining.emplace(special, 300);
-      if (emplace_ret.second) {
-        // it didn't have the special already; increase its move speed
-        this->move_speed *= 2;
-        this->push_speed *= 2;
-        this->block_destroy_rate *= 2;
-      } else {
-        // it did already have the special; just change the timeout
-        emplace_ret.first->second = 300;
+    case BlockSpecial::Speed:
+      // if it already had the special, just change the timeout
+      if (!had_special) {
+        monster.move_speed() *= 2;
+        monster.push_speed() *= 2;
+        monster.block_destroy_rate() *= 2;
       }
       break;
-    }
     case BlockSpecial::KillsMonsters:
       // if the monster already kills monsters, then this bonus does nothing
-      if (!this->has_flags(Monster::Flag::KillsMonsters) ||
-          this->has_special(BlockSpecial::KillsMonsters)) {
-        this->set_flags(Monster::Flag::KillsMonsters);
-        this->special_to_frames_remaining[special] = 300; // 10 seconds
+      if (!monster.has_flags(Monster::Flag::KillsMonsters) || had_special) {
+        monster.set_flags(Monster::Flag::KillsMonsters);
       }
       break;
     default:
       throw logic_error("unimplemented special addition action");
   }
 
-  this->special_to_frames_remaining[special] = frames;
+  size_t slot = Monster::timed_special_slot(special);
+  this->special_mask[index] |= (1 << slot);
+  this->special_frames_remaining[index][slot] = frames;
 }
 
-bool Monster::is_alive() const {
-  return this->death_frame < 0;
-}
+void MonsterTable::attenuate_and_delete_specials(size_t index) {
+  // most monsters have no specials, so this is usually the only check
+  uint8_t& special_mask = this->special_mask[index];
+  if (!special_mask) {
+    return;
+  }
 
-void Monster::attenuate_and_delete_specials() {
-  for (auto special_it = this->special_to_frames_remaining.begin();
-       special_it != this->special_to_frames_remaining.end();) {
-    special_it->second--;
-    if (special_it->second == 0) {
-      switch (special_it->first) {
-        case BlockSpecial::TimeStop:
-        case BlockSpecial::ThrowBombs:
-          // these don't affect the monster's flags/params at all
-          break;
-        case BlockSpecial::KillsMonsters:
-          this->clear_flags(Monster::Flag::KillsMonsters);
-          break;
-        case BlockSpecial::Invincibility:
-          this->clear_flags(Monster::Flag::Invincible);
-          break;
-        case BlockSpecial::Speed:
-          this->move_speed /= 2;
-          this->push_speed /= 2;
-          this->block_destroy_rate /= 2;
-          break;
-        default:
-          throw logic_error("unimplemented special removal action");
-      }
-      special_it = this->special_to_frames_remaining.erase(special_it);
-    } else {
-      special_it++;
+  auto monster = (*this)[index];
+  auto& special_frames_remaining = this->special_frames_remaining[index];
+  for (size_t slot = 0; slot < Monster::num_timed_specials; slot++) {
+    if (!(special_mask & (1 << slot)) || (--special_frames_remaining[slot] != 0)) {
+      continue;
+    }
+    switch (Monster::timed_special_for_slot(slot)) {
+      case BlockSpecial::TimeStop:
+        this->time_stop_holder_count--;
+        break;
+      case BlockSpecial::ThrowBombs:
+        // this doesn't affect the monster's flags/params at all
+        break;
+      case BlockSpecial::KillsMonsters:
+        monster.clear_flags(Monster::Flag::KillsMonsters);
+        break;
+      case BlockSpecial::Invincibility:
+        monster.clear_flags(Monster::Flag::Invincible);
+        break;
+      case BlockSpecial::Speed:
+        monster.move_speed() /= 2;
+        monster.push_speed() /= 2;
+        monster.block_destroy_rate() /= 2;
+        break;
+      default:
+        throw logic_error("unimplemented special removal action");
     }
+    special_mask &= ~(1 << slot);
   }
 }
 
-void Monster::choose_random_direction(uint8_t available_directions) {
+void MonsterTable::choose_random_direction(size_t index,
+    uint8_t available_directions, LevelRNG& rng) {
   // if there are no directions available, do nothing
   if (available_directions == Impulse::None) {
     return;
@@ -404,42 +660,104 @@ void Monster::choose_random_direction(uint8_t available_directions) {
 
   // if there's only one direction available, go that way
   if ((available_directions & (available_directions - 1)) == 0) {
-    this->control_impulse = available_directions;
+    this->control_impulse[index] = available_directions;
     return;
   }
 
-  // prepare for randomness
-  static random_device rd;
-  static mt19937 g(rd());
-
   // if there are multiple directions available, forbid the direction that
-  // the monster just came from, then choose a direction at random
-  available_directions &= ~(opposite_direction(this->facing_direction));
-  Impulse direction_order[] = {Impulse::Left, Impulse::Right, Impulse::Up,
-      Impulse::Down};
-  shuffle(direction_order, direction_order + 4, g);
-  for (auto check_direction : direction_order) {
+  // the monster just came from, then choose one of the rest at random. we pick
+  // the n-th available direction instead of using std::shuffle because
+  // shuffle's results differ between standard library implementations
+  available_directions &= ~(opposite_direction(this->facing_direction[index]));
+  size_t num_available = 0;
+  for (auto check_direction : all_directions) {
     if (available_directions & check_direction) {
-      this->control_impulse = check_direction;
+      num_available++;
+    }
+  }
+  size_t which = rng() % num_available;
+  for (auto check_direction : all_directions) {
+    if ((available_directions & check_direction) && (which-- == 0)) {
+      this->control_impulse[index] = check_direction;
       return;
     }
   }
 }
 
-bool Monster::has_flags(uint64_t flags) const {
-  return (this->flags & flags) == flags;
-}
+void MonsterTable::serialize(BinaryWriter& w) const {
+  w.put_vector(this->x);
+  w.put_vector(this->y);
+  w.put_vector(this->x_speed);
+  w.put_vector(this->y_speed);
+  w.put_vector(this->flags);
+  w.put_vector(this->death_frame);
+  w.put_vector(this->integrity);
+  w.put_vector(this->facing_direction);
+  w.put_vector(this->control_impulse);
+  w.put_vector(this->move_speed);
+  w.put_vector(this->push_speed);
+  w.put_vector(this->block_destroy_rate);
+  w.put_vector(this->movement_policy);
+
+  // each monster's specials are written as a count, then each special and its
+  // frames remaining, in enum order
+  for (size_t index = 0; index < this->size(); index++) {
+    uint8_t special_mask = this->special_mask[index];
+    size_t count = 0;
+    for (size_t slot = 0; slot < Monster::num_timed_specials; slot++) {
+      count += (special_mask >> slot) & 1;
+    }
+    w.put_varint(count);
+    for (size_t slot = 0; slot < Monster::num_timed_specials; slot++) {
+      if (special_mask & (1 << slot)) {
+        w.put_varint(static_cast<uint64_t>(Monster::timed_special_for_slot(slot)));
+        w.put_value(this->special_frames_remaining[index][slot]);
+      }
+    }
+  }
 
-bool Monster::has_any_flags(uint64_t flags) const {
-  return (this->flags & flags) != 0;
+  w.put_vector(this->handle);
+  this->handles.serialize(w);
 }
 
-void Monster::set_flags(uint64_t flags) {
-  this->flags |= flags;
-}
+void MonsterTable::deserialize(BinaryReader& r) {
+  r.get_vector(this->x);
+  size_t size = this->x.size();
+  deserialize_column(r, this->y, size);
+  deserialize_column(r, this->x_speed, size);
+  deserialize_column(r, this->y_speed, size);
+  deserialize_column(r, this->flags, size);
+  deserialize_column(r, this->death_frame, size);
+  deserialize_column(r, this->integrity, size);
+  deserialize_column(r, this->facing_direction, size);
+  deserialize_column(r, this->control_impulse, size);
+  deserialize_column(r, this->move_speed, size);
+  deserialize_column(r, this->push_speed, size);
+  deserialize_column(r, this->block_destroy_rate, size);
+  deserialize_column(r, this->movement_policy, size);
+
+  this->special_mask.assign(size, 0);
+  this->special_frames_remaining.resize(size);
+  this->time_stop_holder_count = 0;
+  for (size_t index = 0; index < size; index++) {
+    uint64_t count = r.get_varint();
+    for (uint64_t x = 0; x < count; x++) {
+      // this is the same as Monster::timed_special_slot, but for values that
+      // may not be valid BlockSpecials at all
+      uint64_t slot = r.get_varint() -
+          static_cast<uint64_t>(BlockSpecial::Invincibility);
+      if (slot >= Monster::num_timed_specials) {
+        throw runtime_error("saved monster has an invalid special");
+      }
+      this->special_mask[index] |= (1 << slot);
+      this->special_frames_remaining[index][slot] = r.get_value<int64_t>();
+    }
+    this->time_stop_holder_count += this->has_special(index,
+        BlockSpecial::TimeStop);
+  }
 
-void Monster::clear_flags(uint64_t flags) {
-  this->flags &= ~flags;
+  deserialize_column(r, this->handle, size);
+  this->handles.deserialize(r);
 }
 
 
@@ -467,24 +785,114 @@ const char* Block::name_for_flag(int64_t f) {
   }
 }
 
-Block::Block(int64_t x, int64_t y, BlockSpecial special, int64_t flags) :
-    x(x), y(y), x_speed(0), y_speed(0), owner(NULL),
-    monsters_killed_this_push(0), bounce_speed_absorption(2), bomb_speed(16),
-    decay_rate(0.0), integrity(1.0), special(special), flags(flags),
-    frames_until_action(0) { }
+size_t BlockTable::size() const {
+  return this->x.size();
+}
+
+void BlockTable::clear() {
+  this->x.clear();
+  this->y.clear();
+  this->x_speed.clear();
+  this->y_speed.clear();
+  this->flags.clear();
+  this->integrity.clear();
+  this->decay_rate.clear();
+  this->frames_until_action.clear();
+  this->special.clear();
+  this->owner.clear();
+  this->monsters_killed_this_push.clear();
+  this->bounce_speed_absorption.clear();
+  this->bomb_speed.clear();
+  this->handle.clear();
+  this->handles.clear();
+}
+
+void BlockTable::reserve(size_t count) {
+  this->x.reserve(count);
+  this->y.reserve(count);
+  this->x_speed.reserve(count);
+  this->y_speed.reserve(count);
+  this->flags.reserve(count);
+  this->integrity.reserve(count);
+  this->decay_rate.reserve(count);
+  this->frames_until_action.reserve(count);
+  this->special.reserve(count);
+  this->owner.reserve(count);
+  this->monsters_killed_this_push.reserve(count);
+  this->bounce_speed_absorption.reserve(count);
+  this->bomb_speed.reserve(count);
+  this->handle.reserve(count);
+  this->handles.reserve(count);
+}
 
-string Block::str() const {
-  string flags_str = name_for_flags(this->flags, this->name_for_flag);
+size_t BlockTable::add(int64_t x, int64_t y, BlockSpecial special,
+    int64_t flags) {
+  this->x.emplace_back(x);
+  this->y.emplace_back(y);
+  this->x_speed.emplace_back(0);
+  this->y_speed.emplace_back(0);
+  this->flags.emplace_back(flags);
+  this->integrity.emplace_back(1.0);
+  this->decay_rate.emplace_back(0.0);
+  this->frames_until_action.emplace_back(0);
+  this->special.emplace_back(special);
+  this->owner.emplace_back();
+  this->monsters_killed_this_push.emplace_back(0);
+  this->bounce_speed_absorption.emplace_back(2);
+  this->bomb_speed.emplace_back(16);
+  size_t index = this->x.size() - 1;
+  this->handle.emplace_back(this->handles.add(index));
+  return index;
+}
+
+template <typename T>
+static void move_last_into(vector<T>& v, size_t index) {
+  if (index != v.size() - 1) {
+    v[index] = move(v.back());
+  }
+  v.pop_back();
+}
+
+void BlockTable::erase(size_t index) {
+  this->handles.remove(this->handle[index]);
+  if (index != this->size() - 1) {
+    this->handles.move(this->handle.back(), index);
+  }
+
+  move_last_into(this->x, index);
+  move_last_into(this->y, index);
+  move_last_into(this->x_speed, index);
+  move_last_into(this->y_speed, index);
+  move_last_into(this->flags, index);
+  move_last_into(this->integrity, index);
+  move_last_into(this->decay_rate, index);
+  move_last_into(this->frames_until_action, index);
+  move_last_into(this->special, index);
+  move_last_into(this->owner, index);
+  move_last_into(this->monsters_killed_this_push, index);
+  move_last_into(this->bounce_speed_absorption, index);
+  move_last_into(this->bomb_speed, index);
+  move_last_into(this->handle, index);
+}
+
+int64_t BlockTable::index_for_handle(EntityHandle handle) const {
+  return this->handles.index_for(handle);
+}
+
+string BlockTable::str(size_t index) const {
+  string flags_str = name_for_flags(this->flags[index], Block::name_for_flag);
   return string_printf("<Block: x=%" PRId64 " y=%" PRId64 " x_speed=%" PRId64
       " y_speed=%" PRId64 " decay_rate=%g integrity=%g special=%" PRIu64
-      " flags=%s>", this->x, this->y, this->x_speed, this->y_speed,
-      this->decay_rate, this->integrity, static_cast<int64_t>(this->special),
-      flags_str.c_str());
+      " flags=%s>", this->x[index], this->y[index], this->x_speed[index],
+      this->y_speed[index], this->decay_rate[index], this->integrity[index],
+      static_cast<int64_t>(this->special[index]), flags_str.c_str());
 }
 
-void Block::set_special(BlockSpecial special, int64_t timer_value) {
-  this->special = special;
-  switch (this->special) {
+void BlockTable::set_special(size_t index, BlockSpecial special,
+    int64_t timer_value) {
+  auto block = (*this)[index];
+  block.special() = special;
+  switch (special) {
     case BlockSpecial::None:
     case BlockSpecial::LineUp:
     case BlockSpecial::Points:
@@ -500,460 +908,1736 @@ void Block::set_special(BlockSpecial special, int64_t timer_value) {
 
     case BlockSpecial::CreatesMonsters:
     case BlockSpecial::Timer:
-      this->frames_until_action = timer_value;
+      block.frames_until_action() = timer_value;
       break;
 
     case BlockSpecial::Indestructible:
-      this->clear_flags(Block::Flag::Destructible);
+      block.clear_flags(Block::Flag::Destructible);
       break;
 
     case BlockSpecial::IndestructibleAndImmovable:
-      this->clear_flags(Block::Flag::Pushable | Block::Flag::Destructible);
+      block.clear_flags(Block::Flag::Pushable | Block::Flag::Destructible);
       break;
 
     case BlockSpecial::Immovable:
-      this->clear_flags(Block::Flag::Pushable);
+      block.clear_flags(Block::Flag::Pushable);
       break;
 
     case BlockSpecial::Brittle:
-      this->set_flags(Block::Flag::Brittle);
+      block.set_flags(Block::Flag::Brittle);
       break;
 
     case BlockSpecial::Bouncy:
-      this->set_flags(Block::Flag::Bouncy);
+      block.set_flags(Block::Flag::Bouncy);
       break;
 
     case BlockSpecial::Bomb:
-      this->set_flags(Block::Flag::IsBomb);
+      block.set_flags(Block::Flag::IsBomb);
       break;
 
     case BlockSpecial::BouncyBomb:
-      this->set_flags(Block::Flag::IsBomb | Block::Flag::DelayedBomb);
+      block.set_flags(Block::Flag::IsBomb | Block::Flag::DelayedBomb);
       break;
   }
 }
 
-bool Block::has_flags(uint64_t flags) const {
-  return (this->flags & flags) == flags;
+void BlockTable::serialize(BinaryWriter& w) const {
+  w.put_vector(this->x);
+  w.put_vector(this->y);
+  w.put_vector(this->x_speed);
+  w.put_vector(this->y_speed);
+  w.put_vector(this->flags);
+  w.put_vector(this->integrity);
+  w.put_vector(this->decay_rate);
+  w.put_vector(this->frames_until_action);
+  w.put_vector(this->special);
+  w.put_vector(this->owner);
+  w.put_vector(this->monsters_killed_this_push);
+  w.put_vector(this->bounce_speed_absorption);
+  w.put_vector(this->bomb_speed);
+  w.put_vector(this->handle);
+  this->handles.serialize(w);
+}
+
+void BlockTable::deserialize(BinaryReader& r) {
+  r.get_vector(this->x);
+  size_t size = this->x.size();
+  deserialize_column(r, this->y, size);
+  deserialize_column(r, this->x_speed, size);
+  deserialize_column(r, this->y_speed, size);
+  deserialize_column(r, this->flags, size);
+  deserialize_column(r, this->integrity, size);
+  deserialize_column(r, this->decay_rate, size);
+  deserialize_column(r, this->frames_until_action, size);
+  deserialize_column(r, this->special, size);
+  deserialize_column(r, this->owner, size);
+  deserialize_column(r, this->monsters_killed_this_push, size);
+  deserialize_column(r, this->bounce_speed_absorption, size);
+  deserialize_column(r, this->bomb_speed, size);
+  deserialize_column(r, this->handle, size);
+  this->handles.deserialize(r);
+}
+
+
+
+size_t ExplosionTable::size() const {
+  return this->x.size();
 }
 
-bool Block::has_any_flags(uint64_t flags) const {
-  return (this->flags & flags) != 0;
+bool ExplosionTable::empty() const {
+  return this->x.empty();
 }
 
-void Block::set_flags(uint64_t flags) {
-  this->flags |= flags;
+void ExplosionTable::clear() {
+  this->x.clear();
+  this->y.clear();
+  this->decay_rate.clear();
+  this->integrity.clear();
 }
 
-void Block::clear_flags(uint64_t flags) {
-  this->flags &= ~flags;
+size_t ExplosionTable::add(int64_t x, int64_t y, float decay_rate) {
+  this->x.emplace_back(x);
+  this->y.emplace_back(y);
+  this->decay_rate.emplace_back(decay_rate);
+  this->integrity.emplace_back(1.5);
+  return this->x.size() - 1;
 }
 
+void ExplosionTable::erase(size_t index) {
+  move_last_into(this->x, index);
+  move_last_into(this->y, index);
+  move_last_into(this->decay_rate, index);
+  move_last_into(this->integrity, index);
+}
 
+string ExplosionTable::str(size_t index) const {
+  return string_printf("<Explosion: x=%" PRId64 " y=%" PRId64 ">",
+      this->x[index], this->y[index]);
+}
 
-Explosion::Explosion(int64_t x, int64_t y, float decay_rate) : x(x), y(y),
-    decay_rate(decay_rate), integrity(1.5) { }
+void ExplosionTable::serialize(BinaryWriter& w) const {
+  w.put_vector(this->x);
+  w.put_vector(this->y);
+  w.put_vector(this->decay_rate);
+  w.put_vector(this->integrity);
+}
 
-string Explosion::str() const {
-  return string_printf("<Explosion: x=%" PRId64 " y=%" PRId64 ">", this->x,
-      this->y);
+void ExplosionTable::deserialize(BinaryReader& r) {
+  r.get_vector(this->x);
+  size_t size = this->x.size();
+  deserialize_column(r, this->y, size);
+  deserialize_column(r, this->decay_rate, size);
+  deserialize_column(r, this->integrity, size);
 }
 
 
 
-LevelState::LevelState(const GenerationParameters& params) : params(params),
-    updates_per_second(30.0f), frames_executed(0), frames_between_monsters(300) {
+// hashes a single value's bytes into a running fnv1a64 hash
+template <typename T>
+static uint64_t hash_value(const T& value, uint64_t hash) {
+  return fnv1a64(&value, sizeof(value), hash);
+}
+
+uint64_t LevelState::GenerationParameters::hash() const {
+  uint64_t ret = fnv1a64(&this->grid_pitch, sizeof(this->grid_pitch));
+  ret = hash_value(this->w, ret);
+  ret = hash_value(this->h, ret);
+  ret = hash_value(this->player_x, ret);
+  ret = hash_value(this->player_y, ret);
+  ret = hash_value(this->player_squishable, ret);
+
+  // vector<bool> is packed, so its data can't be hashed directly
+  ret = hash_value(this->fixed_block_map, ret);
+  ret = hash_value(this->block_map.size(), ret);
+  for (bool cell : this->block_map) {
+    ret = hash_value(cell, ret);
+  }
+
+  // the order of an unordered_map depends on the standard library, so go
+  // through the specials in enum order instead
+  for (int64_t x = static_cast<int64_t>(BlockSpecial::None);
+       x <= static_cast<int64_t>(BlockSpecial::Everything); x++) {
+    auto it = this->special_type_to_count.find(static_cast<BlockSpecial>(x));
+    if (it != this->special_type_to_count.end()) {
+      ret = hash_value(x, ret);
+      ret = hash_value(it->second.first, ret);
+      ret = hash_value(it->second.second, ret);
+    }
+  }
+
+  ret = hash_value(this->basic_monster_count.first, ret);
+  ret = hash_value(this->basic_monster_count.second, ret);
+  ret = hash_value(this->power_monster_count.first, ret);
+  ret = hash_value(this->power_monster_count.second, ret);
+  ret = hash_value(this->basic_monster_score, ret);
+  ret = hash_value(this->power_monster_score, ret);
+  ret = hash_value(this->basic_monster_movement_policy, ret);
+  ret = hash_value(this->power_monster_movement_policy, ret);
+  ret = hash_value(this->power_monsters_can_push, ret);
+  ret = hash_value(this->power_monsters_become_creators, ret);
+  ret = hash_value(this->player_move_speed, ret);
+  ret = hash_value(this->basic_monster_move_speed, ret);
+  ret = hash_value(this->power_monster_move_speed, ret);
+  ret = hash_value(this->push_speed, ret);
+  ret = hash_value(this->bomb_speed, ret);
+  ret = hash_value(this->bounce_speed_absorption, ret);
+  ret = hash_value(this->block_destroy_rate, ret);
+
+  // levels that use the default LineUp formations hash the same as they did
+  // before levels could define their own, so their replays still match
+  if (!this->lineup_formations.empty()) {
+    ret = hash_value(this->lineup_formations.size(), ret);
+    for (uint32_t formation : this->lineup_formations) {
+      ret = hash_value(formation, ret);
+    }
+  }
+  return ret;
+}
+
+LevelState::LevelState(const GenerationParameters& params, uint64_t seed) :
+    LevelState(make_shared<const GenerationParameters>(params), seed) { }
+
+LevelState::LevelState(shared_ptr<const GenerationParameters> params,
+    uint64_t seed) : params(move(params)), seed(seed) {
+  this->initialize();
+}
+
+void LevelState::reset(shared_ptr<const GenerationParameters> params,
+    uint64_t seed) {
+  this->params = move(params);
+  this->seed = seed;
+  this->initialize();
+}
+
+void LevelState::initialize() {
+  const auto& params = *this->params;
+  this->rng.seed(this->seed);
+  this->updates_per_second = 30.0f;
+  this->frames_executed = 0;
+  this->frames_between_monsters = 300;
+
+  this->monsters.clear();
+  this->blocks.clear();
+  this->explosions.clear();
+  this->touched_blocks.clear();
+  this->touched_monsters.clear();
+  this->frame_events.events_mask = Event::NoEvents;
+  this->frame_events.scores.clear();
+  this->path_scratch.player_distances_frame = -1;
+  this->path_scratch.player_distances_valid = false;
+  this->path_scratch.dirty_cells.clear();
+
+  this->w_cells = params.w / params.grid_pitch;
+  this->h_cells = params.h / params.grid_pitch;
+  size_t num_cells = this->w_cells * this->h_cells;
+  this->block_grid.assign(num_cells, -1);
+  this->overflow_blocks.clear();
+  this->bitboard_words_per_row = (this->w_cells + 63) / 64;
+  this->bitboards.assign(num_bitboard_planes * this->h_cells *
+      this->bitboard_words_per_row, 0);
+  this->block_cover_counts.assign(num_cells, 0);
+  this->monster_cells.assign(num_cells * monster_cell_slots, -1);
+  this->overflow_monsters.clear();
+
+  this->lineup_placements = params.lineup_formations.empty() ?
+      default_lineup_placements() : make_shared<const vector<uint32_t>>(
+        lineup_placements_for_formations(params.lineup_formations));
+
+  // the scratch vectors and the event buffer keep their memory from one frame
+  // to the next. giving them some room up front means most levels never have
+  // to grow them during a frame
+  this->time_stop_holders.reserve(16);
+  this->candidate_indexes.reserve(16);
+  this->explosion_candidates.reserve(16);
+  this->frame_events.scores.reserve(16);
 
   // the player is a monster, technically
   uint64_t player_flags = Monster::Flag::IsPlayer | Monster::Flag::CanPushBlocks | Monster::Flag::CanDestroyBlocks | (params.player_squishable ? Monster::Flag::Squishable : 0);
-  this->player.reset(new Monster(params.player_x, params.player_y, player_flags));
-  this->monsters.emplace(this->player);
+  this->player_index = this->monsters.add(params.player_x, params.player_y,
+      player_flags);
 
   // set player parameters
-  this->player->block_destroy_rate = params.block_destroy_rate;
-  this->player->move_speed = params.player_move_speed;
-  this->player->push_speed = params.push_speed;
-
-  // create blocks according to the block map
-  int64_t w_cells = this->params.w / this->params.grid_pitch;
-  int64_t h_cells = this->params.h / this->params.grid_pitch;
-  if (params.block_map.size() != w_cells * h_cells) {
+  auto player = this->monsters[this->player_index];
+  player.block_destroy_rate() = params.block_destroy_rate;
+  player.move_speed() = params.player_move_speed;
+  player.push_speed() = params.push_speed;
+
+  // create blocks according to the block map. blocks can't overlap, so
+  // there can never be more blocks than cells; reserving that much space up
+  // front means that creating blocks later (e.g. with ThrowBombs) never has to
+  // allocate memory
+  if (params.block_map.size() != num_cells) {
     throw invalid_argument("block map size doesn\'t match level dimensions");
   }
-  for (int64_t y = 0; y < this->params.h / this->params.grid_pitch; y++) {
-    for (int64_t x = 0; x < this->params.w / this->params.grid_pitch; x++) {
-      int64_t z = y * (this->params.w / this->params.grid_pitch) + x;
-      if (params.block_map[z]) {
-        auto& block = *this->blocks.emplace(new Block(x * this->params.grid_pitch, y * this->params.grid_pitch)).first;
-        block->bounce_speed_absorption = params.bounce_speed_absorption;
-        block->bomb_speed = params.bomb_speed;
+  this->blocks.reserve(num_cells);
+  for (int64_t y = 0; y < this->h_cells; y++) {
+    for (int64_t x = 0; x < this->w_cells; x++) {
+      if (params.block_map[y * this->w_cells + x]) {
+        auto block = this->blocks[this->blocks.add(x * params.grid_pitch,
+            y * params.grid_pitch)];
+        block.bounce_speed_absorption() = params.bounce_speed_absorption;
+        block.bomb_speed() = params.bomb_speed;
       }
     }
   }
 
   // replace some blocks with monsters until there are enough of them (the +1 is
-  // necessary because the player is already in the monster set)
-  int64_t basic_monster_count = random_int(params.basic_monster_count);
-  int64_t power_monster_count = random_int(params.power_monster_count);
-  while (this->monsters.size() < basic_monster_count + power_monster_count + 1) {
-    auto block_it = this->blocks.begin();
-    advance(block_it, rand() % this->blocks.size()); // O(n), sigh...
-
-    bool is_power_monster = (this->monsters.size() >= basic_monster_count + 1);
-    auto& monster = *this->monsters.emplace(new Monster((*block_it)->x,
-        (*block_it)->y, this->flags_for_monster(is_power_monster))).first;
-    monster->movement_policy = is_power_monster ?
-        this->params.power_monster_movement_policy :
-        this->params.basic_monster_movement_policy;
-    monster->block_destroy_rate = params.block_destroy_rate;
-    monster->move_speed = is_power_monster ?
-        this->params.power_monster_move_speed :
-        this->params.basic_monster_move_speed;
-    monster->push_speed = params.push_speed;
-    block_it = this->blocks.erase(block_it);
-  }
-
-  // now apply the block specials. again, taking advantage of unordered-ness
-  auto remaining_blocks = this->blocks;
-  for (const auto& special_it : params.special_type_to_count) {
-    int64_t count = random_int(special_it.second);
-    for (size_t x = 0; x < count; x++) {
+  // necessary because the player is already in the monster table). the blocks
+  // are a dense array, so choosing one and deleting it (by moving the last
+  // block into its place) are both constant-time
+  int64_t basic_monster_count = this->random_int(params.basic_monster_count);
+  int64_t power_monster_count = this->random_int(params.power_monster_count);
+  while (this->monsters.size() <
+      static_cast<size_t>(basic_monster_count + power_monster_count + 1)) {
+    size_t block_index = this->rng() % this->blocks.size();
+
+    bool is_power_monster = (this->monsters.size() >=
+        static_cast<size_t>(basic_monster_count + 1));
+    auto monster = this->monsters[this->monsters.add(
+        this->blocks.x[block_index], this->blocks.y[block_index],
+        this->flags_for_monster(is_power_monster))];
+    monster.movement_policy() = is_power_monster ?
+        params.power_monster_movement_policy :
+        params.basic_monster_movement_policy;
+    monster.block_destroy_rate() = params.block_destroy_rate;
+    monster.move_speed() = is_power_monster ?
+        params.power_monster_move_speed :
+        params.basic_monster_move_speed;
+    monster.push_speed() = params.push_speed;
+    this->blocks.erase(block_index);
+  }
+
+  // the remaining blocks won't be moved or deleted during construction, so we
+  // can build the occupancy grid and the monster cell index now. the blocks
+  // are all aligned, each in its own cell, and have no specials yet, so this
+  // fills in the grid and the bitboards directly instead of going through
+  // add_block_to_grid, which has to handle blocks anywhere
+  size_t none_plane = bitboard_plane_for_special(BlockSpecial::None);
+  for (size_t block_index = 0; block_index < this->blocks.size(); block_index++) {
+    int64_t x_cell = this->blocks.x[block_index] / params.grid_pitch;
+    int64_t y_cell = this->blocks.y[block_index] / params.grid_pitch;
+    this->block_grid[y_cell * this->w_cells + x_cell] = block_index;
+    this->block_cover_counts[y_cell * this->w_cells + x_cell] = 1;
+    this->set_bitboard_bit(BitboardPlane::Occupied, x_cell, y_cell, true);
+    this->set_bitboard_bit(BitboardPlane::Pushable, x_cell, y_cell,
+        this->blocks.flags[block_index] & Block::Flag::Pushable);
+    this->set_bitboard_bit(BitboardPlane::Destructible, x_cell, y_cell,
+        this->blocks.flags[block_index] & Block::Flag::Destructible);
+    this->set_bitboard_bit(none_plane, x_cell, y_cell, true);
+  }
+  for (size_t monster_index = 0; monster_index < this->monsters.size(); monster_index++) {
+    this->add_monster_to_cells(monster_index);
+  }
+
+  // now apply the block specials to randomly-chosen blocks. each block gets at
+  // most one special. the candidates are the indexes of the blocks that don't
+  // have one yet, kept dense by moving the last one into the chosen one's
+  // place. this borrows candidate_indexes, which exec_frame doesn't need yet
+  auto& remaining_blocks = this->candidate_indexes;
+  remaining_blocks.resize(this->blocks.size());
+  for (size_t block_index = 0; block_index < this->blocks.size(); block_index++) {
+    remaining_blocks[block_index] = block_index;
+  }
+  // the order of an unordered_map depends on the standard library, so go
+  // through the specials in enum order (as hash() does); otherwise the same
+  // seed would place them differently on different platforms
+  for (int64_t special_value = static_cast<int64_t>(BlockSpecial::None);
+       special_value <= static_cast<int64_t>(BlockSpecial::Everything);
+       special_value++) {
+    BlockSpecial special = static_cast<BlockSpecial>(special_value);
+    auto special_it = params.special_type_to_count.find(special);
+    if (special_it == params.special_type_to_count.end()) {
+      continue;
+    }
+    int64_t count = this->random_int(special_it->second);
+    bool all_blocks_have_specials = false;
+    for (int64_t x = 0; x < count; x++) {
       if (remaining_blocks.size() == 0) {
-        return; // all blocks have specials? wow
+        all_blocks_have_specials = true; // wow
+        break;
       }
-      auto block_it = remaining_blocks.begin();
-      advance(block_it, rand() % remaining_blocks.size()); // O(n), sigh...
+      size_t which = this->rng() % remaining_blocks.size();
 
       int64_t timer_value = this->frames_between_monsters;
-      if (special_it.first == BlockSpecial::Timer) {
-        timer_value = (this->frames_between_monsters * 2) + rand() % (this->frames_between_monsters * 2);
+      if (special == BlockSpecial::Timer) {
+        timer_value = (this->frames_between_monsters * 2) + this->rng() % (this->frames_between_monsters * 2);
       }
-      (*block_it)->set_special(special_it.first, timer_value);
+      this->set_block_special(remaining_blocks[which], special, timer_value);
 
-      remaining_blocks.erase(block_it);
+      remaining_blocks[which] = remaining_blocks.back();
+      remaining_blocks.pop_back();
+    }
+    if (all_blocks_have_specials) {
+      break;
     }
   }
-
-  // note: if you add more logic here, watch out for the return statement in the
-  // above double loop
+  remaining_blocks.clear();
 }
 
 void LevelState::validate() const {
   // things to check:
   // 1. grid_pitch isn't zero, and evenly divides w and h
   // 2. no blocks overlap or are outside the level boundaries
-  // 3. move_speed and push_speed for all monsters divides grid_pitch evenly,
-  //    but push_speed can be 0 if the monster can't push
+  // 3. no monsters are outside the level boundaries, and move_speed and
+  //    push_speed for all monsters divide grid_pitch evenly, but push_speed
+  //    can be 0 if the monster can't push
 
   // (1) w, h, grid_pitch
-  if (this->params.grid_pitch == 0) {
+  if (this->params->grid_pitch == 0) {
     throw invalid_argument("grid pitch is zero");
   }
-  if ((this->params.w == 0) || (this->params.h == 0)) {
+  if ((this->params->w == 0) || (this->params->h == 0)) {
     throw invalid_argument("one or both of the level dimensions is zero");
   }
-  if ((this->params.w % this->params.grid_pitch) || (this->params.h % params.grid_pitch)) {
+  if ((this->params->w % this->params->grid_pitch) || (this->params->h % this->params->grid_pitch)) {
     throw invalid_argument(
         "level dimension is not a multiple of the grid pitch");
   }
+  for (uint32_t formation : this->params->lineup_formations) {
+    if ((formation == 0) ||
+        (formation >> (lineup_window_size * lineup_window_size))) {
+      throw invalid_argument(string_printf(
+          "LineUp formation %08" PRIX32 " is empty or larger than %" PRId64 "x%" PRId64,
+          formation, lineup_window_size, lineup_window_size));
+    }
+    if (lineup_placements_for_formations({formation}).empty()) {
+      throw invalid_argument(string_printf(
+          "LineUp formation %08" PRIX32 " can never be matched", formation));
+    }
+  }
+
+  // (2) blocks. this uses the occupancy grid to find the blocks that could
+  // overlap each one, so it's linear in the number of blocks
+  vector<size_t> candidates;
+  for (size_t block_index = 0; block_index < this->blocks.size(); block_index++) {
+    this->validate_block(block_index, block_index + 1, candidates);
+  }
+
+  // (3) monsters
+  size_t time_stop_holder_count = 0;
+  for (size_t monster_index = 0; monster_index < this->monsters.size(); monster_index++) {
+    this->validate_monster(monster_index);
+    time_stop_holder_count += this->monsters.has_special(monster_index,
+        BlockSpecial::TimeStop);
+  }
+  if (time_stop_holder_count != this->monsters.time_stop_holder_count) {
+    throw logic_error(string_printf("%zu monsters have TimeStop, but the "
+        "monster table counts %zu", time_stop_holder_count,
+        this->monsters.time_stop_holder_count));
+  }
+}
+
+void LevelState::validate_frame() const {
+  vector<size_t> candidates;
+  for (const auto& handle : this->touched_blocks) {
+    int64_t block_index = this->blocks.index_for_handle(handle);
+    if (block_index < 0) {
+      continue; // it was destroyed later in the frame
+    }
+    this->validate_block(block_index, 0, candidates);
+
+    // the grid must list the block in the cell its top-left corner is in
+    int64_t cell = this->grid_index_for_position(this->blocks.x[block_index],
+        this->blocks.y[block_index]);
+    if ((this->block_grid[cell] != block_index) &&
+        (find(this->overflow_blocks.begin(), this->overflow_blocks.end(),
+          make_pair(cell, block_index)) == this->overflow_blocks.end())) {
+      string block_str = this->blocks.str(block_index);
+      throw logic_error(string_printf(
+          "%s is missing from the occupancy grid", block_str.c_str()));
+    }
+  }
+
+  for (size_t monster_index : this->touched_monsters) {
+    auto monster = this->monsters[monster_index];
+    if (!monster.is_alive()) {
+      continue;
+    }
+    this->validate_monster(monster_index);
+
+    // the cell index must list the monster in every cell it overlaps
+    int64_t x_cell_min, x_cell_max, y_cell_min, y_cell_max;
+    this->cell_range_for_position(monster.x(), this->w_cells, &x_cell_min,
+        &x_cell_max);
+    this->cell_range_for_position(monster.y(), this->h_cells, &y_cell_min,
+        &y_cell_max);
+    for (int64_t y_cell = y_cell_min; y_cell <= y_cell_max; y_cell++) {
+      for (int64_t x_cell = x_cell_min; x_cell <= x_cell_max; x_cell++) {
+        int64_t z = y_cell * this->w_cells + x_cell;
+        const int64_t* slots = &this->monster_cells[z * monster_cell_slots];
+        const int64_t* slots_end = slots + monster_cell_slots;
+        if ((find(slots, slots_end, static_cast<int64_t>(monster_index)) == slots_end) &&
+            (find(this->overflow_monsters.begin(), this->overflow_monsters.end(),
+              make_pair(z, static_cast<int64_t>(monster_index))) == this->overflow_monsters.end())) {
+          string monster_str = monster.str();
+          throw logic_error(string_printf(
+              "%s is missing from the monster cell index", monster_str.c_str()));
+        }
+      }
+    }
+  }
+}
+
+void LevelState::validate_block(size_t block_index, size_t min_other_index,
+    vector<size_t>& candidates) const {
+  auto block = this->blocks[block_index];
+  if ((block.x() < 0) || (block.x() > this->params->w - this->params->grid_pitch) ||
+      (block.y() < 0) || (block.y() > this->params->h - this->params->grid_pitch)) {
+    string block_str = block.str();
+    throw invalid_argument(string_printf("%s is outside of the boundary",
+        block_str.c_str()));
+  }
+
+  // find_blocks_near returns exactly the blocks that are close enough to
+  // overlap this one
+  this->find_blocks_near(block.x(), block.y(), min_other_index, candidates);
+  for (size_t other_index : candidates) {
+    if (other_index == block_index) {
+      continue;
+    }
+    string block_str = block.str();
+    string other_block_str = this->blocks.str(other_index);
+    throw invalid_argument(string_printf("%s overlaps with %s",
+        block_str.c_str(), other_block_str.c_str()));
+  }
+}
+
+void LevelState::validate_monster(size_t monster_index) const {
+  // unlike blocks, monsters may overlap
+  auto monster = this->monsters[monster_index];
+  if ((monster.x() < 0) || (monster.x() > this->params->w - this->params->grid_pitch) ||
+      (monster.y() < 0) || (monster.y() > this->params->h - this->params->grid_pitch)) {
+    string monster_str = monster.str();
+    throw invalid_argument(string_printf("%s is outside of the boundary",
+        monster_str.c_str()));
+  }
+
+  if (this->params->grid_pitch % monster.move_speed()) {
+    auto monster_str = monster.str();
+    throw invalid_argument(string_printf(
+        "%s has invalid move speed (%" PRId64 " does not divide %" PRIu64")",
+        monster_str.c_str(), monster.move_speed(), this->params->grid_pitch));
+  }
+  if ((monster.push_speed() == 0) && (monster.has_flags(Monster::Flag::CanPushBlocks))) {
+    auto monster_str = monster.str();
+    throw invalid_argument(string_printf("%s has no push speed but can push",
+        monster_str.c_str()));
+  }
+  if (monster.push_speed() && (this->params->grid_pitch % monster.push_speed())) {
+    auto monster_str = monster.str();
+    throw invalid_argument(string_printf(
+        "%s has invalid push speed (%" PRId64 " does not divide %" PRIu64")",
+        monster_str.c_str(), monster.move_speed(), this->params->grid_pitch));
+  }
+  if (monster.special_mask() >> Monster::num_timed_specials) {
+    auto monster_str = monster.str();
+    throw logic_error(string_printf("%s has specials that monsters can't hold",
+        monster_str.c_str()));
+  }
+}
+
+const LevelState::GenerationParameters& LevelState::get_params() const {
+  return *this->params;
+}
+
+LevelState LevelState::fork() const {
+  return *this;
+}
+
+// the block grid and monster cells are mostly empty (-1), so they're saved as
+// a list of the cells that aren't, each as its distance from the previous one
+// and its value
+static void serialize_sparse_cells(BinaryWriter& w,
+    const vector<int64_t>& cells) {
+  size_t count = 0;
+  for (int64_t value : cells) {
+    count += (value != -1);
+  }
+  w.put_varint(cells.size());
+  w.put_varint(count);
+  size_t prev_index = 0;
+  for (size_t index = 0; index < cells.size(); index++) {
+    if (cells[index] != -1) {
+      w.put_varint(index - prev_index);
+      w.put_varint(cells[index]);
+      prev_index = index;
+    }
+  }
+}
+
+static void deserialize_sparse_cells(BinaryReader& r, vector<int64_t>& cells) {
+  cells.assign(r.get_varint(), -1);
+  uint64_t count = r.get_varint();
+  size_t index = 0;
+  for (uint64_t x = 0; x < count; x++) {
+    index += r.get_varint();
+    if (index >= cells.size()) {
+      throw runtime_error("saved cell is out of range");
+    }
+    cells[index] = r.get_varint();
+  }
+}
+
+string LevelState::serialize_state() const {
+  BinaryWriter w;
+  w.put_u64(this->params->hash());
+  w.put_u64(this->seed);
+  w.put_varint(this->rng.get_num_draws());
+
+  w.put_varint(this->player_index);
+  this->monsters.serialize(w);
+  this->blocks.serialize(w);
+  this->explosions.serialize(w);
+  w.put_value(this->updates_per_second);
+  w.put_varint(this->frames_executed);
+  w.put_varint(this->frames_between_monsters);
+
+  serialize_sparse_cells(w, this->block_grid);
+  w.put_vector(this->overflow_blocks);
+  w.put_vector(this->bitboards);
+  w.put_vector(this->block_cover_counts);
+  serialize_sparse_cells(w, this->monster_cells);
+  w.put_vector(this->overflow_monsters);
+  return w.release();
+}
+
+void LevelState::restore_state(const string& data) {
+  BinaryReader r(data);
+  if (r.get_u64() != this->params->hash()) {
+    throw invalid_argument("state was saved from a different level");
+  }
+  this->seed = r.get_u64();
+  this->rng.restore(this->seed, r.get_varint());
+
+  this->player_index = r.get_varint();
+  this->monsters.deserialize(r);
+  this->blocks.deserialize(r);
+  this->explosions.deserialize(r);
+  if (this->player_index >= static_cast<int64_t>(this->monsters.size())) {
+    throw runtime_error("saved state has no player");
+  }
+  this->updates_per_second = r.get_value<float>();
+  this->frames_executed = r.get_varint();
+  this->frames_between_monsters = r.get_varint();
+
+  // the parameters are the same, so the grids must be the same size too
+  size_t num_cells = this->w_cells * this->h_cells;
+  size_t num_bitboard_words = num_bitboard_planes * this->h_cells *
+      this->bitboard_words_per_row;
+  deserialize_sparse_cells(r, this->block_grid);
+  r.get_vector(this->overflow_blocks);
+  r.get_vector(this->bitboards);
+  r.get_vector(this->block_cover_counts);
+  deserialize_sparse_cells(r, this->monster_cells);
+  r.get_vector(this->overflow_monsters);
+  if ((this->block_grid.size() != num_cells) ||
+      (this->bitboards.size() != num_bitboard_words) ||
+      (this->block_cover_counts.size() != num_cells) ||
+      (this->monster_cells.size() != num_cells * monster_cell_slots)) {
+    throw runtime_error("saved state has grids of the wrong size");
+  }
+  if (!r.done()) {
+    throw runtime_error("saved state has extra data at the end");
+  }
+
+  // the distance field describes the state that was just replaced, and the
+  // last frame's events don't belong to the restored one
+  this->path_scratch.player_distances_frame = -1;
+  this->path_scratch.player_distances_valid = false;
+  this->frame_events.events_mask = Event::NoEvents;
+  this->frame_events.scores.clear();
+}
+
+uint64_t LevelState::get_seed() const {
+  return this->seed;
+}
+
+int64_t LevelState::random_int(int64_t low, int64_t high) {
+  return low + (this->rng() % static_cast<uint64_t>(high + 1 - low));
+}
+
+int64_t LevelState::random_int(const pair<int64_t, int64_t>& bounds) {
+  return this->random_int(bounds.first, bounds.second);
+}
+
+ConstMonsterRef LevelState::get_player() const {
+  return this->monsters[this->player_index];
+}
+const MonsterTable& LevelState::get_monsters() const {
+  return this->monsters;
+}
+const BlockTable& LevelState::get_blocks() const {
+  return this->blocks;
+}
+const ExplosionTable& LevelState::get_explosions() const {
+  return this->explosions;
+}
+
+float LevelState::get_updates_per_second() const {
+  return this->updates_per_second;
+}
+int64_t LevelState::get_frames_executed() const {
+  return this->frames_executed;
+}
+int64_t LevelState::get_frames_between_monsters() const {
+  return this->frames_between_monsters;
+}
+
+int64_t LevelState::count_monsters_with_flags(uint64_t flags, uint64_t mask) const {
+  int64_t count = 0;
+  for (const auto& monster : this->monsters) {
+    if (!monster.is_alive() || ((monster.flags() & mask) != flags)) {
+      continue;
+    }
+    count++;
+  }
+  return count;
+}
 
-  // (2) check that no blocks overlap or are outside the boundaries
-  // O(n^2), sigh
+int64_t LevelState::count_blocks_with_special(BlockSpecial special) const {
+  int64_t count = 0;
   for (const auto& block : this->blocks) {
-    if ((block->x < 0) || (block->x > this->params.w - this->params.grid_pitch) ||
-        (block->y < 0) || (block->y > this->params.h - this->params.grid_pitch)) {
-      string block_str = block->str();
-      throw invalid_argument(string_printf("%s is outside of the boundary",
-          block_str.c_str()));
-    }
-    for (const auto& other_block : this->blocks) {
-      if (block == other_block) {
+    if (block.special() != special) {
+      continue;
+    }
+    count++;
+  }
+  return count;
+}
+
+bool LevelState::is_complete() const {
+  return (this->count_monsters_with_flags(0, Monster::Flag::IsPlayer) == 0) &&
+      (this->count_blocks_with_special(BlockSpecial::CreatesMonsters) == 0);
+}
+
+LevelState::PathfindingScratch::PathfindingScratch() : generation(0),
+    player_distances_frame(-1), player_distances_valid(false) { }
+
+LevelState::PathfindingScratch::PathfindingScratch(const PathfindingScratch&) :
+    generation(0), player_distances_frame(-1), player_distances_valid(false) { }
+
+LevelState::PathfindingScratch& LevelState::PathfindingScratch::operator=(
+    const PathfindingScratch&) {
+  // keep the memory, but not the distance field; it describes the state that
+  // was just overwritten
+  this->player_distances_frame = -1;
+  this->player_distances_valid = false;
+  return *this;
+}
+
+bool LevelState::PathfindingScratch::HeapEntry::operator<(
+    const HeapEntry& other) const {
+  // std::push_heap and std::pop_heap keep the largest entry on top, so
+  // "larger" here means "should be expanded sooner": lower estimated total
+  // cost first, then the one farther from the start (which is usually closer
+  // to the target), then the lower cell index so the order is deterministic
+  if (this->estimated_cost != other.estimated_cost) {
+    return this->estimated_cost > other.estimated_cost;
+  }
+  if (this->cost != other.cost) {
+    return this->cost < other.cost;
+  }
+  return this->cell > other.cell;
+}
+
+Impulse LevelState::find_path(int64_t x, int64_t y, int64_t target_x,
+    int64_t target_y, size_t max_expansions, size_t* num_expansions) const {
+  if (num_expansions) {
+    *num_expansions = 0;
+  }
+  if (!this->is_aligned(x) || !this->is_aligned(y) ||
+      !this->is_aligned(target_x) || !this->is_aligned(target_y)) {
+    throw invalid_argument("path endpoints must be aligned to the grid");
+  }
+  if (!this->is_within_bounds(x, y) ||
+      !this->is_within_bounds(target_x, target_y)) {
+    throw invalid_argument("path endpoints must be within the level");
+  }
+
+  int64_t target_x_cell = target_x / this->params->grid_pitch;
+  int64_t target_y_cell = target_y / this->params->grid_pitch;
+  int32_t start_cell = (y / this->params->grid_pitch) * this->w_cells +
+      (x / this->params->grid_pitch);
+  int32_t target_cell = target_y_cell * this->w_cells + target_x_cell;
+  if (start_cell == target_cell) {
+    return Impulse::None;
+  }
+
+  // every step costs 1, so the manhattan distance (in cells) never
+  // overestimates the remaining cost, and the first path found to the target
+  // is a shortest one
+  auto remaining_cost = [&](int64_t x_cell, int64_t y_cell) -> int32_t {
+    return llabs(x_cell - target_x_cell) + llabs(y_cell - target_y_cell);
+  };
+
+  // nodes from previous calls are ignored because their generation doesn't
+  // match, so we don't have to clear the array (except when the generation
+  // wraps around)
+  auto& scratch = this->path_scratch;
+  scratch.nodes.resize(this->w_cells * this->h_cells);
+  scratch.heap.clear();
+  if (++scratch.generation == 0) {
+    for (auto& node : scratch.nodes) {
+      node.generation = 0;
+    }
+    scratch.generation = 1;
+  }
+
+  auto& start_node = scratch.nodes[start_cell];
+  start_node.generation = scratch.generation;
+  start_node.cost = 0;
+  start_node.first_direction = Impulse::None;
+  start_node.closed = false;
+  scratch.heap.push_back({remaining_cost(x / this->params->grid_pitch,
+      y / this->params->grid_pitch), 0, start_cell});
+
+  // if we run out of expansions, we go toward the discovered cell that's
+  // closest to the target
+  int32_t best_cell = -1;
+  int32_t best_remaining_cost = 0;
+
+  size_t expansions = 0;
+  Impulse ret = Impulse::None;
+  while (!scratch.heap.empty()) {
+    pop_heap(scratch.heap.begin(), scratch.heap.end());
+    auto entry = scratch.heap.back();
+    scratch.heap.pop_back();
+
+    // a cell can be in the heap more than once if we found a cheaper way to
+    // get to it after adding it; only the cheapest entry counts
+    auto& node = scratch.nodes[entry.cell];
+    if (node.closed || (entry.cost != node.cost)) {
+      continue;
+    }
+    if (entry.cell == target_cell) {
+      ret = node.first_direction;
+      break;
+    }
+    if (max_expansions && (expansions >= max_expansions)) {
+      if (best_cell >= 0) {
+        ret = scratch.nodes[best_cell].first_direction;
+      }
+      break;
+    }
+    node.closed = true;
+    expansions++;
+
+    int64_t x_cell = entry.cell % this->w_cells;
+    int64_t y_cell = entry.cell / this->w_cells;
+    for (Impulse dir : all_directions) {
+      auto offsets = offsets_for_direction(dir);
+      int64_t next_x_cell = x_cell + offsets.first;
+      int64_t next_y_cell = y_cell + offsets.second;
+      if ((next_x_cell < 0) || (next_x_cell >= this->w_cells) ||
+          (next_y_cell < 0) || (next_y_cell >= this->h_cells)) {
+        continue;
+      }
+
+      // if we've seen this cell before during this search, we already know
+      // it's empty. if it isn't empty, mark it closed so we don't check again
+      int32_t next_cell = next_y_cell * this->w_cells + next_x_cell;
+      int32_t next_cost = entry.cost + 1;
+      auto& next_node = scratch.nodes[next_cell];
+      if (next_node.generation == scratch.generation) {
+        if (next_node.closed || (next_node.cost <= next_cost)) {
+          continue;
+        }
+      } else if (!this->space_is_empty(next_x_cell * this->params->grid_pitch,
+          next_y_cell * this->params->grid_pitch)) {
+        next_node.generation = scratch.generation;
+        next_node.closed = true;
+        continue;
+      }
+
+      // we only need the first step of the path, so instead of remembering
+      // where each cell was reached from, remember which way the path to it
+      // leaves the start
+      next_node.generation = scratch.generation;
+      next_node.cost = next_cost;
+      next_node.first_direction = (entry.cell == start_cell) ? dir :
+          node.first_direction;
+      next_node.closed = false;
+
+      int32_t next_remaining_cost = remaining_cost(next_x_cell, next_y_cell);
+      scratch.heap.push_back({next_cost + next_remaining_cost, next_cost,
+          next_cell});
+      push_heap(scratch.heap.begin(), scratch.heap.end());
+
+      if ((best_cell < 0) || (next_remaining_cost < best_remaining_cost)) {
+        best_cell = next_cell;
+        best_remaining_cost = next_remaining_cost;
+      }
+    }
+  }
+
+  // if the heap ran out, there's no path, and ret is still None
+  PROFILE_COUNT(path_expansions, expansions);
+  if (num_expansions) {
+    *num_expansions = expansions;
+  }
+  return ret;
+}
+
+int32_t LevelState::neighbor_cell(int32_t cell, Impulse direction) const {
+  auto offsets = offsets_for_direction(direction);
+  int64_t x_cell = (cell % this->w_cells) + offsets.first;
+  int64_t y_cell = (cell / this->w_cells) + offsets.second;
+  if ((x_cell < 0) || (x_cell >= this->w_cells) ||
+      (y_cell < 0) || (y_cell >= this->h_cells)) {
+    return -1;
+  }
+  return y_cell * this->w_cells + x_cell;
+}
+
+bool LevelState::cell_is_empty(int32_t cell) const {
+  return !this->bitboard_bit(BitboardPlane::Occupied, cell % this->w_cells,
+      cell / this->w_cells);
+}
+
+void LevelState::mark_cells_dirty(int64_t x, int64_t y) {
+  auto& scratch = this->path_scratch;
+  if (!scratch.player_distances_valid) {
+    return;
+  }
+
+  int64_t x_cell_min, x_cell_max, y_cell_min, y_cell_max;
+  this->cell_range_for_position(x, this->w_cells, &x_cell_min, &x_cell_max);
+  this->cell_range_for_position(y, this->h_cells, &y_cell_min, &y_cell_max);
+  for (int64_t y_cell = y_cell_min; y_cell <= y_cell_max; y_cell++) {
+    for (int64_t x_cell = x_cell_min; x_cell <= x_cell_max; x_cell++) {
+      scratch.dirty_cells.emplace_back(y_cell * this->w_cells + x_cell);
+    }
+  }
+
+  // if this many cells changed, rebuilding the field is cheaper than repairing
+  // it (this also keeps dirty_cells from growing forever if nobody uses the
+  // field for a while)
+  if (scratch.dirty_cells.size() >
+      static_cast<size_t>(this->w_cells * this->h_cells)) {
+    scratch.player_distances_valid = false;
+    scratch.dirty_cells.clear();
+  }
+}
+
+void LevelState::update_player_distances() {
+  auto& scratch = this->path_scratch;
+  if (scratch.player_distances_frame == this->frames_executed) {
+    return;
+  }
+  scratch.player_distances_frame = this->frames_executed;
+
+  // find the cells that the live players are in
+  scratch.queue.clear();
+  for (const auto& monster : this->monsters) {
+    if (!monster.has_flags(Monster::Flag::IsPlayer) || !monster.is_alive()) {
+      continue;
+    }
+    int64_t x = this->align(monster.x());
+    int64_t y = this->align(monster.y());
+    if (!this->is_within_bounds(x, y) || !this->space_is_empty(x, y)) {
+      continue;
+    }
+    scratch.queue.emplace_back((y / this->params->grid_pitch) * this->w_cells +
+        (x / this->params->grid_pitch));
+  }
+  sort(scratch.queue.begin(), scratch.queue.end());
+  scratch.queue.erase(unique(scratch.queue.begin(), scratch.queue.end()),
+      scratch.queue.end());
+
+  // if the players are in the same cells as last time, then only blocks have
+  // changed, and we can just fix the parts of the field they affected. if a
+  // player moved to a different cell, almost every distance changes, so we
+  // start over
+  if (scratch.player_distances_valid &&
+      (scratch.queue == scratch.player_distance_sources)) {
+    this->repair_player_distances();
+    return;
+  }
+  scratch.player_distance_sources = scratch.queue;
+  scratch.player_distances_valid = true;
+  scratch.dirty_cells.clear();
+
+  // this is a breadth-first search outward from every live player at once,
+  // so each cell ends up with its distance to whichever player is closest.
+  // blocked cells are -2; cells that no player can reach are -1. the sources
+  // are already in the queue
+  scratch.player_distances.resize(this->w_cells * this->h_cells);
+  for (size_t cell = 0; cell < scratch.player_distances.size(); cell++) {
+    scratch.player_distances[cell] = this->cell_is_empty(cell) ? -1 : -2;
+  }
+  for (int32_t cell : scratch.queue) {
+    scratch.player_distances[cell] = 0;
+  }
+  for (size_t queue_index = 0; queue_index < scratch.queue.size(); queue_index++) {
+    int32_t cell = scratch.queue[queue_index];
+    int32_t next_distance = scratch.player_distances[cell] + 1;
+    for (Impulse dir : all_directions) {
+      int32_t next_cell = this->neighbor_cell(cell, dir);
+      if ((next_cell >= 0) && (scratch.player_distances[next_cell] == -1)) {
+        scratch.player_distances[next_cell] = next_distance;
+        scratch.queue.emplace_back(next_cell);
+      }
+    }
+  }
+  PROFILE_COUNT(distance_field_expansions, scratch.queue.size());
+}
+
+void LevelState::repair_player_distances() {
+  auto& scratch = this->path_scratch;
+  auto& distances = scratch.player_distances;
+  auto& heap = scratch.distance_heap;
+  auto& recompute_cells = scratch.queue;
+  greater<pair<int32_t, int32_t>> heap_order; // smallest distance on top
+
+  // find the cells whose blocked status actually changed. when a cell becomes
+  // empty, it needs a distance; when a cell becomes blocked, the cells that
+  // were reached through it might need new distances
+  heap.clear();
+  recompute_cells.clear();
+  for (int32_t cell : scratch.dirty_cells) {
+    bool was_blocked = (distances[cell] == -2);
+    if (this->cell_is_empty(cell) != was_blocked) {
+      continue;
+    }
+    if (was_blocked) {
+      distances[cell] = -1;
+      recompute_cells.emplace_back(cell);
+    } else {
+      int32_t prev_distance = distances[cell];
+      distances[cell] = -2;
+      if (prev_distance < 0) {
         continue;
       }
-      if (this->check_stationary_collision(block->x, block->y, other_block->x,
-          other_block->y)) {
-        string block_str = block->str();
-        string other_block_str = other_block->str();
-        throw invalid_argument(string_printf("%s overlaps with %s",
-            block_str.c_str(), other_block_str.c_str()));
+      for (Impulse dir : all_directions) {
+        int32_t next_cell = this->neighbor_cell(cell, dir);
+        if ((next_cell >= 0) && (distances[next_cell] == prev_distance + 1)) {
+          heap.emplace_back(prev_distance + 1, next_cell);
+          push_heap(heap.begin(), heap.end(), heap_order);
+        }
       }
     }
   }
+  scratch.dirty_cells.clear();
+
+  // a cell's distance is still good if it's a source or it has a neighbor
+  // that's one step closer to a player. if not, it loses its distance, and
+  // the cells that were reached through it have to be checked too. doing this
+  // in order of distance means a cell's neighbors that are one step closer
+  // have always been checked before the cell itself
+  while (!heap.empty()) {
+    pop_heap(heap.begin(), heap.end(), heap_order);
+    int32_t distance = heap.back().first;
+    int32_t cell = heap.back().second;
+    heap.pop_back();
+    if ((distances[cell] != distance) || (distance == 0)) {
+      continue;
+    }
+
+    bool supported = false;
+    for (Impulse dir : all_directions) {
+      int32_t next_cell = this->neighbor_cell(cell, dir);
+      if ((next_cell >= 0) && (distances[next_cell] == distance - 1)) {
+        supported = true;
+        break;
+      }
+    }
+    if (supported) {
+      continue;
+    }
+
+    distances[cell] = -1;
+    recompute_cells.emplace_back(cell);
+    for (Impulse dir : all_directions) {
+      int32_t next_cell = this->neighbor_cell(cell, dir);
+      if ((next_cell >= 0) && (distances[next_cell] == distance + 1)) {
+        heap.emplace_back(distance + 1, next_cell);
+        push_heap(heap.begin(), heap.end(), heap_order);
+      }
+    }
+  }
+
+  // every distance left in the field is now achievable, so give the cells
+  // that lost theirs (or just became empty) the best distance their
+  // neighbors offer, then spread any improvements outward. this can also
+  // shorten distances in the rest of the field, if a cell became empty
+  for (int32_t cell : recompute_cells) {
+    int32_t best_distance = -1;
+    for (Impulse dir : all_directions) {
+      int32_t next_cell = this->neighbor_cell(cell, dir);
+      if ((next_cell >= 0) && (distances[next_cell] >= 0) &&
+          ((best_distance < 0) || (distances[next_cell] + 1 < best_distance))) {
+        best_distance = distances[next_cell] + 1;
+      }
+    }
+    if (best_distance >= 0) {
+      distances[cell] = best_distance;
+      heap.emplace_back(best_distance, cell);
+      push_heap(heap.begin(), heap.end(), heap_order);
+    }
+  }
+  while (!heap.empty()) {
+    pop_heap(heap.begin(), heap.end(), heap_order);
+    int32_t distance = heap.back().first;
+    int32_t cell = heap.back().second;
+    heap.pop_back();
+    if (distances[cell] != distance) {
+      continue;
+    }
+    PROFILE_COUNT(distance_field_expansions, 1);
+    for (Impulse dir : all_directions) {
+      int32_t next_cell = this->neighbor_cell(cell, dir);
+      if ((next_cell >= 0) && ((distances[next_cell] == -1) ||
+          (distances[next_cell] > distance + 1))) {
+        distances[next_cell] = distance + 1;
+        heap.emplace_back(distance + 1, next_cell);
+        push_heap(heap.begin(), heap.end(), heap_order);
+      }
+    }
+  }
+}
+
+Impulse LevelState::direction_toward_nearest_player(int64_t x, int64_t y) {
+  this->update_player_distances();
+  const auto& distances = this->path_scratch.player_distances;
+
+  // if the monster is already at a player's position, there's nowhere to go
+  int64_t x_cell = x / this->params->grid_pitch;
+  int64_t y_cell = y / this->params->grid_pitch;
+  if (distances[y_cell * this->w_cells + x_cell] == 0) {
+    return Impulse::None;
+  }
+
+  // go toward whichever neighbor is closest to a player. we don't look at the
+  // monster's own cell's distance, since it isn't necessarily empty (like the
+  // start of a find_path search)
+  Impulse ret = Impulse::None;
+  int32_t min_distance = 0;
+  for (Impulse dir : all_directions) {
+    auto offsets = offsets_for_direction(dir);
+    int64_t next_x_cell = x_cell + offsets.first;
+    int64_t next_y_cell = y_cell + offsets.second;
+    if ((next_x_cell < 0) || (next_x_cell >= this->w_cells) ||
+        (next_y_cell < 0) || (next_y_cell >= this->h_cells)) {
+      continue;
+    }
+    int32_t distance = distances[next_y_cell * this->w_cells + next_x_cell];
+    if ((distance >= 0) && ((ret == Impulse::None) || (distance < min_distance))) {
+      ret = dir;
+      min_distance = distance;
+    }
+  }
+  return ret;
+}
+
+double LevelState::current_score_proportion() const {
+  int64_t score_end_frame = this->updates_per_second * 120;
+  if (this->frames_executed >= score_end_frame) {
+    return 0.0;
+  }
+  return 1.0 - (static_cast<double>(this->frames_executed) / static_cast<double>(score_end_frame));
+}
+
+int64_t LevelState::score_for_monster(bool is_power_monster, int64_t mult) const {
+  int64_t base = is_power_monster ? this->params->power_monster_score : this->params->basic_monster_score;
+  return this->current_score_proportion() * (base * mult);
+}
+
+uint64_t LevelState::flags_for_monster(bool is_power_monster) const {
+  return Monster::Flag::Squishable | Monster::Flag::KillsPlayers |
+      (is_power_monster ? Monster::Flag::IsPower : 0) |
+      ((is_power_monster && this->params->power_monsters_can_push) ? Monster::Flag::CanPushBlocks : 0);
+}
+
+bool LevelState::is_aligned(int64_t z) const {
+  return (z % this->params->grid_pitch) == 0;
+}
+
+int64_t LevelState::align(int64_t z) const {
+  int64_t half_pitch = this->params->grid_pitch >> 1;
+  int64_t misalignment = z % this->params->grid_pitch;
+  return z + ((misalignment >= half_pitch) ? this->params->grid_pitch : 0) -
+      misalignment;
+}
+
+bool LevelState::is_within_bounds(int64_t x, int64_t y) const {
+  return (x >= 0) && (x <= this->params->w - this->params->grid_pitch) &&
+         (y >= 0) && (y <= this->params->h - this->params->grid_pitch);
+}
+
+int64_t LevelState::grid_index_for_position(int64_t x, int64_t y) const {
+  int64_t x_cell = (x < 0) ? 0 : (x / this->params->grid_pitch);
+  int64_t y_cell = (y < 0) ? 0 : (y / this->params->grid_pitch);
+  if (x_cell >= this->w_cells) {
+    x_cell = this->w_cells - 1;
+  }
+  if (y_cell >= this->h_cells) {
+    y_cell = this->h_cells - 1;
+  }
+  return y_cell * this->w_cells + x_cell;
+}
+
+void LevelState::add_block_to_grid(size_t block_index) {
+  VALIDATE_TOUCH_BLOCK(block_index);
+  this->mark_cells_dirty(this->blocks.x[block_index],
+      this->blocks.y[block_index]);
+  int64_t index = this->grid_index_for_position(this->blocks.x[block_index],
+      this->blocks.y[block_index]);
+  auto& cell_block = this->block_grid[index];
+  if (cell_block < 0) {
+    cell_block = block_index;
+  } else {
+    this->overflow_blocks.emplace_back(index, block_index);
+  }
+  this->add_block_cover(this->blocks.x[block_index],
+      this->blocks.y[block_index], 1);
+  this->update_block_planes(this->blocks.x[block_index],
+      this->blocks.y[block_index]);
+}
 
-  // (3) check that no monsters are outside the boundaries (unlike blocks,
-  // monsters may overlap)
-  for (const auto& monster : this->monsters) {
-    if ((monster->x < 0) || (monster->x > this->params.w - this->params.grid_pitch) ||
-        (monster->y < 0) || (monster->y > this->params.h - this->params.grid_pitch)) {
-      string monster_str = monster->str();
-      throw invalid_argument(string_printf("%s is outside of the boundary",
-          monster_str.c_str()));
+void LevelState::remove_block_from_grid(size_t block_index, int64_t x,
+    int64_t y) {
+  this->mark_cells_dirty(x, y);
+  int64_t index = this->grid_index_for_position(x, y);
+  auto& cell_block = this->block_grid[index];
+  if (cell_block == static_cast<int64_t>(block_index)) {
+    cell_block = -1;
+
+    // if another block was waiting for this cell, move it into the grid
+    for (auto it = this->overflow_blocks.begin(); it != this->overflow_blocks.end(); it++) {
+      if (it->first == index) {
+        cell_block = it->second;
+        this->overflow_blocks.erase(it);
+        break;
+      }
     }
-  }
 
-  // (3) check move_speed and push_speed for all monsters
-  for (const auto& monster : this->monsters) {
-    if (this->params.grid_pitch % monster->move_speed) {
-      auto monster_str = monster->str();
-      throw invalid_argument(string_printf(
-          "%s has invalid move speed (%" PRId64 " does not divide %" PRIu64")",
-          monster_str.c_str(), monster->move_speed, this->params.grid_pitch));
-    }
-    if ((monster->push_speed == 0) && (monster->has_flags(Monster::Flag::CanPushBlocks))) {
-      auto monster_str = monster->str();
-      throw invalid_argument(string_printf("%s has no push speed but can push",
-          monster_str.c_str()));
+  } else {
+    auto it = this->overflow_blocks.begin();
+    for (; it != this->overflow_blocks.end(); it++) {
+      if (it->second == static_cast<int64_t>(block_index)) {
+        break;
+      }
     }
-    if (monster->push_speed && (this->params.grid_pitch % monster->push_speed)) {
-      auto monster_str = monster->str();
-      throw invalid_argument(string_printf(
-          "%s has invalid push speed (%" PRId64 " does not divide %" PRIu64")",
-          monster_str.c_str(), monster->move_speed, this->params.grid_pitch));
+    if (it == this->overflow_blocks.end()) {
+      throw logic_error("block is missing from the occupancy grid");
     }
+    this->overflow_blocks.erase(it);
   }
+
+  // the block is out of the grid now, so find_block won't see it when the
+  // planes are recomputed
+  this->add_block_cover(x, y, -1);
+  this->update_block_planes(x, y);
 }
 
-const LevelState::GenerationParameters& LevelState::get_params() const {
-  return this->params;
+void LevelState::update_block_in_grid(size_t block_index, int64_t prev_x,
+    int64_t prev_y) {
+  VALIDATE_TOUCH_BLOCK(block_index);
+  int64_t x = this->blocks.x[block_index];
+  int64_t y = this->blocks.y[block_index];
+  if (this->grid_index_for_position(prev_x, prev_y) !=
+      this->grid_index_for_position(x, y)) {
+    this->remove_block_from_grid(block_index, prev_x, prev_y);
+    this->add_block_to_grid(block_index);
+    return;
+  }
+
+  // the block's top-left corner is still in the same cell, but it might
+  // cover different cells now (e.g. if it just became aligned). it also might
+  // have just become aligned or stopped being aligned, which affects the planes
+  if (this->is_aligned(prev_x) != this->is_aligned(x) ||
+      this->is_aligned(prev_y) != this->is_aligned(y)) {
+    this->mark_cells_dirty(prev_x, prev_y);
+    this->add_block_cover(prev_x, prev_y, -1);
+    this->update_block_planes(prev_x, prev_y);
+    this->mark_cells_dirty(x, y);
+    this->add_block_cover(x, y, 1);
+    this->update_block_planes(x, y);
+  }
 }
 
-const std::shared_ptr<Monster> LevelState::get_player() const {
-  return this->player;
+void LevelState::delete_block(size_t block_index) {
+  this->remove_block_from_grid(block_index, this->blocks.x[block_index],
+      this->blocks.y[block_index]);
+
+  // the last block is about to be moved into this block's place, so the grid
+  // has to point to its new index
+  size_t last_index = this->blocks.size() - 1;
+  if (block_index != last_index) {
+    int64_t index = this->grid_index_for_position(this->blocks.x[last_index],
+        this->blocks.y[last_index]);
+    if (this->block_grid[index] == static_cast<int64_t>(last_index)) {
+      this->block_grid[index] = block_index;
+    } else {
+      for (auto& it : this->overflow_blocks) {
+        if (it.second == static_cast<int64_t>(last_index)) {
+          it.second = block_index;
+          break;
+        }
+      }
+    }
+  }
+  this->blocks.erase(block_index);
 }
-const std::unordered_set<std::shared_ptr<Monster>>& LevelState::get_monsters() const {
-  return this->monsters;
+
+size_t LevelState::bitboard_plane_for_special(BlockSpecial special) {
+  return BitboardPlane::FirstSpecial + static_cast<size_t>(special);
 }
-const std::unordered_set<std::shared_ptr<Block>>& LevelState::get_blocks() const {
-  return this->blocks;
+
+size_t LevelState::get_bitboard_words_per_row() const {
+  return this->bitboard_words_per_row;
 }
 
-const std::unordered_set<std::shared_ptr<struct Explosion>>& LevelState::get_explosions() const {
-  return this->explosions;
+const uint64_t* LevelState::get_bitboard(size_t plane) const {
+  if (plane >= num_bitboard_planes) {
+    throw out_of_range("bitboard plane does not exist");
+  }
+  return this->bitboards.data() +
+      plane * this->h_cells * this->bitboard_words_per_row;
 }
 
-float LevelState::get_updates_per_second() const {
-  return this->updates_per_second;
+uint64_t LevelState::hash_bitboards() const {
+  return fnv1a64(this->bitboards.data(),
+      this->bitboards.size() * sizeof(this->bitboards[0]));
 }
-int64_t LevelState::get_frames_executed() const {
-  return this->frames_executed;
+
+bool LevelState::bitboard_bit(size_t plane, int64_t x_cell,
+    int64_t y_cell) const {
+  uint64_t word = this->bitboards[(plane * this->h_cells + y_cell) *
+      this->bitboard_words_per_row + (x_cell >> 6)];
+  return (word >> (x_cell & 63)) & 1;
 }
-int64_t LevelState::get_frames_between_monsters() const {
-  return this->frames_between_monsters;
+
+void LevelState::set_bitboard_bit(size_t plane, int64_t x_cell,
+    int64_t y_cell, bool value) {
+  uint64_t& word = this->bitboards[(plane * this->h_cells + y_cell) *
+      this->bitboard_words_per_row + (x_cell >> 6)];
+  uint64_t mask = 1ULL << (x_cell & 63);
+  word = value ? (word | mask) : (word & ~mask);
 }
 
-int64_t LevelState::count_monsters_with_flags(uint64_t flags, uint64_t mask) const {
-  int64_t count = 0;
-  for (const auto& monster : this->monsters) {
-    if (!monster->is_alive() || ((monster->flags & mask) != flags)) {
-      continue;
+uint64_t LevelState::bitboard_row_bits(size_t plane, int64_t x_cell,
+    int64_t y_cell, size_t count) const {
+  if ((y_cell < 0) || (y_cell >= this->h_cells)) {
+    return 0;
+  }
+
+  // the range can span two words (or three, if x_cell is negative, but the
+  // first one is outside the level). cells outside the level are zero, since
+  // the padding at the end of each row is always zero
+  const uint64_t* row = this->bitboards.data() +
+      (plane * this->h_cells + y_cell) * this->bitboard_words_per_row;
+  int64_t end_cell = min<int64_t>(x_cell + count, this->w_cells);
+  uint64_t ret = 0;
+  for (int64_t word_cell = (x_cell < 0) ? 0 : (x_cell & ~63);
+       word_cell < end_cell; word_cell += 64) {
+    uint64_t word = row[word_cell >> 6];
+    int64_t shift = word_cell - x_cell;
+    if (shift >= 0) {
+      ret |= (shift < 64) ? (word << shift) : 0;
+    } else {
+      ret |= word >> (-shift);
     }
-    count++;
   }
-  return count;
+  return (count < 64) ? (ret & ((1ULL << count) - 1)) : ret;
 }
 
-int64_t LevelState::count_blocks_with_special(BlockSpecial special) const {
-  int64_t count = 0;
-  for (const auto& block : this->blocks) {
-    if (block->special != special) {
-      continue;
+uint64_t LevelState::bitboard_column_bits(size_t plane, int64_t x_cell,
+    int64_t y_cell, size_t count) const {
+  if ((x_cell < 0) || (x_cell >= this->w_cells)) {
+    return 0;
+  }
+  uint64_t ret = 0;
+  for (size_t z = 0; z < count; z++) {
+    int64_t row = y_cell + z;
+    if ((row >= 0) && (row < this->h_cells)) {
+      ret |= static_cast<uint64_t>(this->bitboard_bit(plane, x_cell, row)) << z;
     }
-    count++;
   }
-  return count;
+  return ret;
 }
 
-Impulse LevelState::find_path(int64_t x, int64_t y, int64_t target_x, int64_t target_y) const {
-  // TODO: we make the assumption here that coordinates are 32-bit encodable;
-  // this could be wrong in some strange universe
-  auto encode_cell_coords = +[](int64_t x, int64_t y) -> int64_t {
-    return ((x & 0xFFFFFFFF) << 32) | (y & 0xFFFFFFFF);
-  };
-  auto encode_cell_coords_pair = +[](const pair<int64_t, int64_t>& c) -> int64_t {
-    return ((c.first & 0xFFFFFFFF) << 32) | (c.second & 0xFFFFFFFF);
-  };
-  auto decode_cell_coords = +[](int64_t c) -> pair<int64_t, int64_t> {
-    return make_pair(((c >> 32) & 0xFFFFFFFF), (c & 0xFFFFFFFF));
-  };
-
-  int64_t start_cell = encode_cell_coords(x, y);
-  int64_t target_cell = encode_cell_coords(target_x, target_y);
-
-  unordered_set<int64_t> visited_cells;
-  unordered_set<int64_t> pending_cells;
-  pending_cells.emplace(start_cell);
-
-  // map of cell to direction back to start
-  unordered_map<int64_t, Impulse> reverse_path;
-
-  unordered_map<int64_t, int64_t> cell_score;
-  unordered_map<int64_t, int64_t> passthrough_score;
-  cell_score.emplace(start_cell, 0);
-  passthrough_score.emplace(start_cell, dist2(x, y, target_x, target_y));
-
-  while (!pending_cells.empty()) {
-    // TODO: this probably could be faster if we used a multimap<score, cell>
-    // for pending_cells
-    int64_t current_cell = 0xFFFFFFFFFFFFFFFF;
-    {
-      // TODO: this is ugly; don't use a constant
-      int64_t min_score = 0x7FFFFFFFFFFFFFFF;
-      for (const auto& c : pending_cells) {
-        int64_t cell_score = 0x7FFFFFFFFFFFFFFE;
-        auto passthrough_score_it = passthrough_score.find(c);
-        if (passthrough_score_it != passthrough_score.end()) {
-          cell_score = passthrough_score_it->second;
-        }
+uint32_t LevelState::match_lineup_formation(int64_t x_cell,
+    int64_t y_cell) const {
+  // build the window from the rows of the LineUp plane around the cell. the
+  // caller already checked the block in the center, so it always counts
+  size_t lineup_plane = bitboard_plane_for_special(BlockSpecial::LineUp);
+  int64_t half_size = lineup_window_size / 2;
+  uint32_t window = 1 << lineup_window_center;
+  for (int64_t y = 0; y < lineup_window_size; y++) {
+    window |= this->bitboard_row_bits(lineup_plane, x_cell - half_size,
+        y_cell - half_size + y, lineup_window_size) << (y * lineup_window_size);
+  }
 
-        if (cell_score < min_score) {
-          current_cell = c;
-          min_score = cell_score;
-        }
-      }
+  for (uint32_t placement : *this->lineup_placements) {
+    if ((window & placement) == placement) {
+      return placement;
     }
+  }
+  return 0;
+}
 
-    auto current_cell_pair = decode_cell_coords(current_cell);
-    if (current_cell == target_cell) {
-      Impulse ret = Impulse::None;
-      try {
-        for (;;) {
-          ret = reverse_path.at(current_cell);
-          auto offsets = offsets_for_direction(ret);
-          current_cell_pair.first -= offsets.first * this->params.grid_pitch;
-          current_cell_pair.second -= offsets.second * this->params.grid_pitch;
-          current_cell = encode_cell_coords_pair(current_cell_pair);
-        }
-      } catch (const out_of_range&) { }
-      return ret;
+bool LevelState::covered_cell_range(int64_t z, int64_t num_cells,
+    int64_t* min_cell, int64_t* max_cell) const {
+  // a block overlaps a cell if it's less than a grid pitch away from the
+  // cell's position. that's just one cell if the block is aligned, and two if
+  // it isn't
+  int64_t cell = (z >= 0) ? (z / this->params->grid_pitch) :
+      -((this->params->grid_pitch - 1 - z) / this->params->grid_pitch);
+  *min_cell = (cell < 0) ? 0 : cell;
+  *max_cell = cell + !this->is_aligned(z);
+  if (*max_cell >= num_cells) {
+    *max_cell = num_cells - 1;
+  }
+  return *min_cell <= *max_cell;
+}
+
+void LevelState::add_block_cover(int64_t x, int64_t y, int64_t delta) {
+  int64_t x_cell_min, x_cell_max, y_cell_min, y_cell_max;
+  if (!this->covered_cell_range(x, this->w_cells, &x_cell_min, &x_cell_max) ||
+      !this->covered_cell_range(y, this->h_cells, &y_cell_min, &y_cell_max)) {
+    return;
+  }
+  for (int64_t y_cell = y_cell_min; y_cell <= y_cell_max; y_cell++) {
+    for (int64_t x_cell = x_cell_min; x_cell <= x_cell_max; x_cell++) {
+      auto& count = this->block_cover_counts[y_cell * this->w_cells + x_cell];
+      count += delta;
+      this->set_bitboard_bit(BitboardPlane::Occupied, x_cell, y_cell,
+          count != 0);
     }
+  }
+}
 
-    pending_cells.erase(current_cell);
-    visited_cells.emplace(current_cell);
+void LevelState::update_block_planes(int64_t x, int64_t y) {
+  if (!this->is_aligned(x) || !this->is_aligned(y) || (x < 0) || (y < 0)) {
+    return;
+  }
+  int64_t x_cell = x / this->params->grid_pitch;
+  int64_t y_cell = y / this->params->grid_pitch;
+  if ((x_cell >= this->w_cells) || (y_cell >= this->h_cells)) {
+    return;
+  }
 
-    for (Impulse dir : all_directions) {
-      auto offsets = offsets_for_direction(dir);
-      pair<int64_t, int64_t> next_cell_pair = make_pair(
-          current_cell_pair.first + this->params.grid_pitch * offsets.first,
-          current_cell_pair.second + this->params.grid_pitch * offsets.second);
-      int64_t next_cell = encode_cell_coords_pair(next_cell_pair);
+  int64_t block_index = this->find_block(x, y);
+  uint64_t flags = (block_index >= 0) ? this->blocks.flags[block_index] : 0;
+  this->set_bitboard_bit(BitboardPlane::Pushable, x_cell, y_cell,
+      flags & Block::Flag::Pushable);
+  this->set_bitboard_bit(BitboardPlane::Destructible, x_cell, y_cell,
+      flags & Block::Flag::Destructible);
+  size_t special_plane = (block_index >= 0) ?
+      bitboard_plane_for_special(this->blocks.special[block_index]) : 0;
+  for (size_t plane = BitboardPlane::FirstSpecial; plane < num_bitboard_planes;
+       plane++) {
+    this->set_bitboard_bit(plane, x_cell, y_cell, plane == special_plane);
+  }
+}
 
-      if (!this->is_within_bounds(next_cell_pair.first, next_cell_pair.second)) {
-        continue;
-      }
-      if (!this->space_is_empty(next_cell_pair.first, next_cell_pair.second)) {
-        continue;
-      }
-      if (visited_cells.count(next_cell)) {
-        continue;
-      }
-      pending_cells.emplace(next_cell);
+void LevelState::set_block_special(size_t block_index, BlockSpecial special,
+    int64_t timer_value) {
+  this->blocks.set_special(block_index, special, timer_value);
+  this->update_block_planes(this->blocks.x[block_index],
+      this->blocks.y[block_index]);
+}
 
-      int64_t tentative_cell_score = cell_score.at(current_cell) + 1;
-      auto cell_score_it = cell_score.find(next_cell);
-      if ((cell_score_it != cell_score.end()) &&
-          (cell_score_it->second < tentative_cell_score)) {
-        continue;
+uint8_t LevelState::empty_directions(int64_t x, int64_t y) const {
+  uint8_t ret = Impulse::None;
+  if (!this->is_aligned(x) || !this->is_aligned(y) || (x < 0) || (y < 0) ||
+      (x / this->params->grid_pitch >= this->w_cells) ||
+      (y / this->params->grid_pitch >= this->h_cells)) {
+    for (Impulse dir : all_directions) {
+      auto offsets = offsets_for_direction(dir);
+      if (this->space_is_empty(x + this->params->grid_pitch * offsets.first,
+          y + this->params->grid_pitch * offsets.second)) {
+        ret |= dir;
       }
-
-      reverse_path[next_cell] = dir;
-      cell_score[next_cell] = tentative_cell_score;
-      passthrough_score[next_cell] = tentative_cell_score + dist2(
-          next_cell_pair.first, next_cell_pair.second, target_x, target_y);
     }
+    return ret;
   }
 
-  // no path exists
-  return Impulse::None;
+  // the level is a whole number of cells, so a neighbor that's outside the
+  // grid is outside the level too. bitboard_*_bits return zero for those, so
+  // they have to be excluded separately
+  int64_t x_cell = x / this->params->grid_pitch;
+  int64_t y_cell = y / this->params->grid_pitch;
+  uint64_t row = this->bitboard_row_bits(BitboardPlane::Occupied, x_cell - 1,
+      y_cell, 3);
+  uint64_t column = this->bitboard_column_bits(BitboardPlane::Occupied,
+      x_cell, y_cell - 1, 3);
+  if ((x_cell > 0) && !(row & 1)) {
+    ret |= Impulse::Left;
+  }
+  if ((x_cell < this->w_cells - 1) && !(row & 4)) {
+    ret |= Impulse::Right;
+  }
+  if ((y_cell > 0) && !(column & 1)) {
+    ret |= Impulse::Up;
+  }
+  if ((y_cell < this->h_cells - 1) && !(column & 4)) {
+    ret |= Impulse::Down;
+  }
+  return ret;
 }
 
-double LevelState::current_score_proportion() const {
-  int64_t score_end_frame = this->updates_per_second * 120;
-  if (this->frames_executed >= score_end_frame) {
-    return 0.0;
+int64_t LevelState::find_block(int64_t x, int64_t y) const {
+  // a block at exactly (x, y) can only be indexed in one cell
+  int64_t block_index = this->block_grid[this->grid_index_for_position(x, y)];
+  if ((block_index >= 0) && (this->blocks.x[block_index] == x) &&
+      (this->blocks.y[block_index] == y)) {
+    return block_index;
   }
-  return 1.0 - (static_cast<double>(this->frames_executed) / static_cast<double>(score_end_frame));
+  for (const auto& it : this->overflow_blocks) {
+    if ((this->blocks.x[it.second] == x) && (this->blocks.y[it.second] == y)) {
+      return it.second;
+    }
+  }
+  return -1;
 }
 
-int64_t LevelState::score_for_monster(bool is_power_monster, int64_t mult) const {
-  int64_t base = is_power_monster ? this->params.power_monster_score : this->params.basic_monster_score;
-  return this->current_score_proportion() * (base * mult);
-}
+bool LevelState::space_is_empty(int64_t x, int64_t y) const {
+  // if any part of the space is out of bounds, it's not empty
+  if ((x < 0) || (y < 0) || (x >= this->params->w) || (y >= this->params->h)) {
+    return false;
+  }
 
-uint64_t LevelState::flags_for_monster(bool is_power_monster) const {
-  return Monster::Flag::Squishable | Monster::Flag::KillsPlayers |
-      (is_power_monster ? Monster::Flag::IsPower : 0) |
-      ((is_power_monster && this->params.power_monsters_can_push) ? Monster::Flag::CanPushBlocks : 0);
+  // if the space is exactly one cell, the Occupied plane already knows
+  if (this->is_aligned(x) && this->is_aligned(y)) {
+    int64_t x_cell = x / this->params->grid_pitch;
+    int64_t y_cell = y / this->params->grid_pitch;
+    if ((x_cell < this->w_cells) && (y_cell < this->h_cells)) {
+      return !this->bitboard_bit(BitboardPlane::Occupied, x_cell, y_cell);
+    }
+  }
+
+  int64_t x_min = x - this->params->grid_pitch;
+  int64_t y_min = y - this->params->grid_pitch;
+  int64_t x_max = x + this->params->grid_pitch;
+  int64_t y_max = y + this->params->grid_pitch;
+  auto block_overlaps = [&](int64_t block_index) -> bool {
+    int64_t block_x = this->blocks.x[block_index];
+    int64_t block_y = this->blocks.y[block_index];
+    return (block_x > x_min) && (block_x < x_max) &&
+           (block_y > y_min) && (block_y < y_max);
+  };
+
+  // any block that overlaps this space has its top-left corner in one of (at
+  // most) four cells, so we only have to look at those
+  int64_t x_cell_min = (x_min + 1 < 0) ? 0 : ((x_min + 1) / this->params->grid_pitch);
+  int64_t y_cell_min = (y_min + 1 < 0) ? 0 : ((y_min + 1) / this->params->grid_pitch);
+  int64_t x_cell_max = (x_max - 1) / this->params->grid_pitch;
+  int64_t y_cell_max = (y_max - 1) / this->params->grid_pitch;
+  if (x_cell_max >= this->w_cells) {
+    x_cell_max = this->w_cells - 1;
+  }
+  if (y_cell_max >= this->h_cells) {
+    y_cell_max = this->h_cells - 1;
+  }
+  for (int64_t y_cell = y_cell_min; y_cell <= y_cell_max; y_cell++) {
+    for (int64_t x_cell = x_cell_min; x_cell <= x_cell_max; x_cell++) {
+      int64_t block_index = this->block_grid[y_cell * this->w_cells + x_cell];
+      if ((block_index >= 0) && block_overlaps(block_index)) {
+        return false;
+      }
+    }
+  }
+  for (const auto& it : this->overflow_blocks) {
+    if (block_overlaps(it.second)) {
+      return false;
+    }
+  }
+  return true;
 }
 
-bool LevelState::is_aligned(int64_t z) const {
-  return (z % this->params.grid_pitch) == 0;
+void LevelState::find_blocks_near(int64_t x, int64_t y, size_t min_index,
+    vector<size_t>& ret) const {
+  ret.clear();
+
+  int64_t x_min = x - this->params->grid_pitch;
+  int64_t y_min = y - this->params->grid_pitch;
+  int64_t x_max = x + this->params->grid_pitch;
+  int64_t y_max = y + this->params->grid_pitch;
+  auto add_if_near = [&](size_t block_index) {
+    int64_t block_x = this->blocks.x[block_index];
+    int64_t block_y = this->blocks.y[block_index];
+    if ((block_index >= min_index) && (block_x > x_min) && (block_x < x_max) &&
+        (block_y > y_min) && (block_y < y_max)) {
+      ret.emplace_back(block_index);
+    }
+  };
+
+  // same cell range as in space_is_empty
+  int64_t x_cell_min = (x_min + 1 < 0) ? 0 : ((x_min + 1) / this->params->grid_pitch);
+  int64_t y_cell_min = (y_min + 1 < 0) ? 0 : ((y_min + 1) / this->params->grid_pitch);
+  int64_t x_cell_max = (x_max - 1) / this->params->grid_pitch;
+  int64_t y_cell_max = (y_max - 1) / this->params->grid_pitch;
+  if (x_cell_max >= this->w_cells) {
+    x_cell_max = this->w_cells - 1;
+  }
+  if (y_cell_max >= this->h_cells) {
+    y_cell_max = this->h_cells - 1;
+  }
+  for (int64_t y_cell = y_cell_min; y_cell <= y_cell_max; y_cell++) {
+    for (int64_t x_cell = x_cell_min; x_cell <= x_cell_max; x_cell++) {
+      int64_t block_index = this->block_grid[y_cell * this->w_cells + x_cell];
+      if (block_index >= 0) {
+        add_if_near(block_index);
+      }
+    }
+  }
+  for (const auto& it : this->overflow_blocks) {
+    add_if_near(it.second);
+  }
+
+  sort(ret.begin(), ret.end());
 }
 
-int64_t LevelState::align(int64_t z) const {
-  int64_t half_pitch = this->params.grid_pitch >> 1;
-  int64_t misalignment = z % this->params.grid_pitch;
-  return z + ((misalignment >= half_pitch) ? this->params.grid_pitch : 0) -
-      misalignment;
+void LevelState::cell_range_for_position(int64_t z, int64_t num_cells,
+    int64_t* min_cell, int64_t* max_cell) const {
+  *min_cell = (z < 0) ? 0 : (z / this->params->grid_pitch);
+  *max_cell = (z + this->params->grid_pitch - 1 < 0) ? 0 :
+      ((z + this->params->grid_pitch - 1) / this->params->grid_pitch);
+  if (*min_cell >= num_cells) {
+    *min_cell = num_cells - 1;
+  }
+  if (*max_cell >= num_cells) {
+    *max_cell = num_cells - 1;
+  }
 }
 
-bool LevelState::is_within_bounds(int64_t x, int64_t y) const {
-  return (x >= 0) && (x <= this->params.w - this->params.grid_pitch) &&
-         (y >= 0) && (y <= this->params.h - this->params.grid_pitch);
+void LevelState::add_monster_to_cells(size_t monster_index) {
+  VALIDATE_TOUCH_MONSTER(monster_index);
+  int64_t x_cell_min, x_cell_max, y_cell_min, y_cell_max;
+  this->cell_range_for_position(this->monsters.x[monster_index], this->w_cells,
+      &x_cell_min, &x_cell_max);
+  this->cell_range_for_position(this->monsters.y[monster_index], this->h_cells,
+      &y_cell_min, &y_cell_max);
+  for (int64_t y_cell = y_cell_min; y_cell <= y_cell_max; y_cell++) {
+    for (int64_t x_cell = x_cell_min; x_cell <= x_cell_max; x_cell++) {
+      int64_t z = y_cell * this->w_cells + x_cell;
+      int64_t* slots = &this->monster_cells[z * monster_cell_slots];
+      int64_t* slots_end = slots + monster_cell_slots;
+      int64_t* slot = find(slots, slots_end, -1);
+      if (slot != slots_end) {
+        *slot = monster_index;
+      } else {
+        this->overflow_monsters.emplace_back(z, monster_index);
+      }
+    }
+  }
 }
 
-shared_ptr<Block> LevelState::find_block(int64_t x, int64_t y) {
-  for (auto& block : this->blocks) {
-    if ((block->x == x) && (block->y == y)) {
-      return block;
+void LevelState::remove_monster_from_cells(size_t monster_index, int64_t x,
+    int64_t y) {
+  int64_t x_cell_min, x_cell_max, y_cell_min, y_cell_max;
+  this->cell_range_for_position(x, this->w_cells, &x_cell_min, &x_cell_max);
+  this->cell_range_for_position(y, this->h_cells, &y_cell_min, &y_cell_max);
+  for (int64_t y_cell = y_cell_min; y_cell <= y_cell_max; y_cell++) {
+    for (int64_t x_cell = x_cell_min; x_cell <= x_cell_max; x_cell++) {
+      int64_t z = y_cell * this->w_cells + x_cell;
+      int64_t* slots = &this->monster_cells[z * monster_cell_slots];
+      int64_t* slots_end = slots + monster_cell_slots;
+      int64_t* slot = find(slots, slots_end, static_cast<int64_t>(monster_index));
+      if (slot != slots_end) {
+        *slot = -1;
+        continue;
+      }
+
+      auto it = find(this->overflow_monsters.begin(),
+          this->overflow_monsters.end(), make_pair(z, static_cast<int64_t>(monster_index)));
+      if (it == this->overflow_monsters.end()) {
+        throw logic_error("monster is missing from the cell index");
+      }
+      *it = this->overflow_monsters.back();
+      this->overflow_monsters.pop_back();
     }
   }
-  return NULL;
 }
 
-bool LevelState::space_is_empty(int64_t x, int64_t y) const {
-  // if any part of the space is out of bounds, it's not empty
-  if ((x < 0) || (y < 0) || (x >= this->params.w) || (y >= this->params.h)) {
-    return false;
+void LevelState::update_monster_in_cells(size_t monster_index, int64_t prev_x,
+    int64_t prev_y) {
+  VALIDATE_TOUCH_MONSTER(monster_index);
+
+  // most of the time a monster stays within the same cells, so check for that
+  // before doing any work
+  int64_t x = this->monsters.x[monster_index];
+  int64_t y = this->monsters.y[monster_index];
+  int64_t prev_min, prev_max, min, max;
+  this->cell_range_for_position(prev_x, this->w_cells, &prev_min, &prev_max);
+  this->cell_range_for_position(x, this->w_cells, &min, &max);
+  bool changed = (prev_min != min) || (prev_max != max);
+  if (!changed) {
+    this->cell_range_for_position(prev_y, this->h_cells, &prev_min, &prev_max);
+    this->cell_range_for_position(y, this->h_cells, &min, &max);
+    changed = (prev_min != min) || (prev_max != max);
+  }
+  if (changed) {
+    this->remove_monster_from_cells(monster_index, prev_x, prev_y);
+    this->add_monster_to_cells(monster_index);
   }
+}
 
-  int64_t x_min = x - this->params.grid_pitch;
-  int64_t y_min = y - this->params.grid_pitch;
-  int64_t x_max = x + this->params.grid_pitch;
-  int64_t y_max = y + this->params.grid_pitch;
-  for (auto& block : this->blocks) {
-    if ((block->x > x_min) && (block->x < x_max) &&
-        (block->y > y_min) && (block->y < y_max)) {
-      return false;
+void LevelState::find_monsters_near(int64_t x, int64_t y, size_t min_index,
+    vector<size_t>& ret) const {
+  ret.clear();
+
+  // any monster less than a grid pitch away overlaps the space at (x, y), so
+  // it must be in at least one of the cells that the space covers
+  int64_t x_cell_min, x_cell_max, y_cell_min, y_cell_max;
+  this->cell_range_for_position(x, this->w_cells, &x_cell_min, &x_cell_max);
+  this->cell_range_for_position(y, this->h_cells, &y_cell_min, &y_cell_max);
+  auto check_monster = [&](int64_t monster_index) {
+    if ((monster_index >= 0) && (static_cast<size_t>(monster_index) >= min_index) &&
+        (llabs(this->monsters.x[monster_index] - x) < this->params->grid_pitch) &&
+        (llabs(this->monsters.y[monster_index] - y) < this->params->grid_pitch)) {
+      ret.emplace_back(monster_index);
+    }
+  };
+  for (int64_t y_cell = y_cell_min; y_cell <= y_cell_max; y_cell++) {
+    for (int64_t x_cell = x_cell_min; x_cell <= x_cell_max; x_cell++) {
+      int64_t z = y_cell * this->w_cells + x_cell;
+      for (size_t slot = 0; slot < monster_cell_slots; slot++) {
+        check_monster(this->monster_cells[z * monster_cell_slots + slot]);
+      }
+      for (const auto& it : this->overflow_monsters) {
+        if (it.first == z) {
+          check_monster(it.second);
+        }
+      }
     }
   }
-  return true;
+
+  // a misaligned monster is in more than one cell, so it may have been found
+  // more than once
+  sort(ret.begin(), ret.end());
+  ret.erase(unique(ret.begin(), ret.end()), ret.end());
 }
 
 bool LevelState::check_stationary_collision(int64_t this_x, int64_t this_y,
     int64_t other_x, int64_t other_y) const {
-  return ((llabs(this_x - other_x) < this->params.grid_pitch) &&
-          (llabs(this_y - other_y) < this->params.grid_pitch));
+  PROFILE_COUNT(collision_tests, 1);
+  return ((llabs(this_x - other_x) < this->params->grid_pitch) &&
+          (llabs(this_y - other_y) < this->params->grid_pitch));
 }
 
 bool LevelState::check_moving_collision(int64_t this_x, int64_t this_y,
     int64_t this_x_speed, int64_t this_y_speed, int64_t other_x,
     int64_t other_y) const {
+  PROFILE_COUNT(collision_tests, 1);
   if (this_x_speed) {
     int64_t new_x = this_x + this_x_speed;
 
     // if the monster is too far up or down, there's no collision
-    if ((other_y >= this_y + this->params.grid_pitch) ||
-        (other_y + this->params.grid_pitch <= this_y)) {
+    if ((other_y >= this_y + this->params->grid_pitch) ||
+        (other_y + this->params->grid_pitch <= this_y)) {
       return false;
     }
 
     // if the object is moving left, check its left edge against the other
     // object's entirety. otherwise, check its right edge
     if (this_x_speed < 0) {
-      return (new_x < other_x + this->params.grid_pitch) && (new_x > other_x);
+      return (new_x < other_x + this->params->grid_pitch) && (new_x > other_x);
     } else {
-      return (new_x + this->params.grid_pitch < other_x + this->params.grid_pitch) &&
-             (new_x + this->params.grid_pitch > other_x);
+      return (new_x + this->params->grid_pitch < other_x + this->params->grid_pitch) &&
+             (new_x + this->params->grid_pitch > other_x);
     }
 
   } else if (this_y_speed) {
@@ -961,16 +2645,16 @@ bool LevelState::check_moving_collision(int64_t this_x, int64_t this_y,
     int64_t new_y = this_y + this_y_speed;
 
     // if the monster is too far up or down, there's no collision
-    if ((other_x >= this_x + this->params.grid_pitch) ||
-        (other_x + this->params.grid_pitch <= this_x)) {
+    if ((other_x >= this_x + this->params->grid_pitch) ||
+        (other_x + this->params->grid_pitch <= this_x)) {
       return false;
     }
 
     if (this_y_speed < 0) {
-      return (new_y < other_y + this->params.grid_pitch) && (new_y > other_y);
+      return (new_y < other_y + this->params->grid_pitch) && (new_y > other_y);
     } else {
-      return (new_y + this->params.grid_pitch < other_y + this->params.grid_pitch) &&
-             (new_y + this->params.grid_pitch > other_y);
+      return (new_y + this->params->grid_pitch < other_y + this->params->grid_pitch) &&
+             (new_y + this->params->grid_pitch > other_y);
     }
 
   }
@@ -978,31 +2662,26 @@ bool LevelState::check_moving_collision(int64_t this_x, int64_t this_y,
   return false;
 }
 
-LevelState::FrameEvents::ScoreInfo::ScoreInfo(shared_ptr<Monster> monster,
-    shared_ptr<Monster> killed, int64_t score, int64_t lives, int64_t skip_levels,
+LevelState::FrameEvents::ScoreInfo::ScoreInfo(EntityHandle monster,
+    EntityHandle killed, int64_t score, int64_t lives, int64_t skip_levels,
     BlockSpecial bonus, int64_t block_x, int64_t block_y) : score(score),
     lives(lives), skip_levels(skip_levels), bonus(bonus), block_x(block_x),
     block_y(block_y), monster(monster), killed(killed) { }
 
 string LevelState::FrameEvents::ScoreInfo::str() const {
+  string monster_str = this->monster.str();
+  string killed_str = this->killed.str();
   return string_printf("ScoreInfo(score=%" PRId64 ", lives=%" PRId64
       ", skip_levels=%" PRId64 ", bonus=%" PRId64 ", block_x=%" PRId64
-      ", block_y=%" PRId64 ", monster=%p, killed=%p)",
-      this->score, this->lives, this->skip_levels, this->bonus, this->block_x,
-      this->block_y, this->monster.get(), this->killed.get());
+      ", block_y=%" PRId64 ", monster=%s, killed=%s)",
+      this->score, this->lives, this->skip_levels,
+      static_cast<int64_t>(this->bonus), this->block_x,
+      this->block_y, monster_str.c_str(), killed_str.c_str());
 }
 
 LevelState::FrameEvents::FrameEvents() : events_mask(0) { }
 
-LevelState::FrameEvents& LevelState::FrameEvents::operator|=(
-    const FrameEvents& other) {
-  this->events_mask |= other.events_mask;
-  this->scores.insert(this->scores.end(), other.scores.begin(),
-      other.scores.end());
-  return *this;
-}
-
-LevelState::FrameEvents LevelState::exec_frame(int64_t impulses) {
+const LevelState::FrameEvents& LevelState::exec_frame(int64_t impulses) {
   // executes a single frame. the order of actions is as follows:
   // 1. set player and monster control impulses (essentially, everyone decides
   //    what they want to do on this frame). also change the directions that
@@ -1034,71 +2713,68 @@ LevelState::FrameEvents LevelState::exec_frame(int64_t impulses) {
       BlockSpecial::ThrowBombs,
       BlockSpecial::KillsMonsters});
 
+  PROFILE_BEGIN_FRAME();
+
   // collect events that occurred during this frame (this is used for playing
   // sounds)
-  FrameEvents ret;
+  auto& ret = this->frame_events;
   ret.events_mask = Event::NoEvents;
-
-  // figure out which monsters are allowed to move
-  unordered_set<shared_ptr<Monster>> time_stop_holders;
-  for (const auto& monster : this->monsters) {
-    if (monster->has_special(BlockSpecial::TimeStop)) {
-      time_stop_holders.emplace(monster);
+  ret.scores.clear();
+#ifdef TREADS_VALIDATE
+  this->touched_blocks.clear();
+  this->touched_monsters.clear();
+#endif
+
+  // figure out which monsters are allowed to move. monsters that get or lose
+  // TimeStop during the frame don't change this until the next frame
+  this->time_stop_holders.clear();
+  if (this->monsters.time_stop_holder_count) {
+    for (const auto& monster : this->monsters) {
+      if (monster.has_special(BlockSpecial::TimeStop)) {
+        this->time_stop_holders.emplace_back(monster.get_index());
+      }
     }
   }
+  auto held_by_time_stop = [&](size_t monster_index) -> bool {
+    return !this->time_stop_holders.empty() &&
+        (find(this->time_stop_holders.begin(), this->time_stop_holders.end(),
+          monster_index) == this->time_stop_holders.end());
+  };
 
   // (step 1) monsters update their impulses if their integrity is 1.0. if it's
   // not 1.0, their integrity increases a little
-  for (auto& monster : this->monsters) {
-    if (!monster->is_alive()) {
+  for (auto monster : this->monsters) {
+    if (!monster.is_alive()) {
       continue; // dead monsters tell no tales
     }
-    if (monster->integrity < 1) {
-      monster->integrity += 0.01;
+    if (monster.integrity() < 1) {
+      monster.integrity() += 0.01;
       continue; // can't move
     }
-    if (!time_stop_holders.empty() && !time_stop_holders.count(monster)) {
+    if (held_by_time_stop(monster.get_index())) {
       continue; // this monster is held by a time stop
     }
 
     // if the monster isn't a player and isn't aligned, don't bother - it can't
     // move anyway
-    if (!monster->has_flags(Monster::Flag::IsPlayer) &&
-        (!this->is_aligned(monster->x) || !this->is_aligned(monster->y))) {
+    if (!monster.has_flags(Monster::Flag::IsPlayer) &&
+        (!this->is_aligned(monster.x()) || !this->is_aligned(monster.y()))) {
       continue;
     }
 
-    switch (monster->movement_policy) {
+    switch (monster.movement_policy()) {
       case Monster::MovementPolicy::Player:
-        monster->control_impulse = impulses;
+        monster.control_impulse() = impulses;
         break;
 
       case Monster::MovementPolicy::SeekPlayer: {
-        // find the nearest player
-        int64_t min_dist = dist2(0, 0, this->params.grid_pitch * this->params.w,
-            this->params.grid_pitch * this->params.h);
-        shared_ptr<const Monster> nearest_player;
-        for (const auto& other_monster : this->monsters) {
-          if (!other_monster->has_flags(Monster::Flag::IsPlayer) ||
-              !other_monster->is_alive()) {
-            continue;
-          }
-          int64_t dist = dist2(monster->x, monster->y, other_monster->x, other_monster->y);
-          if (dist < min_dist) {
-            min_dist = dist;
-            nearest_player = other_monster;
-          }
-        }
-
-        if (nearest_player.get()) {
-          int64_t target_x = this->align(nearest_player->x);
-          int64_t target_y = this->align(nearest_player->y);
-          Impulse path_impulse = this->find_path(monster->x, monster->y,
-              target_x, target_y);
-          if (path_impulse != Impulse::None) {
-            monster->control_impulse = path_impulse;
-            break;
-          }
+        // all SeekPlayer monsters share one distance field per frame, so this
+        // is cheap after the first one
+        Impulse path_impulse = this->direction_toward_nearest_player(
+            monster.x(), monster.y());
+        if (path_impulse != Impulse::None) {
+          monster.control_impulse() = path_impulse;
+          break;
         }
 
         // if there's no player (what?!) or no path to the player, then use the
@@ -1108,10 +2784,9 @@ LevelState::FrameEvents LevelState::exec_frame(int64_t impulses) {
 
       case Monster::MovementPolicy::Straight: {
         // if the monster can move forward, continue to do so
-        auto offsets = offsets_for_direction(monster->facing_direction);
-        if (this->space_is_empty(monster->x + this->params.grid_pitch * offsets.first,
-            monster->y + this->params.grid_pitch * offsets.second)) {
-          monster->control_impulse = monster->facing_direction;
+        if (this->empty_directions(monster.x(), monster.y()) &
+            monster.facing_direction()) {
+          monster.control_impulse() = monster.facing_direction();
           break;
         }
         // else, fall through to the Random algorithm
@@ -1120,15 +2795,8 @@ LevelState::FrameEvents LevelState::exec_frame(int64_t impulses) {
       Monster__MovementPolicy__Random:
       case Monster::MovementPolicy::Random: {
         // figure out which directions the monster can move
-        uint8_t available_directions = Impulse::None;
-        for (Impulse dir : all_directions) {
-          auto offsets = offsets_for_direction(dir);
-          if (this->space_is_empty(monster->x + this->params.grid_pitch * offsets.first,
-              monster->y + this->params.grid_pitch * offsets.second)) {
-            available_directions |= dir;
-          }
-        }
-        monster->choose_random_direction(available_directions);
+        monster.choose_random_direction(
+            this->empty_directions(monster.x(), monster.y()), this->rng);
         break;
       }
     }
@@ -1136,53 +2804,55 @@ LevelState::FrameEvents LevelState::exec_frame(int64_t impulses) {
     // make the monster face in the impulse direction and update its speed if
     // it's aligned
     bool apply_impulse = false;
-    if (monster->has_flags(Monster::Flag::IsPlayer)) {
+    if (monster.has_flags(Monster::Flag::IsPlayer)) {
       // unlike monsters, players can turn around mid-cell
-      Impulse new_direction = collapse_direction(monster->control_impulse);
+      Impulse new_direction = collapse_direction(monster.control_impulse());
       if (((new_direction == Impulse::Left) || (new_direction == Impulse::Right)) &&
-          this->is_aligned(monster->y)) {
+          this->is_aligned(monster.y())) {
         apply_impulse = true;
       }
       if (((new_direction == Impulse::Up) || (new_direction == Impulse::Down)) &&
-          this->is_aligned(monster->x)) {
+          this->is_aligned(monster.x())) {
         apply_impulse = true;
       }
-      if ((new_direction == Impulse::None) && this->is_aligned(monster->x) && this->is_aligned(monster->y)) {
+      if ((new_direction == Impulse::None) && this->is_aligned(monster.x()) && this->is_aligned(monster.y())) {
         apply_impulse = true;
       }
     } else {
-      apply_impulse = this->is_aligned(monster->x) && this->is_aligned(monster->y);
+      apply_impulse = this->is_aligned(monster.x()) && this->is_aligned(monster.y());
     }
     if (apply_impulse) {
-      Impulse new_direction = collapse_direction(monster->control_impulse);
+      Impulse new_direction = collapse_direction(monster.control_impulse());
       if (new_direction == Impulse::None) {
-        monster->x_speed = 0;
-        monster->y_speed = 0;
+        monster.x_speed() = 0;
+        monster.y_speed() = 0;
       } else {
-        monster->facing_direction = new_direction;
-        if (monster->facing_direction == Impulse::Left) {
-          monster->x_speed = -monster->move_speed;
-          monster->y_speed = 0;
-        } else if (monster->facing_direction == Impulse::Right) {
-          monster->x_speed = monster->move_speed;
-          monster->y_speed = 0;
-        } else if (monster->facing_direction == Impulse::Up) {
-          monster->x_speed = 0;
-          monster->y_speed = -monster->move_speed;
-        } else if (monster->facing_direction == Impulse::Down) {
-          monster->x_speed = 0;
-          monster->y_speed = monster->move_speed;
+        monster.facing_direction() = new_direction;
+        if (monster.facing_direction() == Impulse::Left) {
+          monster.x_speed() = -monster.move_speed();
+          monster.y_speed() = 0;
+        } else if (monster.facing_direction() == Impulse::Right) {
+          monster.x_speed() = monster.move_speed();
+          monster.y_speed() = 0;
+        } else if (monster.facing_direction() == Impulse::Up) {
+          monster.x_speed() = 0;
+          monster.y_speed() = -monster.move_speed();
+        } else if (monster.facing_direction() == Impulse::Down) {
+          monster.x_speed() = 0;
+          monster.y_speed() = monster.move_speed();
         }
       }
     }
   }
 
+  PROFILE_PHASE(Pushes);
+
   // (step 2) apply push impulses appropriately
-  for (auto& monster : this->monsters) {
-    if (!monster->is_alive()) {
+  for (auto monster : this->monsters) {
+    if (!monster.is_alive()) {
       continue; // dead monsters tell no tales
     }
-    if (!time_stop_holders.empty() && !time_stop_holders.count(monster)) {
+    if (held_by_time_stop(monster.get_index())) {
       continue; // this monster is held by a time stop
     }
 
@@ -1197,241 +2867,277 @@ LevelState::FrameEvents LevelState::exec_frame(int64_t impulses) {
     // space beyond it is empty; otherwise, the block is destroyed.
 
     // (2.1) check if the monster has a Push impulse
-    if (!(monster->control_impulse & Impulse::Push)) {
+    if (!(monster.control_impulse() & Impulse::Push)) {
       continue;
     }
 
     // (2.2) check if there's a block in the appropriate spot
-    auto offsets = offsets_for_direction(monster->facing_direction);
-    auto block = this->find_block(monster->x + offsets.first * this->params.grid_pitch,
-                                  monster->y + offsets.second * this->params.grid_pitch);
-    if (!block.get()) {
+    auto offsets = offsets_for_direction(monster.facing_direction());
+    int64_t block_index = this->find_block(
+        monster.x() + offsets.first * this->params->grid_pitch,
+        monster.y() + offsets.second * this->params->grid_pitch);
+    if (block_index < 0) {
       // (2.2.1) no block; the monster throws a bomb if it has ThrowBombs and
       // there are two empty cells in front of it
       // TODO: do this more efficiently by not calling space_is_empty (and
       // iterating all blocks) twice
-      if (monster->has_special(BlockSpecial::ThrowBombs) &&
-          this->space_is_empty(monster->x + offsets.first * this->params.grid_pitch,
-                               monster->y + offsets.second * this->params.grid_pitch) &&
-          this->space_is_empty(monster->x + offsets.first * 2 * this->params.grid_pitch,
-                               monster->y + offsets.second * 2 * this->params.grid_pitch)) {
-        int64_t bomb_x = monster->x + offsets.first * (this->params.grid_pitch + monster->push_speed);
-        int64_t bomb_y = monster->y + offsets.second * (this->params.grid_pitch + monster->push_speed);
-        auto block = *this->blocks.emplace(new Block(bomb_x, bomb_y,
-            BlockSpecial::Bomb)).first;
-        block->set_flags(Block::Flag::IsBomb);
-        block->x_speed = offsets.first * monster->push_speed;
-        block->y_speed = offsets.second * monster->push_speed;
-        block->owner = monster;
-        block->bomb_speed = monster->push_speed;
+      if (monster.has_special(BlockSpecial::ThrowBombs) &&
+          this->space_is_empty(monster.x() + offsets.first * this->params->grid_pitch,
+                               monster.y() + offsets.second * this->params->grid_pitch) &&
+          this->space_is_empty(monster.x() + offsets.first * 2 * this->params->grid_pitch,
+                               monster.y() + offsets.second * 2 * this->params->grid_pitch)) {
+        int64_t bomb_x = monster.x() + offsets.first * (this->params->grid_pitch + monster.push_speed());
+        int64_t bomb_y = monster.y() + offsets.second * (this->params->grid_pitch + monster.push_speed());
+        auto block = this->blocks[this->blocks.add(bomb_x, bomb_y,
+            BlockSpecial::Bomb)];
+        block.set_flags(Block::Flag::IsBomb);
+        block.x_speed() = offsets.first * monster.push_speed();
+        block.y_speed() = offsets.second * monster.push_speed();
+        block.owner() = monster.handle();
+        block.bomb_speed() = monster.push_speed();
+        this->add_block_to_grid(block.get_index());
       }
       continue; // there's no block to push
     }
 
     // (2.3) check if the monster's position is aligned
-    if (!this->is_aligned(monster->x) || !this->is_aligned(monster->y)) {
+    if (!this->is_aligned(monster.x()) || !this->is_aligned(monster.y())) {
       continue;
     }
 
     // (2.4) check if the block is already moving
-    if (block->x_speed || block->y_speed) {
+    auto block = this->blocks[block_index];
+    if (block.x_speed() || block.y_speed()) {
       continue;
     }
 
     // (2.5) check if there's space behind the block; push it if so
-    ret |= this->apply_push_impulse(block, monster, monster->facing_direction,
-        monster->push_speed);
+    this->apply_push_impulse(block, monster.get_index(),
+        monster.facing_direction(), monster.push_speed());
   }
 
-  // (step 3) update decaying blocks
-  for (auto block_it = this->blocks.begin(); block_it != this->blocks.end();) {
-    (*block_it)->integrity -= (*block_it)->decay_rate;
+  PROFILE_PHASE(Decay);
 
-    // if the block has no integrity left, delete it
-    if ((*block_it)->integrity <= 0.0) {
-      block_it = this->blocks.erase(block_it);
+  // (step 3) update decaying blocks
+  for (size_t block_index = 0; block_index < this->blocks.size();) {
+    auto block = this->blocks[block_index];
+    block.integrity() -= block.decay_rate();
+
+    // if the block has no integrity left, delete it. this moves the last block
+    // into this index, so don't advance
+    if (block.integrity() <= 0.0) {
+      this->delete_block(block_index);
     } else {
-      block_it++;
+      block_index++;
     }
   }
 
+  PROFILE_PHASE(Specials);
+
   // (step 4) update monster specials
-  for (auto& monster : this->monsters) {
-    monster->attenuate_and_delete_specials();
+  for (auto monster : this->monsters) {
+    monster.attenuate_and_delete_specials();
   }
 
+  PROFILE_PHASE(BlockMotion);
+
   // (step 5) moving blocks slide until they hit something that blocks them,
   // squishing things that get in their way and are squishable
-  for (auto& block : this->blocks) {
+  auto& candidates = this->candidate_indexes;
+  for (auto block : this->blocks) {
     // if it's not moving, it won't hit anything
-    if ((block->x_speed == 0) && (block->y_speed == 0)) {
+    if ((block.x_speed() == 0) && (block.y_speed() == 0)) {
       continue;
     }
 
     bool collision = false;
+    int64_t prev_x = block.x();
+    int64_t prev_y = block.y();
 
     // (5.1) check for collisions with the level edges (this will cause it to
     // stop or bounce)
     // (5.1.1) left edge
-    if (this->check_moving_collision(block->x, block->y, block->x_speed,
-        block->y_speed, -this->params.grid_pitch, block->y)) {
-      block->x = 0;
-      block->x_speed = -block->x_speed + block->bounce_speed_absorption * sgn(block->x_speed);
+    if (this->check_moving_collision(block.x(), block.y(), block.x_speed(),
+        block.y_speed(), -this->params->grid_pitch, block.y())) {
+      block.x() = 0;
+      block.x_speed() = -block.x_speed() + block.bounce_speed_absorption() * sgn(block.x_speed());
       collision = true;
     }
     // (5.1.2) right edge
-    if (this->check_moving_collision(block->x, block->y, block->x_speed,
-        block->y_speed, this->params.w, block->y)) {
-      block->x = this->params.w - this->params.grid_pitch;
-      block->x_speed = -block->x_speed + block->bounce_speed_absorption * sgn(block->x_speed);
+    if (this->check_moving_collision(block.x(), block.y(), block.x_speed(),
+        block.y_speed(), this->params->w, block.y())) {
+      block.x() = this->params->w - this->params->grid_pitch;
+      block.x_speed() = -block.x_speed() + block.bounce_speed_absorption() * sgn(block.x_speed());
       collision = true;
     }
     // (5.1.3) top edge
-    if (this->check_moving_collision(block->x, block->y, block->x_speed,
-        block->y_speed, block->x, -this->params.grid_pitch)) {
-      block->y = 0;
-      block->y_speed = -block->y_speed + block->bounce_speed_absorption * sgn(block->y_speed);
+    if (this->check_moving_collision(block.x(), block.y(), block.x_speed(),
+        block.y_speed(), block.x(), -this->params->grid_pitch)) {
+      block.y() = 0;
+      block.y_speed() = -block.y_speed() + block.bounce_speed_absorption() * sgn(block.y_speed());
       collision = true;
     }
     // (5.1.4) bottom edge
-    if (this->check_moving_collision(block->x, block->y, block->x_speed,
-        block->y_speed, block->x, this->params.h)) {
-      block->y = this->params.h - this->params.grid_pitch;
-      block->y_speed = -block->y_speed + block->bounce_speed_absorption * sgn(block->y_speed);
+    if (this->check_moving_collision(block.x(), block.y(), block.x_speed(),
+        block.y_speed(), block.x(), this->params->h)) {
+      block.y() = this->params->h - this->params->grid_pitch;
+      block.y_speed() = -block.y_speed() + block.bounce_speed_absorption() * sgn(block.y_speed());
       collision = true;
     }
 
     // (5.2) check for collisions with other blocks (this will cause it to stop
-    // or bounce)
-    for (auto& other_block : this->blocks) {
-      if (block == other_block) {
-        continue; // can't collide with itself, lolz
+    // or bounce). a block moves along only one axis, so it can only hit blocks
+    // that are less than a grid pitch away from its next position; we get
+    // those from the occupancy grid and check them in index order. when the
+    // block bounces, its position and speed change, so we get the candidates
+    // again, skipping the ones we've already checked.
+    for (size_t min_index = 0;;) {
+      if ((block.x_speed() == 0) && (block.y_speed() == 0)) {
+        break; // it stopped; it can't hit anything else
       }
-
-      bool other_block_collision = this->check_moving_collision(block->x,
-          block->y, block->x_speed, block->y_speed, other_block->x,
-          other_block->y);
-      if (other_block_collision) {
-        // this block hit the other block; put this block right next to the
-        // other block, and make it bounce away and maybe slow down. but
-        // blocks can't stop on misaligned positions, so if the position is
-        // misaligned, it always bounces elastically.
-        if (block->x_speed) {
-          bool elastic_bounce = (other_block->has_flags(Block::Flag::Bouncy)) ||
-              !this->is_aligned(other_block->x);
-          block->x = other_block->x - sgn(block->x_speed) * this->params.grid_pitch;
-          block->x_speed = -block->x_speed + (!elastic_bounce) * block->bounce_speed_absorption * sgn(block->x_speed);
-        } else {
-          bool elastic_bounce = (other_block->has_flags(Block::Flag::Bouncy)) ||
-              !this->is_aligned(other_block->y);
-          block->y = other_block->y - sgn(block->y_speed) * this->params.grid_pitch;
-          block->y_speed = -block->y_speed + (!elastic_bounce) * block->bounce_speed_absorption * sgn(block->y_speed);
+      bool along_x = (block.x_speed() != 0);
+      int64_t next_x = block.x() + (along_x ? block.x_speed() : 0);
+      int64_t next_y = block.y() + (along_x ? 0 : block.y_speed());
+      this->find_blocks_near(next_x, next_y, min_index, candidates);
+
+      bool bounced = false;
+      for (size_t other_index : candidates) {
+        if (other_index == block.get_index()) {
+          continue; // can't collide with itself, lolz
         }
-        collision = true;
+        auto other_block = this->blocks[other_index];
+
+        bool other_block_collision = this->check_moving_collision(block.x(),
+            block.y(), block.x_speed(), block.y_speed(), other_block.x(),
+            other_block.y());
+        if (other_block_collision) {
+          // this block hit the other block; put this block right next to the
+          // other block, and make it bounce away and maybe slow down. but
+          // blocks can't stop on misaligned positions, so if the position is
+          // misaligned, it always bounces elastically.
+          if (block.x_speed()) {
+            bool elastic_bounce = (other_block.has_flags(Block::Flag::Bouncy)) ||
+                !this->is_aligned(other_block.x());
+            block.x() = other_block.x() - sgn(block.x_speed()) * this->params->grid_pitch;
+            block.x_speed() = -block.x_speed() + (!elastic_bounce) * block.bounce_speed_absorption() * sgn(block.x_speed());
+          } else {
+            bool elastic_bounce = (other_block.has_flags(Block::Flag::Bouncy)) ||
+                !this->is_aligned(other_block.y());
+            block.y() = other_block.y() - sgn(block.y_speed()) * this->params->grid_pitch;
+            block.y_speed() = -block.y_speed() + (!elastic_bounce) * block.bounce_speed_absorption() * sgn(block.y_speed());
+          }
+          collision = true;
+          bounced = true;
+          min_index = other_index + 1;
+          break;
+        }
+      }
+      if (!bounced) {
+        break;
       }
     }
 
     // (5.3) check for collisions with monsters (this will cause the block to
-    // stop, bounce, or kill)
-    for (auto& other_monster : this->monsters) {
-      if (!other_monster->is_alive()) {
-        continue; // dead monsters tell no tales
+    // stop, bounce, or kill). like above, only monsters near the block's next
+    // position can be hit
+    for (size_t min_index = 0;;) {
+      if ((block.x_speed() == 0) && (block.y_speed() == 0)) {
+        break;
       }
+      bool along_x = (block.x_speed() != 0);
+      int64_t next_x = block.x() + (along_x ? block.x_speed() : 0);
+      int64_t next_y = block.y() + (along_x ? 0 : block.y_speed());
+      this->find_monsters_near(next_x, next_y, min_index, candidates);
+
+      bool bounced = false;
+      for (size_t other_index : candidates) {
+        auto other_monster = this->monsters[other_index];
+        if (!other_monster.is_alive()) {
+          continue; // dead monsters tell no tales
+        }
 
-      if (!this->check_moving_collision(block->x, block->y, block->x_speed,
-          block->y_speed, other_monster->x, other_monster->y)) {
-        continue;
-      }
+        if (!this->check_moving_collision(block.x(), block.y(), block.x_speed(),
+            block.y_speed(), other_monster.x(), other_monster.y())) {
+          continue;
+        }
 
-      // logic here is similar to the above loop
-      if (other_monster->has_flags(Monster::Flag::Squishable) &&
-          !other_monster->has_flags(Monster::Flag::Invincible)) {
-        bool is_player = other_monster->has_flags(Monster::Flag::IsPlayer);
-        bool is_power = other_monster->has_flags(Monster::Flag::IsPower);
-        block->monsters_killed_this_push++;
-        other_monster->death_frame = this->frames_executed;
-        ret.events_mask |= is_player ? Event::PlayerSquished : Event::MonsterSquished;
-        ret.scores.emplace_back(block->owner, other_monster,
-            this->score_for_monster(is_power, block->monsters_killed_this_push));
+        // logic here is similar to the above loop
+        if (other_monster.has_flags(Monster::Flag::Squishable) &&
+            !other_monster.has_flags(Monster::Flag::Invincible)) {
+          bool is_player = other_monster.has_flags(Monster::Flag::IsPlayer);
+          bool is_power = other_monster.has_flags(Monster::Flag::IsPower);
+          block.monsters_killed_this_push()++;
+          other_monster.death_frame() = this->frames_executed;
+          this->remove_monster_from_cells(other_index, other_monster.x(),
+              other_monster.y());
+          ret.events_mask |= is_player ? Event::PlayerSquished : Event::MonsterSquished;
+          ret.scores.emplace_back(block.owner(), other_monster.handle(),
+              this->score_for_monster(is_power, block.monsters_killed_this_push()));
 
-      } else {
-        if (block->x_speed) {
-          bool elastic_bounce = !this->is_aligned(other_monster->x);
-          block->x = other_monster->x - sgn(block->x_speed) * this->params.grid_pitch;
-          block->x_speed = -block->x_speed + (!elastic_bounce) * block->bounce_speed_absorption * sgn(block->x_speed);
         } else {
-          bool elastic_bounce = !this->is_aligned(other_monster->y);
-          block->y = other_monster->y - sgn(block->y_speed) * this->params.grid_pitch;
-          block->y_speed = -block->y_speed + (!elastic_bounce) * block->bounce_speed_absorption * sgn(block->y_speed);
+          if (block.x_speed()) {
+            bool elastic_bounce = !this->is_aligned(other_monster.x());
+            block.x() = other_monster.x() - sgn(block.x_speed()) * this->params->grid_pitch;
+            block.x_speed() = -block.x_speed() + (!elastic_bounce) * block.bounce_speed_absorption() * sgn(block.x_speed());
+          } else {
+            bool elastic_bounce = !this->is_aligned(other_monster.y());
+            block.y() = other_monster.y() - sgn(block.y_speed()) * this->params->grid_pitch;
+            block.y_speed() = -block.y_speed() + (!elastic_bounce) * block.bounce_speed_absorption() * sgn(block.y_speed());
+          }
+          collision = true;
+          bounced = true;
+          min_index = other_index + 1;
+          break;
         }
-        collision = true;
+      }
+      if (!bounced) {
+        break;
       }
     }
 
     // (5.4) if collision is true, then we've already updated the block's
-    // location, so we shouldn't move it incrementally
+    // location, so we shouldn't move it incrementally. either way, the
+    // occupancy grid has to be updated before anything below looks at it
+    if (!collision) {
+      block.x() += block.x_speed();
+      block.y() += block.y_speed();
+    }
+    this->update_block_in_grid(block.get_index(), prev_x, prev_y);
     if (!collision) {
-      block->x += block->x_speed;
-      block->y += block->y_speed;
+      // the block is still sliding; nothing else to do
 
     // (5.4.1) if the block collided and is a bomb and is aligned, it explodes.
     // if it's a bouncy bomb, it only explodes if it's stopped.
-    } else if (block->has_flags(Block::Flag::IsBomb) &&
-        this->is_aligned(block->x) && this->is_aligned(block->y) &&
-        (!block->has_flags(Block::Flag::DelayedBomb) || ((block->x_speed == 0) && (block->y_speed == 0)))) {
-      ret |= this->apply_explosion(block);
+    } else if (block.has_flags(Block::Flag::IsBomb) &&
+        this->is_aligned(block.x()) && this->is_aligned(block.y()) &&
+        (!block.has_flags(Block::Flag::DelayedBomb) || ((block.x_speed() == 0) && (block.y_speed() == 0)))) {
+      this->apply_explosion(block);
 
     // (5.4.2) if the block stopped and is a LineUp, check if it's lined up with
     // other LineUp blocks
-    } else if ((block->special == BlockSpecial::LineUp) &&
-        this->is_aligned(block->x) && this->is_aligned(block->y) &&
-        (block->x_speed == 0) && (block->y_speed == 0)) {
-      auto left_block = find_block(block->x - this->params.grid_pitch, block->y);
-      auto left2_block = find_block(block->x - 2 * this->params.grid_pitch, block->y);
-      auto right_block = find_block(block->x + this->params.grid_pitch, block->y);
-      auto right2_block = find_block(block->x + 2 * this->params.grid_pitch, block->y);
-      auto up_block = find_block(block->x, block->y - this->params.grid_pitch);
-      auto up2_block = find_block(block->x, block->y - 2 * this->params.grid_pitch);
-      auto down_block = find_block(block->x, block->y + this->params.grid_pitch);
-      auto down2_block = find_block(block->x, block->y + 2 * this->params.grid_pitch);
-      vector<vector<shared_ptr<Block>>> formations({
-          // 5-block formations first
-          {left2_block, left_block, block, right_block, right2_block},
-          {up2_block, up_block, block, down_block, down2_block},
-
-          // 4-block formations
-          {left2_block, left_block, block, right_block},
-          {left_block, block, right_block, right2_block},
-          {up2_block, up_block, block, down_block},
-          {up_block, block, down_block, down2_block},
-
-          // 3-block formations
-          {left2_block, left_block, block},
-          {left_block, block, right_block},
-          {block, right_block, right2_block},
-          {up2_block, up_block, block},
-          {up_block, block, down_block},
-          {block, down_block, down2_block},
-      });
-
-      for (auto& formation : formations) {
-        size_t blocks_with_special = 0;
-        for (auto& block : formation) {
-          if (!block.get() || (block->special != BlockSpecial::LineUp)) {
-            break;
-          }
-          blocks_with_special++;
-        }
-        if (blocks_with_special != formation.size()) {
+    } else if ((block.special() == BlockSpecial::LineUp) &&
+        this->is_aligned(block.x()) && this->is_aligned(block.y()) &&
+        (block.x_speed() == 0) && (block.y_speed() == 0)) {
+      // if a formation matched, all of its blocks get random specials, from
+      // left to right and top to bottom
+      int64_t x_cell = block.x() / this->params->grid_pitch;
+      int64_t y_cell = block.y() / this->params->grid_pitch;
+      uint32_t placement = this->match_lineup_formation(x_cell, y_cell);
+      for (int64_t z = 0; placement; z++, placement >>= 1) {
+        if (!(placement & 1)) {
           continue;
         }
-
-        // at this point, the formation matched and should be resolved
-        for (auto& block : formation) {
-        block->set_special(random_specials[rand() % random_specials.size()],
-            this->frames_between_monsters);
+        int64_t formation_block_index = block.get_index();
+        if (z != lineup_window_center) {
+          int64_t dx = (z % lineup_window_size) - (lineup_window_center % lineup_window_size);
+          int64_t dy = (z / lineup_window_size) - (lineup_window_center / lineup_window_size);
+          formation_block_index = this->find_block(
+              block.x() + dx * this->params->grid_pitch,
+              block.y() + dy * this->params->grid_pitch);
         }
-        break;
+        this->set_block_special(formation_block_index,
+            random_specials[this->rng() % random_specials.size()],
+            this->frames_between_monsters);
       }
 
       ret.events_mask |= Event::BlockStopped;
@@ -1439,18 +3145,34 @@ LevelState::FrameEvents LevelState::exec_frame(int64_t impulses) {
     // (5.4.3) there was a collision, and the block didn't explode. play the
     // appropriate sound for this
     } else {
-      bool stopped = (block->x_speed == 0) && (block->y_speed == 0);
+      bool stopped = (block.x_speed() == 0) && (block.y_speed() == 0);
       ret.events_mask |= stopped ? Event::BlockStopped : Event::BlockBounced;
     }
   }
 
+  PROFILE_PHASE(MonsterMotion);
+
   // (step 6) monsters and players move according to their speeds; if they
   // collide with blocks they stop, if they collide with other monsters they may
   // stop, die, kill, or continue depending on their flags.
-  for (auto& monster : this->monsters) {
-    if (!monster->is_alive()) {
+  // usually a monster can only be affected by monsters that it touches, which
+  // we get from the cell index. but a monster that blocks others stops them
+  // no matter where it is (see step 6.3), so if there are any such monsters,
+  // every monster has to look at all the others.
+  bool any_blocking_monsters = false;
+  for (const auto& monster : this->monsters) {
+    if (monster.is_alive() && monster.has_any_flags(
+        Monster::Flag::BlocksPlayers | Monster::Flag::BlocksMonsters)) {
+      any_blocking_monsters = true;
+      break;
+    }
+  }
+  for (auto monster : this->monsters) {
+    if (!monster.is_alive()) {
       continue; // dead monsters tell no tales
     }
+    int64_t prev_x = monster.x();
+    int64_t prev_y = monster.y();
 
     // TODO: this logic is very similar to the block logic; can we factor it out
     // somehow?
@@ -1465,104 +3187,134 @@ LevelState::FrameEvents LevelState::exec_frame(int64_t impulses) {
     // (6.1) check for collisions with the level edges (this will cause it to
     // stop)
     // (6.1.1) left edge
-    if (this->check_moving_collision(monster->x, monster->y, monster->x_speed,
-        monster->y_speed, -this->params.grid_pitch, monster->y)) {
-      monster->x = 0;
-      monster->x_speed = 0;
+    if (this->check_moving_collision(monster.x(), monster.y(), monster.x_speed(),
+        monster.y_speed(), -this->params->grid_pitch, monster.y())) {
+      monster.x() = 0;
+      monster.x_speed() = 0;
       collision = true;
     }
     // (6.1.2) right edge
-    if (this->check_moving_collision(monster->x, monster->y, monster->x_speed,
-        monster->y_speed, this->params.w, monster->y)) {
-      monster->x = this->params.w - this->params.grid_pitch;
-      monster->x_speed = 0;
+    if (this->check_moving_collision(monster.x(), monster.y(), monster.x_speed(),
+        monster.y_speed(), this->params->w, monster.y())) {
+      monster.x() = this->params->w - this->params->grid_pitch;
+      monster.x_speed() = 0;
       collision = true;
     }
     // (6.1.3) top edge
-    if (this->check_moving_collision(monster->x, monster->y, monster->x_speed,
-        monster->y_speed, monster->x, -this->params.grid_pitch)) {
-      monster->y = 0;
-      monster->y_speed = 0;
+    if (this->check_moving_collision(monster.x(), monster.y(), monster.x_speed(),
+        monster.y_speed(), monster.x(), -this->params->grid_pitch)) {
+      monster.y() = 0;
+      monster.y_speed() = 0;
       collision = true;
     }
     // (6.1.4) bottom edge
-    if (this->check_moving_collision(monster->x, monster->y, monster->x_speed,
-        monster->y_speed, monster->x, this->params.h)) {
-      monster->y = this->params.h - this->params.grid_pitch;
-      monster->y_speed = 0;
+    if (this->check_moving_collision(monster.x(), monster.y(), monster.x_speed(),
+        monster.y_speed(), monster.x(), this->params->h)) {
+      monster.y() = this->params->h - this->params->grid_pitch;
+      monster.y_speed() = 0;
       collision = true;
     }
 
     // (6.2) check for collisions with blocks (this will cause it to stop; we've
-    // already checked for blocks running monsters over in step 4.3)
-    for (auto& other_block : this->blocks) {
-      bool other_block_collision = this->check_moving_collision(monster->x,
-          monster->y, monster->x_speed, monster->y_speed, other_block->x,
-          other_block->y);
-      if (other_block_collision) {
-        // this monster hit the block; put this monster right next to the block,
-        // and make it slow down to the speed of the block. (we can't just make
-        // it stop because monsters can't stop on misaligned positions.) but
-        // don't let its speed increase or change signs.
-        // TODO: can this be collapsed into something simpler?
-        if (monster->x_speed) {
-          monster->x = other_block->x - sgn(monster->x_speed) * this->params.grid_pitch;
-          if (monster->x_speed < 0) { // monster moving left
-            if (other_block->x_speed < 0) { // block moving left
-              if (-other_block->x_speed < -monster->x_speed) { // block is slower
-                monster->x_speed = other_block->x_speed;
-              }
-            } else { // block moving right
-              if (other_block->x_speed < -monster->x_speed) { // block is slower
-                monster->x_speed = -other_block->x_speed;
-              }
-            }
-          } else { // monster moving right
-            if (other_block->x_speed < 0) { // block moving left
-              if (-other_block->x_speed < monster->x_speed) { // block is slower
-                monster->x_speed = -other_block->x_speed;
+    // already checked for blocks running monsters over in step 4.3). as in
+    // step 5.2, only blocks near the monster's next position are checked, in
+    // index order, and we look them up again if the monster's position or
+    // speed changes.
+    for (size_t min_index = 0;;) {
+      if ((monster.x_speed() == 0) && (monster.y_speed() == 0)) {
+        break;
+      }
+      bool along_x = (monster.x_speed() != 0);
+      int64_t next_x = monster.x() + (along_x ? monster.x_speed() : 0);
+      int64_t next_y = monster.y() + (along_x ? 0 : monster.y_speed());
+      this->find_blocks_near(next_x, next_y, min_index, candidates);
+
+      bool hit_block = false;
+      for (size_t other_index : candidates) {
+        auto other_block = this->blocks[other_index];
+        bool other_block_collision = this->check_moving_collision(monster.x(),
+            monster.y(), monster.x_speed(), monster.y_speed(), other_block.x(),
+            other_block.y());
+        if (other_block_collision) {
+          // this monster hit the block; put this monster right next to the block,
+          // and make it slow down to the speed of the block. (we can't just make
+          // it stop because monsters can't stop on misaligned positions.) but
+          // don't let its speed increase or change signs.
+          // TODO: can this be collapsed into something simpler?
+          if (monster.x_speed()) {
+            monster.x() = other_block.x() - sgn(monster.x_speed()) * this->params->grid_pitch;
+            if (monster.x_speed() < 0) { // monster moving left
+              if (other_block.x_speed() < 0) { // block moving left
+                if (-other_block.x_speed() < -monster.x_speed()) { // block is slower
+                  monster.x_speed() = other_block.x_speed();
+                }
+              } else { // block moving right
+                if (other_block.x_speed() < -monster.x_speed()) { // block is slower
+                  monster.x_speed() = -other_block.x_speed();
+                }
               }
-            } else { // block moving right
-              if (other_block->x_speed < -monster->x_speed) { // block is slower
-                monster->x_speed = other_block->x_speed;
+            } else { // monster moving right
+              if (other_block.x_speed() < 0) { // block moving left
+                if (-other_block.x_speed() < monster.x_speed()) { // block is slower
+                  monster.x_speed() = -other_block.x_speed();
+                }
+              } else { // block moving right
+                if (other_block.x_speed() < -monster.x_speed()) { // block is slower
+                  monster.x_speed() = other_block.x_speed();
+                }
               }
             }
-          }
 
-        } else {
-          monster->y = other_block->y - sgn(monster->y_speed) * this->params.grid_pitch;
-          if (monster->y_speed < 0) { // monster moving left
-            if (other_block->y_speed < 0) { // block moving left
-              if (-other_block->y_speed < -monster->y_speed) { // block is slower
-                monster->y_speed = other_block->y_speed;
-              }
-            } else { // block moving right
-              if (other_block->y_speed < -monster->y_speed) { // block is slower
-                monster->y_speed = -other_block->y_speed;
-              }
-            }
-          } else { // monster moving right
-            if (other_block->y_speed < 0) { // block moving left
-              if (-other_block->y_speed < monster->y_speed) { // block is slower
-                monster->y_speed = -other_block->y_speed;
+          } else {
+            monster.y() = other_block.y() - sgn(monster.y_speed()) * this->params->grid_pitch;
+            if (monster.y_speed() < 0) { // monster moving left
+              if (other_block.y_speed() < 0) { // block moving left
+                if (-other_block.y_speed() < -monster.y_speed()) { // block is slower
+                  monster.y_speed() = other_block.y_speed();
+                }
+              } else { // block moving right
+                if (other_block.y_speed() < -monster.y_speed()) { // block is slower
+                  monster.y_speed() = -other_block.y_speed();
+                }
               }
-            } else { // block moving right
-              if (other_block->y_speed < -monster->y_speed) { // block is slower
-                monster->y_speed = other_block->y_speed;
+            } else { // monster moving right
+              if (other_block.y_speed() < 0) { // block moving left
+                if (-other_block.y_speed() < monster.y_speed()) { // block is slower
+                  monster.y_speed() = -other_block.y_speed();
+                }
+              } else { // block moving right
+                if (other_block.y_speed() < -monster.y_speed()) { // block is slower
+                  monster.y_speed() = other_block.y_speed();
+                }
               }
             }
           }
+          collision = true;
+          hit_block = true;
+          min_index = other_index + 1;
+          break;
         }
-        collision = true;
+      }
+      if (!hit_block) {
+        break;
       }
     }
 
     // (6.3) check for collisions with other monsters (this may cause the
     // monster to stop or die)
-    bool is_player = monster->has_flags(Monster::Flag::IsPlayer);
-    shared_ptr<Monster> killer;
-    for (auto& other_monster : this->monsters) {
-      if (!other_monster->is_alive()) {
+    bool is_player = monster.has_flags(Monster::Flag::IsPlayer);
+    int64_t killer_index = -1;
+    if (any_blocking_monsters) {
+      candidates.resize(this->monsters.size());
+      for (size_t other_index = 0; other_index < candidates.size(); other_index++) {
+        candidates[other_index] = other_index;
+      }
+    } else {
+      this->find_monsters_near(monster.x(), monster.y(), 0, candidates);
+    }
+    for (size_t other_index : candidates) {
+      auto other_monster = this->monsters[other_index];
+      if (!other_monster.is_alive()) {
         continue; // dead monsters tell no tales
       }
 
@@ -1574,211 +3326,227 @@ LevelState::FrameEvents LevelState::exec_frame(int64_t impulses) {
       // if the other monster kills us, then delete this monster. but if the
       // current monster is the player and has KillsMonsters or Invincible, then
       // it can't be killed even if the other monster has KillsPlayers
-      bool other_monster_kills_monster = other_monster->has_flags(is_player ?
+      bool other_monster_kills_monster = other_monster.has_flags(is_player ?
           Monster::Flag::KillsPlayers : Monster::Flag::KillsMonsters);
-      bool monster_is_immune = is_player && monster->has_any_flags(
+      bool monster_is_immune = is_player && monster.has_any_flags(
           Monster::Flag::KillsMonsters | Monster::Flag::Invincible);
       if (other_monster_kills_monster && !monster_is_immune) {
-        if (this->check_stationary_collision(monster->x, monster->y,
-            other_monster->x, other_monster->y)) {
-          killer = other_monster;
+        if (this->check_stationary_collision(monster.x(), monster.y(),
+            other_monster.x(), other_monster.y())) {
+          killer_index = other_monster.get_index();
           break;
         }
 
       // the other monster doesn't kill us; if it blocks us, then check for
       // collisions
-      } else if (other_monster->has_flags(is_player ?
+      } else if (other_monster.has_flags(is_player ?
           Monster::Flag::BlocksPlayers : Monster::Flag::BlocksMonsters)) {
-        if (this->check_moving_collision(monster->x, monster->y,
-            monster->x_speed, monster->y_speed, other_monster->x,
-            other_monster->y)) {
-          if (monster->x_speed) {
-            monster->x = other_monster->x - sgn(monster->x_speed) * this->params.grid_pitch;
-            monster->x_speed = other_monster->x_speed;
+        if (this->check_moving_collision(monster.x(), monster.y(),
+            monster.x_speed(), monster.y_speed(), other_monster.x(),
+            other_monster.y())) {
+          if (monster.x_speed()) {
+            monster.x() = other_monster.x() - sgn(monster.x_speed()) * this->params->grid_pitch;
+            monster.x_speed() = other_monster.x_speed();
           } else {
-            monster->y = other_monster->y - sgn(monster->y_speed) * this->params.grid_pitch;
-            monster->y_speed = other_monster->y_speed;
+            monster.y() = other_monster.y() - sgn(monster.y_speed()) * this->params->grid_pitch;
+            monster.y_speed() = other_monster.y_speed();
           }
         }
         collision = true;
       }
     }
 
-    if (killer.get()) {
-      ret.events_mask |= (monster->has_flags(Monster::Flag::IsPlayer)) ?
+    if (killer_index >= 0) {
+      ret.events_mask |= (monster.has_flags(Monster::Flag::IsPlayer)) ?
           Event::PlayerKilled : Event::MonsterKilled;
-      monster->death_frame = this->frames_executed;
-      bool is_power = monster->has_flags(Monster::Flag::IsPower);
-      ret.scores.emplace_back(killer, monster, this->score_for_monster(is_power));
+      monster.death_frame() = this->frames_executed;
+      // the cell index still has this monster at its position from before
+      // steps 6.1-6.3
+      this->remove_monster_from_cells(monster.get_index(), prev_x, prev_y);
+      bool is_power = monster.has_flags(Monster::Flag::IsPower);
+      ret.scores.emplace_back(this->monsters.handle[killer_index],
+          monster.handle(), this->score_for_monster(is_power));
       continue;
     }
 
     // (6.4) if collision is true, then we've already updated the monster's
     // location, so we shouldn't move it incrementally. but don't move it if
     // it's caught in a time stop.
-    if (!collision && (time_stop_holders.empty() || time_stop_holders.count(monster))) {
+    if (!collision && !held_by_time_stop(monster.get_index())) {
       // a bug can occur if the monster is following a slow-moving block: they
       // can get stuck in a misaligned trajectory until they hit a wall. to fix
       // this, we snap the monster to an aligned location if it crosses an
       // alignment boundary.
-      int64_t x_cell = monster->x / this->params.grid_pitch;
-      int64_t y_cell = monster->y / this->params.grid_pitch;
-      monster->x += monster->x_speed;
-      monster->y += monster->y_speed;
-      if (x_cell != monster->x / this->params.grid_pitch) {
-        if (monster->x_speed > 0) {
-          monster->x = (x_cell + 1) * this->params.grid_pitch;
+      int64_t x_cell = monster.x() / this->params->grid_pitch;
+      int64_t y_cell = monster.y() / this->params->grid_pitch;
+      monster.x() += monster.x_speed();
+      monster.y() += monster.y_speed();
+      if (x_cell != monster.x() / this->params->grid_pitch) {
+        if (monster.x_speed() > 0) {
+          monster.x() = (x_cell + 1) * this->params->grid_pitch;
         } else {
-          monster->x = x_cell * this->params.grid_pitch + monster->x_speed;
+          monster.x() = x_cell * this->params->grid_pitch + monster.x_speed();
         }
       }
-      if (y_cell != monster->y / this->params.grid_pitch) {
-        if (monster->y_speed > 0) {
-          monster->y = (y_cell + 1) * this->params.grid_pitch;
+      if (y_cell != monster.y() / this->params->grid_pitch) {
+        if (monster.y_speed() > 0) {
+          monster.y() = (y_cell + 1) * this->params->grid_pitch;
         } else {
-          monster->y = y_cell * this->params.grid_pitch + monster->y_speed;
+          monster.y() = y_cell * this->params->grid_pitch + monster.y_speed();
         }
       }
     }
+
+    // keep the cell index up to date for the monsters after this one
+    this->update_monster_in_cells(monster.get_index(), prev_x, prev_y);
   }
 
+  PROFILE_PHASE(TimedBlocks);
+
   // (7) attenuate blocks
   for (auto block : this->blocks) {
-    if (block->integrity != 1.0) {
+    if (block.integrity() != 1.0) {
       continue;
     }
 
-    if (block->frames_until_action == 0) {
-      if (block->special == BlockSpecial::Timer) {
-        block->set_special(random_specials[rand() % random_specials.size()],
+    if (block.frames_until_action() == 0) {
+      if (block.special() == BlockSpecial::Timer) {
+        this->set_block_special(block.get_index(),
+            random_specials[this->rng() % random_specials.size()],
             this->frames_between_monsters);
 
-      } else if (block->special == BlockSpecial::CreatesMonsters) {
+      } else if (block.special() == BlockSpecial::CreatesMonsters) {
         // figure out where the monster can go
         // TODO: don't iterate over all blocks 4 times, sigh
-        vector<Impulse> candidate_directions;
+        Impulse candidate_directions[4];
+        size_t num_candidate_directions = 0;
         for (auto direction : all_directions) {
           auto offsets = offsets_for_direction(direction);
           // don't create a monster in the direction the block is moving (it would
           // just get smashed immediately)
-          if (((offsets.first * block->x_speed) > 0) ||
-              ((offsets.second * block->y_speed) > 0)) {
+          if (((offsets.first * block.x_speed()) > 0) ||
+              ((offsets.second * block.y_speed()) > 0)) {
             continue;
           }
-          int64_t target_x = block->x + offsets.first * this->params.grid_pitch;
-          int64_t target_y = block->y + offsets.second * this->params.grid_pitch;
+          int64_t target_x = block.x() + offsets.first * this->params->grid_pitch;
+          int64_t target_y = block.y() + offsets.second * this->params->grid_pitch;
           if (!this->is_within_bounds(target_x, target_y)) {
             continue;
           }
           if (!this->space_is_empty(target_x, target_y)) {
             continue;
           }
-          candidate_directions.emplace_back(direction);
+          candidate_directions[num_candidate_directions++] = direction;
         }
 
-        if (candidate_directions.empty()) {
+        if (num_candidate_directions == 0) {
           // kaboom
-          block->owner = this->player;
-          ret |= this->apply_explosion(block);
+          block.owner() = this->monsters.handle[this->player_index];
+          this->apply_explosion(block);
         } else {
           // create a monster
-          int64_t which = random_int(0, candidate_directions.size() - 1);
+          int64_t which = this->random_int(0, num_candidate_directions - 1);
 
           auto offsets = offsets_for_direction(candidate_directions[which]);
-          int64_t target_x = block->x + offsets.first * this->params.grid_pitch;
-          int64_t target_y = block->y + offsets.second * this->params.grid_pitch;
+          int64_t target_x = block.x() + offsets.first * this->params->grid_pitch;
+          int64_t target_y = block.y() + offsets.second * this->params->grid_pitch;
 
           bool is_power_monster = false; // TODO: should randomly choose
-          auto& monster = *this->monsters.emplace(new Monster(
-              target_x, target_y, this->flags_for_monster(is_power_monster))).first;
-          monster->movement_policy = is_power_monster ?
-              this->params.power_monster_movement_policy :
-              this->params.basic_monster_movement_policy;
-          monster->facing_direction = candidate_directions[which];
-          monster->block_destroy_rate = this->params.block_destroy_rate;
-          monster->move_speed = is_power_monster ? this->params.power_monster_move_speed : this->params.basic_monster_move_speed;
-          monster->push_speed = this->params.push_speed;
-          monster->x_speed = offsets.first * monster->move_speed;
-          monster->y_speed = offsets.second * monster->move_speed;
-          monster->integrity = 1.0;
+          auto monster = this->monsters[this->monsters.add(target_x, target_y,
+              this->flags_for_monster(is_power_monster))];
+          monster.movement_policy() = is_power_monster ?
+              this->params->power_monster_movement_policy :
+              this->params->basic_monster_movement_policy;
+          monster.facing_direction() = candidate_directions[which];
+          monster.block_destroy_rate() = this->params->block_destroy_rate;
+          monster.move_speed() = is_power_monster ? this->params->power_monster_move_speed : this->params->basic_monster_move_speed;
+          monster.push_speed() = this->params->push_speed;
+          monster.x_speed() = offsets.first * monster.move_speed();
+          monster.y_speed() = offsets.second * monster.move_speed();
+          monster.integrity() = 1.0;
+          this->add_monster_to_cells(monster.get_index());
 
           ret.events_mask |= Event::MonsterCreated;
 
-          block->frames_until_action = this->frames_between_monsters;
+          block.frames_until_action() = this->frames_between_monsters;
         }
       }
 
     } else {
-      block->frames_until_action--;
+      block.frames_until_action()--;
     }
   }
 
+  PROFILE_PHASE(Explosions);
+
   // (8) attenuate and delete explosions
-  for (auto explosion_it = this->explosions.begin(); explosion_it != this->explosions.end();) {
-    auto& explosion = *explosion_it;
-    if (explosion->integrity >= 1.0) {
-      explosion->integrity -= 0.5;
+  for (size_t explosion_index = 0; explosion_index < this->explosions.size();) {
+    auto explosion = this->explosions[explosion_index];
+    if (explosion.integrity() >= 1.0) {
+      explosion.integrity() -= 0.5;
     } else {
-      explosion->integrity -= explosion->decay_rate;
+      explosion.integrity() -= explosion.decay_rate();
     }
 
-    if (explosion->integrity <= 0.0) {
-      explosion_it = this->explosions.erase(explosion_it);
+    if (explosion.integrity() <= 0.0) {
+      this->explosions.erase(explosion_index);
     } else {
-      explosion_it++;
+      explosion_index++;
     }
   }
 
   // increment frame counter and return the event mask
   this->frames_executed++;
+  PROFILE_END_FRAME();
   return ret;
 }
 
-LevelState::FrameEvents LevelState::apply_push_impulse(shared_ptr<Block> block,
-    shared_ptr<Monster> responsible_monster, Impulse direction, int64_t speed) {
-  LevelState::FrameEvents ret;
+void LevelState::apply_push_impulse(BlockRef block,
+    int64_t responsible_monster, Impulse direction, int64_t speed) {
+  auto& ret = this->frame_events;
 
-  block->owner = responsible_monster;
+  block.owner() = (responsible_monster >= 0) ?
+      this->monsters.handle[responsible_monster] : EntityHandle();
 
   auto offsets = offsets_for_direction(direction);
-  if ((block->has_flags(Block::Flag::Pushable)) &&
-      this->space_is_empty(block->x + offsets.first * this->params.grid_pitch,
-                           block->y + offsets.second * this->params.grid_pitch)) {
-    block->x_speed = offsets.first * speed;
-    block->y_speed = offsets.second * speed;
-    block->monsters_killed_this_push = 0;
+  if ((block.has_flags(Block::Flag::Pushable)) &&
+      this->space_is_empty(block.x() + offsets.first * this->params->grid_pitch,
+                           block.y() + offsets.second * this->params->grid_pitch)) {
+    block.x_speed() = offsets.first * speed;
+    block.y_speed() = offsets.second * speed;
+    block.monsters_killed_this_push() = 0;
     ret.events_mask |= Event::BlockPushed;
 
-    if ((block->has_flags(Block::Flag::Brittle)) && (block->decay_rate == 0.0)) {
-      if (responsible_monster.get()) {
-        block->decay_rate = responsible_monster->block_destroy_rate;
+    if ((block.has_flags(Block::Flag::Brittle)) && (block.decay_rate() == 0.0)) {
+      if (responsible_monster >= 0) {
+        block.decay_rate() = this->monsters.block_destroy_rate[responsible_monster];
       } else {
-        block->decay_rate = 0.02;
+        block.decay_rate() = 0.02;
       }
       ret.events_mask |= Event::BlockDestroyed;
     }
 
-  } else if ((block->has_flags(Block::Flag::Destructible)) &&
-             (block->decay_rate == 0.0)) {
-    if (responsible_monster.get()) {
-      block->decay_rate = responsible_monster->block_destroy_rate;
+  } else if ((block.has_flags(Block::Flag::Destructible)) &&
+             (block.decay_rate() == 0.0)) {
+    if (responsible_monster >= 0) {
+      block.decay_rate() = this->monsters.block_destroy_rate[responsible_monster];
     } else {
-      block->decay_rate = 0.02;
+      block.decay_rate() = 0.02;
     }
-    switch (block->special) {
+    switch (block.special()) {
       case BlockSpecial::Indestructible:
       case BlockSpecial::IndestructibleAndImmovable:
         throw logic_error("indestructible block was destroyed");
 
       case BlockSpecial::Bomb:
       case BlockSpecial::BouncyBomb:
-        ret |= this->apply_explosion(block);
+        this->apply_explosion(block);
         break;
 
       case BlockSpecial::Points:
-        if (responsible_monster.get()) {
-          ret.scores.emplace_back(responsible_monster, nullptr,
-              this->score_for_monster(false), 0, 0, BlockSpecial::None, block->x, block->y);
+        if (responsible_monster >= 0) {
+          ret.scores.emplace_back(block.owner(), EntityHandle(),
+              this->score_for_monster(false), 0, 0, BlockSpecial::None, block.x(), block.y());
         }
       case BlockSpecial::None:
       case BlockSpecial::Timer:
@@ -1790,21 +3558,21 @@ LevelState::FrameEvents LevelState::apply_push_impulse(shared_ptr<Block> block,
         break;
 
       case BlockSpecial::ExtraLife:
-        if (responsible_monster.get()) {
-          ret.scores.emplace_back(responsible_monster, nullptr, 0, 1, 0, BlockSpecial::None, block->x, block->y);
+        if (responsible_monster >= 0) {
+          ret.scores.emplace_back(block.owner(), EntityHandle(), 0, 1, 0, BlockSpecial::None, block.x(), block.y());
         }
         ret.events_mask |= Event::LifeCollected;
         break;
 
       case BlockSpecial::SkipLevels:
-        if (responsible_monster.get()) {
-          ret.scores.emplace_back(responsible_monster, nullptr, 0, 0, 4, BlockSpecial::None, block->x, block->y);
+        if (responsible_monster >= 0) {
+          ret.scores.emplace_back(block.owner(), EntityHandle(), 0, 0, 4, BlockSpecial::None, block.x(), block.y());
         }
         ret.events_mask |= Event::BonusCollected;
         break;
 
       case BlockSpecial::Everything:
-        if (responsible_monster.get()) {
+        if (responsible_monster >= 0) {
           static const vector<BlockSpecial> specials({
               BlockSpecial::Invincibility,
               BlockSpecial::Speed,
@@ -1812,9 +3580,10 @@ LevelState::FrameEvents LevelState::apply_push_impulse(shared_ptr<Block> block,
               BlockSpecial::ThrowBombs,
               BlockSpecial::KillsMonsters});
           for (BlockSpecial special : specials) {
-            responsible_monster->add_special(special, 300);
+            this->monsters.add_special(responsible_monster, special, 300);
           }
-          ret.scores.emplace_back(responsible_monster, nullptr, 0, 0, 0, block->special, block->x, block->y);
+          VALIDATE_TOUCH_MONSTER(responsible_monster);
+          ret.scores.emplace_back(block.owner(), EntityHandle(), 0, 0, 0, block.special(), block.x(), block.y());
         }
         ret.events_mask |= Event::BonusCollected;
         break;
@@ -1824,72 +3593,74 @@ LevelState::FrameEvents LevelState::apply_push_impulse(shared_ptr<Block> block,
       case BlockSpecial::TimeStop:
       case BlockSpecial::ThrowBombs:
       case BlockSpecial::KillsMonsters:
-        if (responsible_monster.get()) {
-          responsible_monster->add_special(block->special, 300);
-          ret.scores.emplace_back(responsible_monster, nullptr, 0, 0, 0, block->special, block->x, block->y);
+        if (responsible_monster >= 0) {
+          this->monsters.add_special(responsible_monster, block.special(), 300);
+          VALIDATE_TOUCH_MONSTER(responsible_monster);
+          ret.scores.emplace_back(block.owner(), EntityHandle(), 0, 0, 0, block.special(), block.x(), block.y());
         }
       case BlockSpecial::CreatesMonsters:
         ret.events_mask |= Event::BonusCollected;
     }
   }
-
-  return ret;
 }
 
-LevelState::FrameEvents LevelState::apply_explosion(shared_ptr<Block> block) {
-  FrameEvents ret;
+void LevelState::apply_explosion(BlockRef block) {
+  auto& ret = this->frame_events;
 
-  if (block->integrity <= 0.0) {
-    return ret;
+  if (block.integrity() <= 0.0) {
+    return;
   }
 
   // hack: set the bomb block's integrity to zero so it gets deleted on the
   // next frame
-  block->integrity = 0.0;
+  block.integrity() = 0.0;
   ret.events_mask |= Event::Explosion;
 
   // make an explosion in place of the destroyed block
-  this->explosions.emplace(new struct Explosion(block->x, block->y, 0.04));
+  this->explosions.add(block.x(), block.y(), 0.04);
 
   for (auto direction : all_directions) {
     auto offsets = offsets_for_direction(direction);
-    int64_t target_x = block->x + offsets.first * this->params.grid_pitch;
-    int64_t target_y = block->y + offsets.second * this->params.grid_pitch;
+    int64_t target_x = block.x() + offsets.first * this->params->grid_pitch;
+    int64_t target_y = block.y() + offsets.second * this->params->grid_pitch;
     if (!this->is_within_bounds(target_x, target_y)) {
       continue;
     }
 
     // make an explosion for the kaboom effect
-    this->explosions.emplace(new struct Explosion(target_x, target_y, 0.05));
-
-    auto target_block = this->find_block(target_x, target_y);
-    if (target_block.get()) {
-      if (!target_block->x_speed || !target_block->y_speed) {
-        ret |= this->apply_push_impulse(target_block, block->owner, direction, block->bomb_speed);
+    this->explosions.add(target_x, target_y, 0.05);
+
+    int64_t target_block_index = this->find_block(target_x, target_y);
+    if (target_block_index >= 0) {
+      auto target_block = this->blocks[target_block_index];
+      if (!target_block.x_speed() || !target_block.y_speed()) {
+        this->apply_push_impulse(target_block,
+            this->monsters.index_for_handle(block.owner()), direction,
+            block.bomb_speed());
       }
     } else {
       // note that we don't check for monsters if there was a block, since
       // monsters and blocks can't occupy the same space
-      for (auto& monster : this->monsters) {
-        if (!monster->is_alive()) {
-          continue;
-        }
-        if (!this->check_stationary_collision(target_x, target_y, monster->x,
-            monster->y)) {
+      this->find_monsters_near(target_x, target_y, 0,
+          this->explosion_candidates);
+      for (size_t monster_index : this->explosion_candidates) {
+        auto monster = this->monsters[monster_index];
+        if (!monster.is_alive()) {
           continue;
         }
 
-        if (!monster->has_flags(Monster::Flag::Invincible)) {
-          monster->death_frame = this->frames_executed;
-          ret.events_mask |= monster->has_flags(Monster::Flag::IsPlayer)
+        if (!monster.has_flags(Monster::Flag::Invincible)) {
+          monster.death_frame() = this->frames_executed;
+          this->remove_monster_from_cells(monster_index, monster.x(),
+              monster.y());
+          ret.events_mask |= monster.has_flags(Monster::Flag::IsPlayer)
               ? Event::PlayerSquished : Event::MonsterSquished;
           // TODO: we probably should have some kind of multiplier for killing
           // lots of monsters with one bomb push
-          ret.scores.emplace_back(block->owner, monster, this->score_for_monster(false));
+          ret.scores.emplace_back(block.owner(), monster.handle(),
+              this->score_for_monster(false));
         }
       }
     }
   }
-
-  return ret;
 }
@@ -1,12 +1,20 @@
+#pragma once
+
 #include <stdint.h>
 
+#include <array>
 #include <memory>
 #include <phosg/Strings.hh>
+#include <random>
+#include <string>
 #include <unordered_map>
 #include <unordered_set>
 #include <utility>
 #include <vector>
 
+class BinaryReader;
+class BinaryWriter;
+
 
 
 enum Impulse {
@@ -59,7 +67,7 @@ enum class BlockSpecial {
   BouncyBomb,
   CreatesMonsters,
 
-  // these are also used in special_type_to_frames_remaining
+  // monsters hold these for a limited time (see Monster::timed_special_slot)
   Invincibility,
   Speed,
   TimeStop,
@@ -72,6 +80,119 @@ BlockSpecial special_for_name(const char* name);
 const char* name_for_special(BlockSpecial special);
 const char* display_name_for_special(BlockSpecial special);
 
+// monsters, blocks and explosions are stored as structures of arrays: each
+// field lives in its own contiguous array, and an entity is an index into all
+// of them. within each table, the fields that the per-frame loops in
+// exec_frame touch come first; the rest are only used when something is
+// pushed, picked up or killed. code outside the tables works with the
+// lightweight Ref classes below, which are just (table, index) pairs.
+
+// iterates over a table, producing refs to its entries
+template <typename TableT, typename RefT>
+class TableIterator {
+public:
+  TableIterator(TableT* table, size_t index) : table(table), index(index) { }
+
+  RefT operator*() const {
+    return RefT(this->table, this->index);
+  }
+  TableIterator& operator++() {
+    this->index++;
+    return *this;
+  }
+  bool operator==(const TableIterator& other) const {
+    return this->index == other.index;
+  }
+  bool operator!=(const TableIterator& other) const {
+    return this->index != other.index;
+  }
+
+private:
+  TableT* table;
+  size_t index;
+};
+
+// a stable reference to a monster or a block. an entity's index can change
+// when other entities are deleted, but its handle never does. slot is a slot in
+// the table's HandleMap, which knows the entity's current index; generation is
+// incremented whenever the slot is freed, so a handle to a deleted entity never
+// refers to whatever reuses its slot. handles are plain values, so copying or
+// saving them is free, and they're the same in a fork as in the original
+struct EntityHandle {
+  uint32_t slot;
+  uint32_t generation;
+
+  // the default handle is null; it never refers to any entity
+  EntityHandle();
+  EntityHandle(uint32_t slot, uint32_t generation);
+
+  bool is_null() const;
+  std::string str() const;
+
+  bool operator==(const EntityHandle& other) const;
+  bool operator!=(const EntityHandle& other) const;
+};
+
+// maps handles to indexes in one table. the table calls add, remove and move
+// whenever it adds, deletes or moves an entity, and index_for looks up a handle
+// in constant time
+class HandleMap {
+public:
+  HandleMap() = default;
+
+  void clear();
+  void reserve(size_t count);
+  EntityHandle add(size_t index);
+  void remove(EntityHandle handle);
+  void move(EntityHandle handle, size_t index);
+  // returns -1 if the handle is null or its entity has been deleted
+  int64_t index_for(EntityHandle handle) const;
+
+  void serialize(BinaryWriter& w) const;
+  void deserialize(BinaryReader& r);
+
+private:
+  // for each slot, the index of the entity using it (or -1 if it's free) and
+  // its current generation. free slots are reused before new ones are made
+  std::vector<int64_t> slot_indexes;
+  std::vector<uint32_t> slot_generations;
+  std::vector<uint32_t> free_slots;
+};
+
+// the level's random number generator: an mt19937_64 that also counts how
+// many numbers it has produced. libstdc++ and libc++ write an mt19937_64's
+// state in different text forms, so saving it that way isn't portable;
+// instead, LevelState saves the seed and this count, and restore skips that
+// many numbers from the seed's start (which is fast compared to executing the
+// frames that drew them)
+class LevelRNG {
+public:
+  typedef uint64_t result_type;
+
+  LevelRNG();
+
+  // starts the sequence for the given seed from the beginning
+  void seed(uint64_t seed);
+  // starts the sequence for the given seed, then skips num_draws numbers
+  void restore(uint64_t seed, uint64_t num_draws);
+  uint64_t get_num_draws() const;
+
+  static constexpr result_type min() {
+    return std::mt19937_64::min();
+  }
+  static constexpr result_type max() {
+    return std::mt19937_64::max();
+  }
+  result_type operator()() {
+    this->num_draws++;
+    return this->engine();
+  }
+
+private:
+  std::mt19937_64 engine;
+  uint64_t num_draws;
+};
+
 struct Monster {
   enum Flag {
     IsPlayer         = 0x0001, // used for checking flags when blocks run over
@@ -98,47 +219,175 @@ struct Monster {
   static MovementPolicy movement_policy_for_name(const char* name);
   static const char* name_for_movement_policy(MovementPolicy special);
 
-  int64_t death_frame;
-
-  int64_t x;
-  int64_t y;
-  int64_t x_speed;
-  int64_t y_speed;
+  // the specials that monsters can hold (Invincibility through KillsMonsters)
+  // each have a slot: a bit in the monster's special mask, and an entry in its
+  // array of frames remaining. timed_special_slot returns num_timed_specials
+  // or more for specials that monsters can't hold
+  static constexpr size_t num_timed_specials = 5;
+  static size_t timed_special_slot(BlockSpecial special) {
+    return static_cast<size_t>(special) -
+        static_cast<size_t>(BlockSpecial::Invincibility);
+  }
+  static BlockSpecial timed_special_for_slot(size_t slot) {
+    return static_cast<BlockSpecial>(
+        static_cast<size_t>(BlockSpecial::Invincibility) + slot);
+  }
+};
 
-  // these speeds need to evenly divide the level's grid_pitch or else
-  // movement and collisions won't work properly
-  int64_t move_speed;
-  int64_t push_speed;
-  float block_destroy_rate;
+template <typename TableT>
+class BasicMonsterRef {
+public:
+  BasicMonsterRef(TableT* table, size_t index) : table(table), index(index) { }
+  template <typename OtherTableT>
+  BasicMonsterRef(const BasicMonsterRef<OtherTableT>& other) :
+      table(other.table), index(other.index) { }
+
+  size_t get_index() const { return this->index; }
+
+  auto& death_frame() const { return this->table->death_frame[this->index]; }
+  auto& x() const { return this->table->x[this->index]; }
+  auto& y() const { return this->table->y[this->index]; }
+  auto& x_speed() const { return this->table->x_speed[this->index]; }
+  auto& y_speed() const { return this->table->y_speed[this->index]; }
+  auto& move_speed() const { return this->table->move_speed[this->index]; }
+  auto& push_speed() const { return this->table->push_speed[this->index]; }
+  auto& block_destroy_rate() const { return this->table->block_destroy_rate[this->index]; }
+  auto& integrity() const { return this->table->integrity[this->index]; }
+  auto& special_mask() const { return this->table->special_mask[this->index]; }
+  auto& special_frames_remaining() const { return this->table->special_frames_remaining[this->index]; }
+  auto& facing_direction() const { return this->table->facing_direction[this->index]; }
+  auto& control_impulse() const { return this->table->control_impulse[this->index]; }
+  auto& flags() const { return this->table->flags[this->index]; }
+  auto& movement_policy() const { return this->table->movement_policy[this->index]; }
+  auto& handle() const { return this->table->handle[this->index]; }
+
+  std::string str() const {
+    return this->table->str(this->index);
+  }
+
+  bool has_special(BlockSpecial special) const {
+    return this->table->has_special(this->index, special);
+  }
+  void add_special(BlockSpecial special, int64_t frames) const {
+    this->table->add_special(this->index, special, frames);
+  }
+  bool is_alive() const {
+    return this->death_frame() < 0;
+  }
+  void attenuate_and_delete_specials() const {
+    this->table->attenuate_and_delete_specials(this->index);
+  }
+  void choose_random_direction(uint8_t available_directions,
+      LevelRNG& rng) const {
+    this->table->choose_random_direction(this->index, available_directions,
+        rng);
+  }
+
+  bool has_flags(uint64_t flags) const {
+    return (this->flags() & flags) == flags;
+  }
+  bool has_any_flags(uint64_t flags) const {
+    return (this->flags() & flags) != 0;
+  }
+  void set_flags(uint64_t flags) const {
+    this->flags() |= flags;
+  }
+  void clear_flags(uint64_t flags) const {
+    this->flags() &= ~flags;
+  }
+
+  bool operator==(const BasicMonsterRef& other) const {
+    return (this->table == other.table) && (this->index == other.index);
+  }
+  bool operator!=(const BasicMonsterRef& other) const {
+    return !this->operator==(other);
+  }
 
-  float integrity; // starts at 0, increases to 1, then monster can move
+private:
+  template <typename OtherTableT> friend class BasicMonsterRef;
 
-  std::unordered_map<BlockSpecial, int64_t> special_to_frames_remaining;
+  TableT* table;
+  size_t index;
+};
 
-  Impulse facing_direction;
+struct MonsterTable;
+using MonsterRef = BasicMonsterRef<MonsterTable>;
+using ConstMonsterRef = BasicMonsterRef<const MonsterTable>;
+
+struct MonsterTable {
+  // hot fields
+  std::vector<int64_t> x;
+  std::vector<int64_t> y;
+  std::vector<int64_t> x_speed;
+  std::vector<int64_t> y_speed;
+  std::vector<int64_t> flags;
+  std::vector<int64_t> death_frame;
+  std::vector<float> integrity; // starts at 0, increases to 1, then monster can move
+  std::vector<Impulse> facing_direction;
+  // bit n is set if the monster has the special in slot n (see
+  // Monster::timed_special_slot)
+  std::vector<uint8_t> special_mask;
 
   // ths control impulse tells the Monster what to do next. not valid for the
   // player; the player's control impulse is passed into exec_frame instead.
-  int64_t control_impulse;
-
-  int64_t flags;
-  MovementPolicy movement_policy;
+  std::vector<int64_t> control_impulse;
 
-  Monster() = delete;
-  Monster(int64_t x, int64_t y, int64_t flags);
-
-  std::string str() const;
-
-  bool has_special(BlockSpecial special) const;
-  void add_special(BlockSpecial special, int64_t frames);
-  bool is_alive() const;
-  void attenuate_and_delete_specials();
-  void choose_random_direction(uint8_t available_directions);
-
-  bool has_flags(uint64_t flags) const;
-  bool has_any_flags(uint64_t flags) const;
-  void set_flags(uint64_t flags);
-  void clear_flags(uint64_t flags);
+  // cold fields
+  // these speeds need to evenly divide the level's grid_pitch or else
+  // movement and collisions won't work properly
+  std::vector<int64_t> move_speed;
+  std::vector<int64_t> push_speed;
+  std::vector<float> block_destroy_rate;
+  std::vector<Monster::MovementPolicy> movement_policy;
+  // only the slots whose bits are set in special_mask are meaningful
+  std::vector<std::array<int64_t, Monster::num_timed_specials>> special_frames_remaining;
+  std::vector<EntityHandle> handle;
+  HandleMap handles;
+
+  // how many monsters (alive or dead) have TimeStop, so exec_frame can skip
+  // looking for them when there aren't any
+  size_t time_stop_holder_count = 0;
+
+  // monsters are never deleted, so a monster's index never changes. handles
+  // are still the preferred way to refer to monsters from outside the table
+  // (e.g. in ScoreInfo and Block::owner)
+  size_t size() const;
+  void clear();
+  size_t add(int64_t x, int64_t y, int64_t flags);
+  // returns the monster's index, or -1 if the handle is null
+  int64_t index_for_handle(EntityHandle handle) const;
+
+  std::string str(size_t index) const;
+
+  bool has_special(size_t index, BlockSpecial special) const;
+  void add_special(size_t index, BlockSpecial special, int64_t frames);
+  void attenuate_and_delete_specials(size_t index);
+  void choose_random_direction(size_t index, uint8_t available_directions,
+      LevelRNG& rng);
+
+  // writes/reads every field, including the handle map. deserialize replaces
+  // the whole table
+  void serialize(BinaryWriter& w) const;
+  void deserialize(BinaryReader& r);
+
+  MonsterRef operator[](size_t index) {
+    return MonsterRef(this, index);
+  }
+  ConstMonsterRef operator[](size_t index) const {
+    return ConstMonsterRef(this, index);
+  }
+  TableIterator<MonsterTable, MonsterRef> begin() {
+    return TableIterator<MonsterTable, MonsterRef>(this, 0);
+  }
+  TableIterator<MonsterTable, MonsterRef> end() {
+    return TableIterator<MonsterTable, MonsterRef>(this, this->size());
+  }
+  TableIterator<const MonsterTable, ConstMonsterRef> begin() const {
+    return TableIterator<const MonsterTable, ConstMonsterRef>(this, 0);
+  }
+  TableIterator<const MonsterTable, ConstMonsterRef> end() const {
+    return TableIterator<const MonsterTable, ConstMonsterRef>(this, this->size());
+  }
 };
 
 struct Block {
@@ -154,51 +403,190 @@ struct Block {
   };
   static const char* name_for_flag(int64_t f);
 
-  int64_t x;
-  int64_t y;
-  int64_t x_speed;
-  int64_t y_speed;
+  static const int64_t default_flags = Flag::Pushable | Flag::Destructible |
+      Flag::KillsPlayers | Flag::KillsMonsters;
+};
 
-  // which monster pushed the block (and should get the points)
-  std::shared_ptr<Monster> owner;
-  int64_t monsters_killed_this_push;
+template <typename TableT>
+class BasicBlockRef {
+public:
+  BasicBlockRef(TableT* table, size_t index) : table(table), index(index) { }
+  template <typename OtherTableT>
+  BasicBlockRef(const BasicBlockRef<OtherTableT>& other) :
+      table(other.table), index(other.index) { }
+
+  size_t get_index() const { return this->index; }
+
+  auto& x() const { return this->table->x[this->index]; }
+  auto& y() const { return this->table->y[this->index]; }
+  auto& x_speed() const { return this->table->x_speed[this->index]; }
+  auto& y_speed() const { return this->table->y_speed[this->index]; }
+  auto& owner() const { return this->table->owner[this->index]; }
+  auto& monsters_killed_this_push() const { return this->table->monsters_killed_this_push[this->index]; }
+  auto& bounce_speed_absorption() const { return this->table->bounce_speed_absorption[this->index]; }
+  auto& bomb_speed() const { return this->table->bomb_speed[this->index]; }
+  auto& decay_rate() const { return this->table->decay_rate[this->index]; }
+  auto& integrity() const { return this->table->integrity[this->index]; }
+  auto& special() const { return this->table->special[this->index]; }
+  auto& flags() const { return this->table->flags[this->index]; }
+  auto& frames_until_action() const { return this->table->frames_until_action[this->index]; }
+  auto& handle() const { return this->table->handle[this->index]; }
+
+  std::string str() const {
+    return this->table->str(this->index);
+  }
+
+  void set_special(BlockSpecial special, int64_t timer_value) const {
+    this->table->set_special(this->index, special, timer_value);
+  }
+
+  bool has_flags(uint64_t flags) const {
+    return (this->flags() & flags) == flags;
+  }
+  bool has_any_flags(uint64_t flags) const {
+    return (this->flags() & flags) != 0;
+  }
+  void set_flags(uint64_t flags) const {
+    this->flags() |= flags;
+  }
+  void clear_flags(uint64_t flags) const {
+    this->flags() &= ~flags;
+  }
+
+  bool operator==(const BasicBlockRef& other) const {
+    return (this->table == other.table) && (this->index == other.index);
+  }
+  bool operator!=(const BasicBlockRef& other) const {
+    return !this->operator==(other);
+  }
 
-  int64_t bounce_speed_absorption;
-  int64_t bomb_speed;
+private:
+  template <typename OtherTableT> friend class BasicBlockRef;
 
-  float decay_rate; // [0, 1]
-  float integrity; // [0, 1]; when it reaches 0 the block is deleted
+  TableT* table;
+  size_t index;
+};
 
-  BlockSpecial special;
-  int64_t flags;
-  int64_t frames_until_action;
+struct BlockTable;
+using BlockRef = BasicBlockRef<BlockTable>;
+using ConstBlockRef = BasicBlockRef<const BlockTable>;
+
+struct BlockTable {
+  // hot fields
+  std::vector<int64_t> x;
+  std::vector<int64_t> y;
+  std::vector<int64_t> x_speed;
+  std::vector<int64_t> y_speed;
+  std::vector<int64_t> flags;
+  std::vector<float> integrity; // [0, 1]; when it reaches 0 the block is deleted
+  std::vector<float> decay_rate; // [0, 1]
+  std::vector<int64_t> frames_until_action;
+  std::vector<BlockSpecial> special;
+
+  // cold fields
+  // handle of the monster that pushed the block (and should get the points), or
+  // null if no monster has pushed it yet
+  std::vector<EntityHandle> owner;
+  std::vector<int64_t> monsters_killed_this_push;
+  std::vector<int64_t> bounce_speed_absorption;
+  std::vector<int64_t> bomb_speed;
+  // unlike its index, a block's handle never changes
+  std::vector<EntityHandle> handle;
+  HandleMap handles;
+
+  size_t size() const;
+  void clear();
+  void reserve(size_t count);
+  size_t add(int64_t x, int64_t y, BlockSpecial special = BlockSpecial::None,
+      int64_t flags = Block::default_flags);
+  // deletes a block by moving the last block into its place; the moved
+  // block's index changes, but no others do
+  void erase(size_t index);
+  // returns the block's index, or -1 if the handle is null or the block has
+  // been deleted
+  int64_t index_for_handle(EntityHandle handle) const;
+
+  std::string str(size_t index) const;
+
+  void set_special(size_t index, BlockSpecial special, int64_t timer_value);
+
+  void serialize(BinaryWriter& w) const;
+  void deserialize(BinaryReader& r);
+
+  BlockRef operator[](size_t index) {
+    return BlockRef(this, index);
+  }
+  ConstBlockRef operator[](size_t index) const {
+    return ConstBlockRef(this, index);
+  }
+  TableIterator<BlockTable, BlockRef> begin() {
+    return TableIterator<BlockTable, BlockRef>(this, 0);
+  }
+  TableIterator<BlockTable, BlockRef> end() {
+    return TableIterator<BlockTable, BlockRef>(this, this->size());
+  }
+  TableIterator<const BlockTable, ConstBlockRef> begin() const {
+    return TableIterator<const BlockTable, ConstBlockRef>(this, 0);
+  }
+  TableIterator<const BlockTable, ConstBlockRef> end() const {
+    return TableIterator<const BlockTable, ConstBlockRef>(this, this->size());
+  }
+};
 
-  Block() = delete;
-  Block(int64_t x, int64_t y, BlockSpecial special = BlockSpecial::None,
-      int64_t flags = Flag::Pushable | Flag::Destructible | Flag::KillsPlayers | Flag::KillsMonsters);
+template <typename TableT>
+class BasicExplosionRef {
+public:
+  BasicExplosionRef(TableT* table, size_t index) : table(table), index(index) { }
 
-  std::string str() const;
+  auto& x() const { return this->table->x[this->index]; }
+  auto& y() const { return this->table->y[this->index]; }
+  auto& decay_rate() const { return this->table->decay_rate[this->index]; }
+  auto& integrity() const { return this->table->integrity[this->index]; }
 
-  void set_special(BlockSpecial special, int64_t timer_value);
+  std::string str() const {
+    return this->table->str(this->index);
+  }
 
-  bool has_flags(uint64_t flags) const;
-  bool has_any_flags(uint64_t flags) const;
-  void set_flags(uint64_t flags);
-  void clear_flags(uint64_t flags);
+private:
+  TableT* table;
+  size_t index;
 };
 
-struct Explosion {
-  int64_t x;
-  int64_t y;
+struct ExplosionTable;
+using ExplosionRef = BasicExplosionRef<ExplosionTable>;
+using ConstExplosionRef = BasicExplosionRef<const ExplosionTable>;
 
-  float decay_rate; // [0, 1]
-  float integrity; // [0, 1]; when it reaches 0 the explosion is deleted
+struct ExplosionTable {
+  std::vector<int64_t> x;
+  std::vector<int64_t> y;
+  std::vector<float> decay_rate; // [0, 1]
+  std::vector<float> integrity; // [0, 1]; when it reaches 0 the explosion is deleted
   // note: integrity starts at 1.0, but drops to 0.5 after the first frame
 
-  Explosion() = delete;
-  Explosion(int64_t x, int64_t y, float decay_rate);
-
-  std::string str() const;
+  size_t size() const;
+  bool empty() const;
+  void clear();
+  size_t add(int64_t x, int64_t y, float decay_rate);
+  // like BlockTable::erase, this moves the last explosion into the gap
+  void erase(size_t index);
+
+  std::string str(size_t index) const;
+
+  void serialize(BinaryWriter& w) const;
+  void deserialize(BinaryReader& r);
+
+  ExplosionRef operator[](size_t index) {
+    return ExplosionRef(this, index);
+  }
+  ConstExplosionRef operator[](size_t index) const {
+    return ConstExplosionRef(this, index);
+  }
+  TableIterator<const ExplosionTable, ConstExplosionRef> begin() const {
+    return TableIterator<const ExplosionTable, ConstExplosionRef>(this, 0);
+  }
+  TableIterator<const ExplosionTable, ConstExplosionRef> end() const {
+    return TableIterator<const ExplosionTable, ConstExplosionRef>(this, this->size());
+  }
 };
 
 class LevelState {
@@ -236,19 +624,83 @@ public:
     int64_t bomb_speed;
     int64_t bounce_speed_absorption;
     float block_destroy_rate;
+
+    // the shapes that LineUp blocks have to form to get specials, in the order
+    // they're checked. each one is a mask over a 5x5 area, where bit
+    // (y * 5 + x) is set if the shape has a block at (x, y). a shape matches
+    // when a LineUp block stops in any of its cells, as long as the shape fits
+    // in the 5x5 cells centered on that block. if this is empty, the level
+    // uses the default shapes: lines of 5, 4 and 3 blocks, longer ones first,
+    // and horizontal before vertical
+    std::vector<uint32_t> lineup_formations;
+
+    // returns a hash of everything here that affects how the level is
+    // generated and how it plays (i.e. everything except the name). replays
+    // use this to check that they're being played on the same level that they
+    // were recorded on
+    uint64_t hash() const;
   };
 
+  // all randomness in the level (monster and special placement, Timer and
+  // LineUp specials, monster movement) comes from an RNG owned by the level
+  // and seeded with the given seed, so the same parameters, seed and inputs
+  // always produce the same game
   LevelState() = delete;
-  LevelState(const GenerationParameters& params);
-
-  // checks that the level will behave properly when exec_frame is called
+  LevelState(const GenerationParameters& params, uint64_t seed);
+  // like the above, but shares the parameters instead of copying them
+  LevelState(std::shared_ptr<const GenerationParameters> params,
+      uint64_t seed);
+
+  // replaces the level with a new one, exactly as if it had been constructed
+  // with these arguments, but reuses the level's memory. when the new level
+  // isn't bigger than the old one, this doesn't allocate at all, so use it
+  // instead of constructing a new level when starting many attempts in a row
+  void reset(std::shared_ptr<const GenerationParameters> params,
+      uint64_t seed);
+
+  // returns an independent copy of the level, including the state of its RNG,
+  // so the copy behaves exactly like the original given the same inputs.
+  // everything except the generation parameters (which are shared) lives in a
+  // few dozen flat arrays, so this costs one allocation per array and no
+  // per-entity work. assigning one LevelState to another (a = b) does the same
+  // thing but reuses a's memory, so it doesn't allocate at all if a is at
+  // least as big as b; use that when forking repeatedly from the same state
+  LevelState fork() const;
+
+  // saves the level's state (everything that can change after it's created,
+  // including the RNG) as a string, and restores a state saved from the same
+  // level. a restored level behaves exactly like the one that was saved, from
+  // the frame it was saved on. the generation parameters aren't included, so
+  // the state can only be restored into a level created with the same
+  // parameters (not necessarily the same seed); restore_state throws
+  // invalid_argument if they're different, and runtime_error if the data is
+  // corrupt, in which case the level's state is undefined. the grid and
+  // bitboards are saved as they are rather than being rebuilt, so a saved
+  // state is a few tens of KB for a typical level. the format is the same on
+  // every platform, so a state saved on one can be restored on another
+  std::string serialize_state() const;
+  void restore_state(const std::string& data);
+
+  // checks that the level will behave properly when exec_frame is called.
+  // this looks at every block and monster, so call it once when the level is
+  // loaded, not on every frame
   void validate() const;
 
-  const std::shared_ptr<Monster> get_player() const;
-  const std::unordered_set<std::shared_ptr<Monster>>& get_monsters() const;
-  const std::unordered_set<std::shared_ptr<Block>>& get_blocks() const;
-  const std::unordered_set<std::shared_ptr<struct Explosion>>& get_explosions() const;
+  // does the same checks as validate, but only for the blocks and monsters
+  // that moved, appeared or got a special during the last call to exec_frame,
+  // and also checks that they're where the occupancy grid and the monster
+  // cell index say they are. the engine only keeps track of which entities it
+  // touched when it's built with TREADS_VALIDATE defined (make VALIDATE=1);
+  // otherwise this does nothing, so it costs nothing to call it after every
+  // frame
+  void validate_frame() const;
+
+  ConstMonsterRef get_player() const;
+  const MonsterTable& get_monsters() const;
+  const BlockTable& get_blocks() const;
+  const ExplosionTable& get_explosions() const;
   const GenerationParameters& get_params() const;
+  uint64_t get_seed() const;
 
   float get_updates_per_second() const;
   int64_t get_frames_executed() const;
@@ -257,7 +709,45 @@ public:
   int64_t count_monsters_with_flags(uint64_t flags, uint64_t mask) const;
   int64_t count_blocks_with_special(BlockSpecial special) const;
 
-  Impulse find_path(int64_t x, int64_t y, int64_t target_x, int64_t target_y) const;
+  // returns true if the level has been cleared: all the monsters are dead and
+  // there are no blocks left that could create more. this doesn't check if
+  // the player is alive
+  bool is_complete() const;
+
+  // returns the direction of the first step along a shortest path from (x, y)
+  // to (target_x, target_y), going around blocks, or None if there's no path.
+  // both positions must be aligned to the grid. if max_expansions isn't 0,
+  // the search gives up after expanding that many cells and heads toward the
+  // closest cell to the target it found. if num_expansions isn't NULL, it's
+  // set to the number of cells that were expanded
+  Impulse find_path(int64_t x, int64_t y, int64_t target_x, int64_t target_y,
+      size_t max_expansions = 0, size_t* num_expansions = NULL) const;
+
+  // packed bitsets ("bitboards") describing where the blocks are, for hashing
+  // states and exporting observations. each plane has one bit per grid cell:
+  // rows start on word boundaries and take get_bitboard_words_per_row() words
+  // each, and cell (x, y) is bit (x % 64) of word (y * words_per_row + x / 64).
+  // bits past the end of a row are always zero. Occupied has a bit set for
+  // every cell that any part of a block covers (so the cell isn't empty, in the
+  // sense of space_is_empty). the other planes only describe blocks that are
+  // exactly aligned to a cell, and say whether that block has a flag or a
+  // special. there's one plane per BlockSpecial, starting at FirstSpecial
+  enum BitboardPlane {
+    Occupied = 0,
+    Pushable,
+    Destructible,
+    FirstSpecial,
+  };
+  static const size_t num_bitboard_planes = BitboardPlane::FirstSpecial +
+      static_cast<size_t>(BlockSpecial::Everything) + 1;
+  static size_t bitboard_plane_for_special(BlockSpecial special);
+
+  size_t get_bitboard_words_per_row() const;
+  const uint64_t* get_bitboard(size_t plane) const;
+  // hashes all the bitboard planes together. two states with the same hash
+  // almost certainly have the same blocks in the same places (but possibly
+  // with different speeds, timers, etc., and with different monsters)
+  uint64_t hash_bitboards() const;
 
   // executes a single update to the level state
   struct FrameEvents {
@@ -269,12 +759,14 @@ public:
       BlockSpecial bonus;
       int64_t block_x;
       int64_t block_y;
-      std::shared_ptr<Monster> monster;
-      std::shared_ptr<Monster> killed; // may be NULL (if score came from a bonus)
-
-      ScoreInfo(std::shared_ptr<Monster> monster,
-          std::shared_ptr<Monster> killed = NULL, int64_t score = 0,
-          int64_t lives = 0, int64_t skip_levels = 0,
+      // these are monster handles (see get_monsters().index_for_handle).
+      // monster is null if nobody pushed the block responsible, and killed is
+      // null if the score came from a bonus
+      EntityHandle monster;
+      EntityHandle killed;
+
+      ScoreInfo(EntityHandle monster, EntityHandle killed = EntityHandle(),
+          int64_t score = 0, int64_t lives = 0, int64_t skip_levels = 0,
           BlockSpecial bonus = BlockSpecial::None, int64_t block_x = 0,
           int64_t block_y = 0);
 
@@ -283,25 +775,206 @@ public:
     std::vector<ScoreInfo> scores;
 
     FrameEvents();
-    FrameEvents& operator|=(const FrameEvents& other);
   };
-  FrameEvents exec_frame(int64_t player_control_impulse);
+  // the returned events belong to the LevelState, and are only valid until the
+  // next call to exec_frame. they're kept in the same buffer every frame, so
+  // reporting them doesn't allocate memory once the buffer is big enough
+  const FrameEvents& exec_frame(int64_t player_control_impulse);
 
   double current_score_proportion() const;
 
 private:
-  GenerationParameters params;
+  // micro_benchmark.cc times some of the private primitives below (collision
+  // checks, block lookups, explosions) directly
+  friend struct LevelStateMicroBenchmark;
+
+  // the parameters never change after the level is created, so forks share
+  // them instead of copying them
+  std::shared_ptr<const GenerationParameters> params;
+
+  uint64_t seed;
+  LevelRNG rng;
+
+  // returns a random integer in [low, high], inclusive
+  int64_t random_int(int64_t low, int64_t high);
+  int64_t random_int(const std::pair<int64_t, int64_t>& bounds);
 
-  std::shared_ptr<Monster> player;
-  std::unordered_set<std::shared_ptr<Monster>> monsters;
-  std::unordered_set<std::shared_ptr<Block>> blocks;
-  std::unordered_set<std::shared_ptr<struct Explosion>> explosions;
+  // sets up a new level from params and seed; the constructors and reset
+  // call this. everything is overwritten, but vectors keep their memory
+  void initialize();
+
+  int64_t player_index;
+  MonsterTable monsters;
+  BlockTable blocks;
+  ExplosionTable explosions;
 
   float updates_per_second;
   int64_t frames_executed;
 
   int64_t frames_between_monsters;
 
+  // scratch space for exec_frame, kept here so that its memory is reused from
+  // one frame to the next. time_stop_holders is the list of monsters that had
+  // TimeStop at the beginning of the frame; candidate_indexes is used for
+  // results from find_blocks_near and find_monsters_near. exec_frame iterates
+  // over candidate_indexes directly, so nothing called from inside those loops
+  // may refill it. apply_explosion (which apply_push_impulse can call) has its
+  // own explosion_candidates so that it can be called from anywhere in
+  // exec_frame; its monster loop must not cause another explosion
+  std::vector<size_t> time_stop_holders;
+  std::vector<size_t> candidate_indexes;
+  std::vector<size_t> explosion_candidates;
+
+  // the entities that exec_frame touched on the current (or last) frame, for
+  // validate_frame. these are only filled in when the engine is built with
+  // TREADS_VALIDATE. blocks are listed by handle, since their indexes change
+  // when other blocks are deleted; entities may be listed more than once
+  std::vector<EntityHandle> touched_blocks;
+  std::vector<size_t> touched_monsters;
+
+  // the checks that validate and validate_frame do for each entity.
+  // validate_block only checks for overlaps with blocks whose indexes are at
+  // least min_other_index, so validate can check each pair only once
+  void validate_block(size_t block_index, size_t min_other_index,
+      std::vector<size_t>& candidates) const;
+  void validate_monster(size_t monster_index) const;
+
+  // events from the current (or last) call to exec_frame. it's cleared at the
+  // beginning of each frame, and exec_frame and the functions it calls add
+  // their events to it directly
+  FrameEvents frame_events;
+
+  // scratch space for find_path and the player distance field. for find_path,
+  // there's one node per grid cell and a binary heap of cells to expand. a
+  // node only counts if its generation matches the current one, so each call
+  // starts with a new generation instead of clearing the nodes.
+  // player_distances holds, for each cell, the number of steps to the nearest
+  // live player (-1 if no player can be reached from there, -2 if the cell is
+  // blocked). it's brought up to date at most once per frame
+  // (player_distances_frame says which one), and only if some SeekPlayer
+  // monster needs it. it stays valid between frames: player_distance_sources
+  // is the list of cells the players were in when it was computed, and
+  // dirty_cells lists the cells whose blocked status may have changed since
+  // then. none of this is part of the level's state, so copying a LevelState
+  // doesn't copy it; the copy makes its own the first time it needs it
+  struct PathfindingScratch {
+    struct Node {
+      uint32_t generation;
+      int32_t cost;
+      Impulse first_direction;
+      bool closed;
+    };
+    struct HeapEntry {
+      int32_t estimated_cost;
+      int32_t cost;
+      int32_t cell;
+
+      bool operator<(const HeapEntry& other) const;
+    };
+    std::vector<Node> nodes;
+    std::vector<HeapEntry> heap;
+    uint32_t generation;
+
+    std::vector<int32_t> player_distances;
+    std::vector<int32_t> player_distance_sources;
+    std::vector<int32_t> dirty_cells;
+    std::vector<int32_t> queue;
+    std::vector<std::pair<int32_t, int32_t>> distance_heap;
+    int64_t player_distances_frame;
+    bool player_distances_valid;
+
+    PathfindingScratch();
+    PathfindingScratch(const PathfindingScratch&);
+    PathfindingScratch& operator=(const PathfindingScratch&);
+  };
+  mutable PathfindingScratch path_scratch;
+
+  // returns the index of the cell next to the given cell in the given
+  // direction, or -1 if that's outside the level
+  int32_t neighbor_cell(int32_t cell, Impulse direction) const;
+  bool cell_is_empty(int32_t cell) const;
+  // records that a block appeared at or disappeared from (x, y), so the cells
+  // it covers may have become empty or blocked
+  void mark_cells_dirty(int64_t x, int64_t y);
+  // brings player_distances up to date for the current frame if it hasn't been
+  // done yet. if only blocks have changed since the last update,
+  // repair_player_distances fixes just the affected part of the field
+  void update_player_distances();
+  void repair_player_distances();
+  // returns the direction that gets a monster at (x, y) (which must be
+  // aligned) closer to the nearest live player, or None if it can't get any
+  // closer
+  Impulse direction_toward_nearest_player(int64_t x, int64_t y);
+
+  // occupancy grid for blocks. each cell holds the index of the block whose
+  // top-left corner is in that cell, or -1; since blocks can't overlap, there's
+  // normally at most one block per cell. if a second block ends up in an
+  // occupied cell anyway, it goes in overflow_blocks (along with its cell
+  // index) instead
+  int64_t w_cells;
+  int64_t h_cells;
+  std::vector<int64_t> block_grid;
+  std::vector<std::pair<int64_t, int64_t>> overflow_blocks;
+
+  // returns the grid index of the cell containing the given position, clamped
+  // to the level boundaries
+  int64_t grid_index_for_position(int64_t x, int64_t y) const;
+  // adds/removes a block to/from the occupancy grid. remove_block_from_grid
+  // takes the position the block had when it was added
+  void add_block_to_grid(size_t block_index);
+  void remove_block_from_grid(size_t block_index, int64_t x, int64_t y);
+  // updates the grid after a block moved from (prev_x, prev_y)
+  void update_block_in_grid(size_t block_index, int64_t prev_x, int64_t prev_y);
+  // deletes a block from the block table and the grid
+  void delete_block(size_t block_index);
+
+  // bitboards (see get_bitboard), all planes back to back in one vector. the
+  // grid functions above keep them up to date. block_cover_counts has the
+  // number of blocks covering each cell; the Occupied plane is the cells where
+  // it isn't zero
+  size_t bitboard_words_per_row;
+  std::vector<uint64_t> bitboards;
+  std::vector<uint16_t> block_cover_counts;
+
+  bool bitboard_bit(size_t plane, int64_t x_cell, int64_t y_cell) const;
+  void set_bitboard_bit(size_t plane, int64_t x_cell, int64_t y_cell,
+      bool value);
+  // returns count (at most 64) consecutive bits from a row or column of a
+  // plane, starting at (x_cell, y_cell). the cells don't have to be within the
+  // level; bits for cells outside it are zero
+  uint64_t bitboard_row_bits(size_t plane, int64_t x_cell, int64_t y_cell,
+      size_t count) const;
+  uint64_t bitboard_column_bits(size_t plane, int64_t x_cell, int64_t y_cell,
+      size_t count) const;
+
+  // the placements of the level's LineUp formations, computed when the level
+  // is created. they never change, so forks share them
+  std::shared_ptr<const std::vector<uint32_t>> lineup_placements;
+  // returns the first placement of a LineUp formation that the blocks around
+  // the LineUp block at (x_cell, y_cell) match, or 0 if none do. bit
+  // (y * 5 + x) of the result is the cell at (x_cell + x - 2, y_cell + y - 2)
+  uint32_t match_lineup_formation(int64_t x_cell, int64_t y_cell) const;
+  // computes the range of cells that a block at z covers in one dimension.
+  // unlike cell_range_for_position, this isn't clamped; it returns false if
+  // none of the cells are within the level, and otherwise clips the range
+  bool covered_cell_range(int64_t z, int64_t num_cells, int64_t* min_cell,
+      int64_t* max_cell) const;
+  // adds delta to the cover counts of all the cells that a block at (x, y)
+  // covers, and updates the Occupied plane to match
+  void add_block_cover(int64_t x, int64_t y, int64_t delta);
+  // if (x, y) is aligned, recomputes the flag and special planes for that cell
+  // from whichever block (if any) is exactly there
+  void update_block_planes(int64_t x, int64_t y);
+  // changes a block's special (like BlockTable::set_special), and updates the
+  // bitboards to match
+  void set_block_special(size_t block_index, BlockSpecial special,
+      int64_t timer_value);
+  // returns the directions in which a block-sized object at (x, y) could move
+  // one full cell without hitting a block or leaving the level. this is the
+  // same as calling space_is_empty four times, but much faster if (x, y) is
+  // aligned
+  uint8_t empty_directions(int64_t x, int64_t y) const;
+
   int64_t score_for_monster(bool is_power_monster, int64_t mult = 1) const;
   uint64_t flags_for_monster(bool is_power_monster) const;
 
@@ -313,12 +986,40 @@ private:
   bool is_within_bounds(int64_t x, int64_t y) const;
 
   // finds the block at the given exact position
-  std::shared_ptr<Block> find_block(int64_t x, int64_t y);
+  // returns -1 if there's no block there
+  int64_t find_block(int64_t x, int64_t y) const;
 
   // checks if an entire block can fit at the given position without colliding
   // with another block. note that this does not check for monsters or players!
   bool space_is_empty(int64_t x, int64_t y) const;
 
+  // finds all blocks whose top-left corners are less than a grid pitch away
+  // from (x, y) in both dimensions, and whose indexes are at least min_index.
+  // the result is sorted by index. these are the only blocks that an object
+  // whose next position is (x, y) can collide with.
+  void find_blocks_near(int64_t x, int64_t y, size_t min_index,
+      std::vector<size_t>& ret) const;
+
+  // live monsters, indexed by grid cell. a monster is listed in every cell
+  // that it overlaps (up to four if it's misaligned in both dimensions).
+  // monsters are added when they're created, moved in step 6 of exec_frame,
+  // and removed when they die. each cell has a few slots in monster_cells
+  // (unused slots are -1); if they're all full, the monster goes in
+  // overflow_monsters (along with the cell index) instead. keeping this flat
+  // means copying a LevelState doesn't have to allocate a list for every cell
+  std::vector<int64_t> monster_cells;
+  std::vector<std::pair<int64_t, int64_t>> overflow_monsters;
+  // computes the range of cells that an object at z overlaps in one dimension
+  void cell_range_for_position(int64_t z, int64_t num_cells, int64_t* min_cell,
+      int64_t* max_cell) const;
+  void add_monster_to_cells(size_t monster_index);
+  void remove_monster_from_cells(size_t monster_index, int64_t x, int64_t y);
+  void update_monster_in_cells(size_t monster_index, int64_t prev_x,
+      int64_t prev_y);
+  // like find_blocks_near, but for live monsters
+  void find_monsters_near(int64_t x, int64_t y, size_t min_index,
+      std::vector<size_t>& ret) const;
+
   // checks if the given object collides with the other object
   bool check_stationary_collision(int64_t this_x, int64_t this_y,
       int64_t other_x, int64_t other_y) const;
@@ -327,9 +1028,10 @@ private:
       int64_t other_y) const;
 
   // pushes or destroys a block
-  FrameEvents apply_push_impulse(std::shared_ptr<Block> block,
-      std::shared_ptr<Monster> responsible_monster, Impulse direction,
-      int64_t speed);
+  // (responsible_monster is a monster index, or -1 if there isn't one)
+  // these add their events to frame_events
+  void apply_push_impulse(BlockRef block, int64_t responsible_monster,
+      Impulse direction, int64_t speed);
   // kaboom
-  FrameEvents apply_explosion(std::shared_ptr<Block> block);
+  void apply_explosion(BlockRef block);
 };
@@ -0,0 +1,326 @@
+#include "level_batch.hh"
+
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "level.hh"
+#include "level_loader.hh"
+
+using namespace std;
+
+
+// how many times a thread checks for new work (or for the other threads to
+// finish) before going to sleep. most callers call step in a tight loop, so
+// the next step usually arrives before this runs out, and waking up a
+// sleeping thread takes longer than a frame does
+static const size_t max_spins = 2000;
+
+// this is the finalizer from splitmix64; it turns similar inputs (like
+// consecutive environment indexes) into unrelated outputs
+static uint64_t mix64(uint64_t x) {
+  x += 0x9E3779B97F4A7C15ULL;
+  x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+  return x ^ (x >> 31);
+}
+
+
+
+const int64_t LevelBatch::initial_player_lives;
+
+LevelBatch::LevelBatch(const vector<LevelState::GenerationParameters>& levels,
+    size_t num_environments, uint64_t seed, size_t start_level_index,
+    size_t num_threads, int64_t max_episode_frames) : levels(levels),
+    seed(seed), max_episode_frames(max_episode_frames),
+    level_indexes(num_environments, start_level_index),
+    attempt_counts(num_environments, 0),
+    episode_skip_levels(num_environments, 0),
+    player_lives(num_environments, initial_player_lives),
+    player_scores(num_environments, 0),
+    events_masks(num_environments, 0), scores(num_environments, 0),
+    lives(num_environments, 0), skip_levels(num_environments, 0),
+    episode_results(num_environments, EpisodeResult::Playing),
+    episode_frames(num_environments, 0), step_generation(0),
+    threads_remaining(0), should_exit(false), step_impulses(NULL) {
+
+  if (num_environments == 0) {
+    throw invalid_argument("batch must contain at least one environment");
+  }
+  if (start_level_index >= this->levels.size()) {
+    throw invalid_argument("start level index is out of range");
+  }
+
+  this->environments.reserve(num_environments);
+  for (size_t x = 0; x < num_environments; x++) {
+    uint64_t level_seed;
+    auto params = this->next_attempt_params(x, &level_seed);
+    this->environments.emplace_back(move(params), level_seed);
+  }
+
+  // there's no point in having more threads than environments
+  if (num_threads == 0) {
+    num_threads = thread::hardware_concurrency();
+  }
+  if (num_threads == 0) {
+    num_threads = 1;
+  }
+  if (num_threads > num_environments) {
+    num_threads = num_environments;
+  }
+  this->num_threads = num_threads;
+
+  // the calling thread is thread 0, so we only need to start the others
+  for (size_t x = 1; x < num_threads; x++) {
+    this->threads.emplace_back(&LevelBatch::worker_thread_routine, this, x);
+  }
+}
+
+LevelBatch::~LevelBatch() {
+  {
+    lock_guard<mutex> g(this->lock);
+    this->should_exit = true;
+  }
+  this->step_started.notify_all();
+  for (auto& t : this->threads) {
+    t.join();
+  }
+}
+
+size_t LevelBatch::size() const {
+  return this->environments.size();
+}
+
+size_t LevelBatch::get_num_threads() const {
+  return this->num_threads;
+}
+
+void LevelBatch::step(const uint64_t* impulses) {
+  this->step_impulses = impulses;
+
+  if (this->threads.empty()) {
+    this->step_range(0, this->environments.size());
+    return;
+  }
+
+  {
+    lock_guard<mutex> g(this->lock);
+    this->threads_remaining = this->threads.size();
+    this->step_generation++;
+  }
+  this->step_started.notify_all();
+
+  // do our share of the work, then wait for everyone else to finish theirs.
+  // if step_range throws, we still have to wait for the other threads, since
+  // they're using the impulses array
+  exception_ptr exc;
+  try {
+    this->step_range(0, this->range_begin(1));
+  } catch (...) {
+    exc = current_exception();
+  }
+
+  for (size_t spins = 0; (spins < max_spins) && this->threads_remaining; spins++) {
+    this_thread::yield();
+  }
+  {
+    unique_lock<mutex> g(this->lock);
+    this->step_finished.wait(g, [&]() {
+      return this->threads_remaining == 0;
+    });
+    if (!exc) {
+      exc = this->worker_exception;
+    }
+    this->worker_exception = nullptr;
+  }
+
+  if (exc) {
+    rethrow_exception(exc);
+  }
+}
+
+const LevelState& LevelBatch::get_level(size_t index) const {
+  return this->environments.at(index);
+}
+
+size_t LevelBatch::get_level_index(size_t index) const {
+  return this->level_indexes.at(index);
+}
+
+int64_t LevelBatch::get_player_lives(size_t index) const {
+  return this->player_lives.at(index);
+}
+
+int64_t LevelBatch::get_player_score(size_t index) const {
+  return this->player_scores.at(index);
+}
+
+const int64_t* LevelBatch::get_events_masks() const {
+  return this->events_masks.data();
+}
+
+const int64_t* LevelBatch::get_scores() const {
+  return this->scores.data();
+}
+
+const int64_t* LevelBatch::get_lives() const {
+  return this->lives.data();
+}
+
+const int64_t* LevelBatch::get_skip_levels() const {
+  return this->skip_levels.data();
+}
+
+const uint8_t* LevelBatch::get_episode_results() const {
+  return this->episode_results.data();
+}
+
+const int64_t* LevelBatch::get_episode_frames() const {
+  return this->episode_frames.data();
+}
+
+shared_ptr<const LevelState::GenerationParameters>
+LevelBatch::next_attempt_params(size_t index, uint64_t* level_seed) {
+  uint64_t attempt_seed = mix64(mix64(mix64(this->seed) + index) +
+      this->attempt_counts[index]++);
+
+  auto params = make_shared<LevelState::GenerationParameters>(
+      this->levels[this->level_indexes[index]]);
+  generate_random_elements(*params, mix64(attempt_seed));
+  *level_seed = mix64(attempt_seed + 1);
+  return params;
+}
+
+void LevelBatch::step_range(size_t begin, size_t end) {
+  for (size_t x = begin; x < end; x++) {
+    auto& game = this->environments[x];
+    const auto& events = game.exec_frame(this->step_impulses[x]);
+
+    // this is the same accounting that main.cc does: only points earned by the
+    // player count
+    int64_t score = 0, lives = 0, skip_levels = 0;
+    const auto& monsters = game.get_monsters();
+    for (const auto& score_info : events.scores) {
+      int64_t monster_index = monsters.index_for_handle(score_info.monster);
+      if ((monster_index >= 0) &&
+          monsters[monster_index].has_flags(Monster::Flag::IsPlayer)) {
+        score += score_info.score;
+        lives += score_info.lives;
+        skip_levels += score_info.skip_levels;
+      }
+    }
+    this->events_masks[x] = events.events_mask;
+    this->scores[x] = score;
+    this->lives[x] = lives;
+    this->skip_levels[x] = skip_levels;
+    this->episode_frames[x] = game.get_frames_executed();
+    this->episode_skip_levels[x] += skip_levels;
+    this->player_scores[x] += score;
+    this->player_lives[x] += lives;
+
+    // the game lets the player move on if the level is complete even if they
+    // died in the process, as long as they have a life to spare, so check for
+    // that first. unlike the game, we end the episode as soon as the player
+    // dies, instead of waiting for them to press a key (during which the level
+    // could still be completed)
+    bool player_dead = (game.get_player().death_frame() >= 0);
+    bool on_first_level = (this->level_indexes[x] == 0);
+    uint8_t result = EpisodeResult::Playing;
+    if (game.is_complete() && (!player_dead || (this->player_lives[x] >= 1))) {
+      result = EpisodeResult::Cleared;
+      if (player_dead && !on_first_level) {
+        this->player_lives[x]--;
+      }
+      this->level_indexes[x] += 1 + this->episode_skip_levels[x];
+      if (this->level_indexes[x] >= this->levels.size()) {
+        this->level_indexes[x] = 0;
+      }
+
+    } else if (player_dead) {
+      if (on_first_level) {
+        // there are unlimited lives on level 0, but the score doesn't carry
+        // over to the next attempt
+        result = EpisodeResult::Died;
+        this->player_lives[x] = initial_player_lives;
+        this->player_scores[x] = 0;
+      } else if (this->player_lives[x] == 0) {
+        result = EpisodeResult::GameOver;
+        this->level_indexes[x] = 0;
+        this->player_lives[x] = initial_player_lives;
+        this->player_scores[x] = 0;
+      } else {
+        result = EpisodeResult::Died;
+        this->player_lives[x]--;
+      }
+
+    } else if ((this->max_episode_frames > 0) &&
+        (this->episode_frames[x] >= this->max_episode_frames)) {
+      result = EpisodeResult::TimedOut;
+    }
+    this->episode_results[x] = result;
+
+    if (result != EpisodeResult::Playing) {
+      this->episode_skip_levels[x] = 0;
+
+      // reset the level in place rather than constructing a new one, so
+      // starting a new episode doesn't allocate memory for the level's tables
+      uint64_t level_seed;
+      auto params = this->next_attempt_params(x, &level_seed);
+      game.reset(move(params), level_seed);
+    }
+  }
+}
+
+void LevelBatch::worker_thread_routine(size_t thread_index) {
+  size_t begin = this->range_begin(thread_index);
+  size_t end = this->range_begin(thread_index + 1);
+
+  uint64_t last_generation = 0;
+  for (;;) {
+    for (size_t spins = 0; (spins < max_spins) &&
+        (this->step_generation == last_generation) && !this->should_exit;
+        spins++) {
+      this_thread::yield();
+    }
+    {
+      unique_lock<mutex> g(this->lock);
+      this->step_started.wait(g, [&]() {
+        return this->should_exit || (this->step_generation != last_generation);
+      });
+      if (this->should_exit) {
+        return;
+      }
+      last_generation = this->step_generation;
+    }
+
+    exception_ptr exc;
+    try {
+      this->step_range(begin, end);
+    } catch (...) {
+      exc = current_exception();
+    }
+
+    bool notify;
+    {
+      lock_guard<mutex> g(this->lock);
+      if (exc && !this->worker_exception) {
+        this->worker_exception = exc;
+      }
+      notify = (--this->threads_remaining == 0);
+    }
+    if (notify) {
+      this->step_finished.notify_one();
+    }
+  }
+}
+
+size_t LevelBatch::range_begin(size_t thread_index) const {
+  return (thread_index * this->environments.size()) / this->num_threads;
+}
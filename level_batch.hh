@@ -0,0 +1,132 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "level.hh"
+
+// runs many independent levels ("environments") side by side, stepping all of
+// them by one frame at a time across a pool of threads. when an environment's
+// episode ends, it's immediately replaced with a new attempt, following the
+// same rules as the game in main.cc. each environment has its own player, who
+// starts with initial_player_lives lives and earns score and lives as in the
+// game. clearing a level moves on to the next one (plus any skipped levels),
+// even if the player died, as long as they had a life to spare; dying costs a
+// life and restarts the same level with a new layout; and dying with no lives
+// left is game over, which goes back to level 0 with a new player. level 0
+// has unlimited lives, but dying there resets the player's score. running out
+// of time (which the game doesn't have) restarts the same level without
+// costing a life.
+//
+// every environment gets its own sequence of seeds derived from the batch's
+// seed and its index, so the results don't depend on how many threads there
+// are or how the work is split between them.
+class LevelBatch {
+public:
+  enum EpisodeResult {
+    Playing = 0, // the episode isn't over yet
+    Cleared,     // all the monsters are dead (the player may have died too,
+                 // but only if they had a life to spare)
+    Died,        // the player died, and is trying the same level again
+    TimedOut,    // the episode reached max_episode_frames
+    GameOver,    // the player died with no lives left; back to level 0
+  };
+
+  // the number of lives a new player gets, as in main.cc
+  static const int64_t initial_player_lives = 3;
+
+  // levels is the list of levels that environments progress through (usually
+  // from load_generation_params). every environment starts at
+  // start_level_index. num_threads includes the calling thread; 0 means use
+  // one thread per core. max_episode_frames is 0 for no limit.
+  LevelBatch(const std::vector<LevelState::GenerationParameters>& levels,
+      size_t num_environments, uint64_t seed, size_t start_level_index = 0,
+      size_t num_threads = 0, int64_t max_episode_frames = 0);
+  LevelBatch(const LevelBatch&) = delete;
+  LevelBatch(LevelBatch&&) = delete;
+  LevelBatch& operator=(const LevelBatch&) = delete;
+  LevelBatch& operator=(LevelBatch&&) = delete;
+  ~LevelBatch();
+
+  size_t size() const;
+  size_t get_num_threads() const;
+
+  // executes one frame in every environment. impulses must have one entry per
+  // environment. when this returns, the result arrays below describe the frame
+  // that was just executed, but any environment whose episode ended has
+  // already been reset, so get_level returns the new attempt
+  void step(const uint64_t* impulses);
+
+  const LevelState& get_level(size_t index) const;
+  size_t get_level_index(size_t index) const;
+  // the environment's player's remaining lives and total score, after the last
+  // step's episode (if it ended) was accounted for
+  int64_t get_player_lives(size_t index) const;
+  int64_t get_player_score(size_t index) const;
+
+  // results of the last step, one entry per environment. score, lives and
+  // skip_levels are what the player earned during that frame (as in main.cc,
+  // points earned by other monsters don't count); episode_frames is the
+  // number of frames the episode had run, including that one
+  const int64_t* get_events_masks() const;
+  const int64_t* get_scores() const;
+  const int64_t* get_lives() const;
+  const int64_t* get_skip_levels() const;
+  const uint8_t* get_episode_results() const;
+  const int64_t* get_episode_frames() const;
+
+private:
+  std::vector<LevelState::GenerationParameters> levels;
+  uint64_t seed;
+  int64_t max_episode_frames;
+  size_t num_threads;
+
+  // per-environment state. seeds for each attempt are derived from the batch
+  // seed, the environment's index and the number of attempts it's made
+  std::vector<LevelState> environments;
+  std::vector<size_t> level_indexes;
+  std::vector<uint64_t> attempt_counts;
+  std::vector<int64_t> episode_skip_levels;
+  std::vector<int64_t> player_lives;
+  std::vector<int64_t> player_scores;
+
+  // results from the last step
+  std::vector<int64_t> events_masks;
+  std::vector<int64_t> scores;
+  std::vector<int64_t> lives;
+  std::vector<int64_t> skip_levels;
+  std::vector<uint8_t> episode_results;
+  std::vector<int64_t> episode_frames;
+
+  // thread pool. each thread (including the one that calls step) always
+  // handles the same contiguous range of environments. step bumps
+  // step_generation to wake the workers, then waits for threads_remaining to
+  // reach zero. these are only modified while holding lock, but they're
+  // atomic because threads spin on them for a bit before going to sleep. if
+  // a worker's step_range throws, the exception goes in worker_exception and
+  // step rethrows it
+  std::vector<std::thread> threads;
+  std::mutex lock;
+  std::condition_variable step_started;
+  std::condition_variable step_finished;
+  std::atomic<uint64_t> step_generation;
+  std::atomic<size_t> threads_remaining;
+  std::atomic<bool> should_exit;
+  std::exception_ptr worker_exception;
+  const uint64_t* step_impulses;
+
+  // generates the parameters and the level seed for the environment's next
+  // attempt at its current level
+  std::shared_ptr<const LevelState::GenerationParameters> next_attempt_params(
+      size_t index, uint64_t* level_seed);
+  void step_range(size_t begin, size_t end);
+  void worker_thread_routine(size_t thread_index);
+  size_t range_begin(size_t thread_index) const;
+};
@@ -0,0 +1,217 @@
+#include "level_loader.hh"
+
+#include <inttypes.h>
+#include <stdint.h>
+
+#include <phosg/JSON.hh>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "level.hh"
+#include "maze.hh"
+
+using namespace std;
+
+
+static pair<int64_t, int64_t> parse_high_low(
+    const shared_ptr<JSONObject>& json) {
+  if (json->is_list()) {
+    return make_pair(json->at(0)->as_int(), json->at(1)->as_int());
+  } else {
+    int64_t count = json->as_int();
+    return make_pair(count, count);
+  }
+}
+
+static int64_t json_get_default_int(const shared_ptr<JSONObject>& json,
+    const std::string& key, int64_t default_value) {
+  try {
+    return json->at(key)->as_int();
+  } catch (const JSONObject::key_error& e) {
+    return default_value;
+  }
+}
+
+static pair<int64_t, int64_t> json_get_default_int_pair(
+    const shared_ptr<JSONObject>& json, const std::string& key,
+    const pair<int64_t, int64_t>& default_value) {
+  try {
+    return parse_high_low(json->at(key));
+  } catch (const JSONObject::key_error& e) {
+    return default_value;
+  }
+}
+
+static int64_t json_get_default_bool(const shared_ptr<JSONObject>& json,
+    const std::string& key, bool default_value) {
+  try {
+    return json->at(key)->as_bool();
+  } catch (const JSONObject::key_error& e) {
+    return default_value;
+  }
+}
+
+static double json_get_default_float(const shared_ptr<JSONObject>& json,
+    const std::string& key, double default_value) {
+  try {
+    return json->at(key)->as_float();
+  } catch (const JSONObject::key_error& e) {
+    return default_value;
+  }
+}
+
+static Monster::MovementPolicy json_get_default_MovementPolicy(
+    const shared_ptr<JSONObject>& json, const std::string& key,
+    Monster::MovementPolicy default_value) {
+  try {
+    return Monster::movement_policy_for_name(json->at(key)->as_string().c_str());
+  } catch (const JSONObject::key_error& e) {
+    return default_value;
+  }
+}
+
+static unordered_map<BlockSpecial, pair<int64_t, int64_t>> parse_special_counts_dict(
+    const shared_ptr<JSONObject>& json) {
+  unordered_map<BlockSpecial, pair<int64_t, int64_t>> result;
+  for (const auto& it : json->as_dict()) {
+    result.emplace(special_for_name(it.first.c_str()), parse_high_low(it.second));
+  }
+  return result;
+}
+
+// each formation is a list of rows, from top to bottom, like ["##", "##"] for
+// a square. '#' is a LineUp block and any other character is a cell that
+// doesn't matter
+static vector<uint32_t> parse_lineup_formations(
+    const shared_ptr<JSONObject>& json) {
+  vector<uint32_t> result;
+  for (const auto& formation_json : json->as_list()) {
+    const auto& rows_json = formation_json->as_list();
+    if (rows_json.size() > 5) {
+      throw invalid_argument("LineUp formation has more than 5 rows");
+    }
+    uint32_t formation = 0;
+    for (size_t y = 0; y < rows_json.size(); y++) {
+      const string& row = rows_json[y]->as_string();
+      if (row.size() > 5) {
+        throw invalid_argument("LineUp formation has more than 5 columns");
+      }
+      for (size_t x = 0; x < row.size(); x++) {
+        if (row[x] == '#') {
+          formation |= 1 << (y * 5 + x);
+        }
+      }
+    }
+    result.emplace_back(formation);
+  }
+  return result;
+}
+
+vector<LevelState::GenerationParameters> load_generation_params(
+    const string& filename) {
+  auto json = JSONObject::load(filename);
+
+  LevelState::GenerationParameters defaults;
+  {
+    auto defaults_json = json->at("defaults");
+    defaults.grid_pitch = defaults_json->at("grid_pitch")->as_int();
+    defaults.w = defaults_json->at("width")->as_int();
+    defaults.h = defaults_json->at("height")->as_int();
+    defaults.player_x = defaults_json->at("player_x")->as_int();
+    defaults.player_y = defaults_json->at("player_y")->as_int();
+    defaults.player_squishable = defaults_json->at("player_squishable")->as_bool();
+    defaults.basic_monster_count = parse_high_low(defaults_json->at("basic_monster_count"));
+    defaults.power_monster_count = parse_high_low(defaults_json->at("power_monster_count"));
+    defaults.basic_monster_score = defaults_json->at("basic_monster_score")->as_int();
+    defaults.power_monster_score = defaults_json->at("power_monster_score")->as_int();
+    defaults.basic_monster_movement_policy = Monster::movement_policy_for_name(
+        defaults_json->at("basic_monster_movement")->as_string().c_str());
+    defaults.power_monster_movement_policy = Monster::movement_policy_for_name(
+        defaults_json->at("power_monster_movement")->as_string().c_str());
+    defaults.power_monsters_can_push = defaults_json->at("power_monsters_can_push")->as_bool();
+    defaults.power_monsters_become_creators = defaults_json->at("power_monsters_become_creators")->as_bool();
+    defaults.player_move_speed = defaults_json->at("player_move_speed")->as_int();
+    defaults.basic_monster_move_speed = defaults_json->at("basic_monster_move_speed")->as_int();
+    defaults.power_monster_move_speed = defaults_json->at("power_monster_move_speed")->as_int();
+    defaults.push_speed = defaults_json->at("push_speed")->as_int();
+    defaults.bomb_speed = defaults_json->at("bomb_speed")->as_int();
+    defaults.bounce_speed_absorption = defaults_json->at("bounce_speed_absorption")->as_int();
+    defaults.block_destroy_rate = defaults_json->at("block_destroy_rate")->as_float();
+    defaults.special_type_to_count = parse_special_counts_dict(
+        defaults_json->at("special_counts"));
+    defaults.fixed_block_map = false; // TODO: should block maps be defaultable?
+    try {
+      defaults.lineup_formations = parse_lineup_formations(
+          defaults_json->at("lineup_formations"));
+    } catch (const JSONObject::key_error& e) { }
+  }
+
+  vector<LevelState::GenerationParameters> all_params;
+  for (const auto& level_json : json->at("levels")->as_list()) {
+    all_params.emplace_back();
+    auto& params = all_params.back();
+
+    try {
+      params.name = level_json->at("name")->as_string();
+    } catch (const out_of_range&) { }
+    params.grid_pitch = json_get_default_int(level_json, "grid_pitch", defaults.grid_pitch);
+    params.w = json_get_default_int(level_json, "width", defaults.w);
+    params.h = json_get_default_int(level_json, "height", defaults.h);
+    params.player_x = json_get_default_int(level_json, "player_x", defaults.player_x);
+    params.player_y = json_get_default_int(level_json, "player_y", defaults.player_y);
+    params.basic_monster_count = json_get_default_int_pair(level_json, "basic_monster_count", defaults.basic_monster_count);
+    params.power_monster_count = json_get_default_int_pair(level_json, "power_monster_count", defaults.power_monster_count);
+    params.basic_monster_score = json_get_default_int(level_json, "basic_monster_score", defaults.basic_monster_score);
+    params.power_monster_score = json_get_default_int(level_json, "power_monster_score", defaults.power_monster_score);
+    params.basic_monster_movement_policy = json_get_default_MovementPolicy(level_json, "basic_monster_movement", defaults.basic_monster_movement_policy);
+    params.power_monster_movement_policy = json_get_default_MovementPolicy(level_json, "power_monster_movement", defaults.power_monster_movement_policy);
+    params.player_move_speed = json_get_default_int(level_json, "player_move_speed", defaults.player_move_speed);
+    params.basic_monster_move_speed = json_get_default_int(level_json, "basic_monster_move_speed", defaults.basic_monster_move_speed);
+    params.power_monster_move_speed = json_get_default_int(level_json, "power_monster_move_speed", defaults.power_monster_move_speed);
+    params.push_speed = json_get_default_int(level_json, "push_speed", defaults.push_speed);
+    params.bomb_speed = json_get_default_int(level_json, "bomb_speed", defaults.bomb_speed);
+    params.bounce_speed_absorption = json_get_default_int(level_json, "bounce_speed_absorption", defaults.bounce_speed_absorption);
+    params.player_squishable = json_get_default_bool(level_json, "player_squishable", defaults.player_squishable);
+    params.power_monsters_can_push = json_get_default_bool(level_json, "power_monsters_can_push", defaults.player_squishable);
+    params.power_monsters_become_creators = json_get_default_bool(level_json, "power_monsters_become_creators", defaults.player_squishable);
+    params.block_destroy_rate = json_get_default_float(level_json, "block_destroy_rate", defaults.block_destroy_rate);
+
+    // TODO: support block_map
+    params.fixed_block_map = false;
+
+    try {
+      params.special_type_to_count = parse_special_counts_dict(
+          level_json->at("special_counts"));
+    } catch (const JSONObject::key_error& e) {
+      params.special_type_to_count = defaults.special_type_to_count;
+    }
+
+    try {
+      params.lineup_formations = parse_lineup_formations(
+          level_json->at("lineup_formations"));
+    } catch (const JSONObject::key_error& e) {
+      params.lineup_formations = defaults.lineup_formations;
+    }
+  }
+
+  // postprocessing: multiple all w, h, player_x, player_y by grid_pitch (in the
+  // json file, they're specified in cells rather than map units)
+  for (auto& params : all_params) {
+    params.w *= params.grid_pitch;
+    params.h *= params.grid_pitch;
+    params.player_x *= params.grid_pitch;
+    params.player_y *= params.grid_pitch;
+  }
+
+  return all_params;
+}
+
+void generate_random_elements(LevelState::GenerationParameters& params,
+    uint64_t seed) {
+  if (!params.fixed_block_map) {
+    params.block_map = generate_maze(params.w / params.grid_pitch,
+        params.h / params.grid_pitch, seed);
+  }
+}
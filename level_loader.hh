@@ -0,0 +1,17 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "level.hh"
+
+// loads the level list from a levels.json file. positions and dimensions in
+// the returned parameters are in map units (the file specifies them in cells)
+std::vector<LevelState::GenerationParameters> load_generation_params(
+    const std::string& filename);
+
+// fills in the parts of the parameters that are randomized for each attempt
+// at a level (currently just the block map, unless it's fixed). the same seed
+// always produces the same elements
+void generate_random_elements(LevelState::GenerationParameters& params,
+    uint64_t seed);
@@ -17,8 +17,8 @@
 #include <phosg/Filesystem.hh>
 #include <phosg/Hash.hh>
 #include <phosg/Image.hh>
-#include <phosg/JSON.hh>
 #include <phosg/Time.hh>
+#include <random>
 #include <stdexcept>
 #include <string>
 #include <vector>
@@ -26,7 +26,9 @@
 #include "audio.hh"
 #include "gl_text.hh"
 #include "level.hh"
+#include "level_loader.hh"
 #include "maze.hh"
+#include "replay.hh"
 
 using namespace std;
 
@@ -87,51 +89,50 @@ static void aligned_rect(float x1, float x2, float y1, float y2) {
 }
 
 static void render_block(shared_ptr<const LevelState> game,
-    shared_ptr<const Block> block, int window_w, int window_h) {
-  const auto* block_ptr = block.get();
-
-  if (block->special == BlockSpecial::CreatesMonsters) {
-    float non_red_channels = static_cast<float>(block->frames_until_action)
+    ConstBlockRef block, int window_w, int window_h) {
+  if (block.special() == BlockSpecial::CreatesMonsters) {
+    float non_red_channels = static_cast<float>(block.frames_until_action())
         / game->get_frames_between_monsters();
-    glColor4f(1.0, non_red_channels, non_red_channels, block->integrity);
+    glColor4f(1.0, non_red_channels, non_red_channels, block.integrity());
   } else {
-    float brightness_modifier = fnv1a64(&block_ptr, sizeof(block_ptr)) & 0x0F;
+    EntityHandle block_handle = block.handle();
+    float brightness_modifier = fnv1a64(&block_handle, sizeof(block_handle)) & 0x0F;
     float block_brightness = 0.8 + 0.2 * (brightness_modifier / 15);
-    glGray2f(block_brightness, block->integrity);
+    glGray2f(block_brightness, block.integrity());
   }
 
   const auto& params = game->get_params();
-  float x1 = to_window(block->x, params.w);
-  float x2 = to_window(block->x + params.grid_pitch, params.w);
-  float y1 = to_window(block->y, params.h);
-  float y2 = to_window(block->y + params.grid_pitch, params.h);
+  float x1 = to_window(block.x(), params.w);
+  float x2 = to_window(block.x() + params.grid_pitch, params.w);
+  float y1 = to_window(block.y(), params.h);
+  float y2 = to_window(block.y() + params.grid_pitch, params.h);
   aligned_rect(x1, x2, y1, y2);
 
-  if (block->special != BlockSpecial::None) {
-    render_image(special_to_image.at(block->special), x1, x2, -y1, -y2,
-        block->integrity, false);
+  if (block.special() != BlockSpecial::None) {
+    render_image(special_to_image.at(block.special()), x1, x2, -y1, -y2,
+        block.integrity(), false);
   }
 }
 
 static void render_monster(shared_ptr<const LevelState> game,
-    shared_ptr<const Monster> monster, int window_w, int window_h) {
+    ConstMonsterRef monster, int window_w, int window_h) {
   const auto& params = game->get_params();
-  float x1 = to_window(monster->x, params.w);
-  float x2 = to_window(monster->x + params.grid_pitch, params.w);
-  float y1 = to_window(monster->y, params.h);
-  float y2 = to_window(monster->y + params.grid_pitch, params.h);
+  float x1 = to_window(monster.x(), params.w);
+  float x2 = to_window(monster.x() + params.grid_pitch, params.w);
+  float y1 = to_window(monster.y(), params.h);
+  float y2 = to_window(monster.y() + params.grid_pitch, params.h);
 
-  if (monster->facing_direction == Impulse::Right || monster->facing_direction == Impulse::Left) {
+  if (monster.facing_direction() == Impulse::Right || monster.facing_direction() == Impulse::Left) {
     int64_t tread_pitch = params.grid_pitch / 4;
-    float tread_boundary_1 = to_window(((monster->x + tread_pitch) / tread_pitch) * tread_pitch, params.w);
-    float tread_boundary_2 = to_window(((monster->x + 2 * tread_pitch) / tread_pitch) * tread_pitch, params.w);
-    float tread_boundary_3 = to_window(((monster->x + 3 * tread_pitch) / tread_pitch) * tread_pitch, params.w);
-    float tread_boundary_4 = to_window(((monster->x + 4 * tread_pitch) / tread_pitch) * tread_pitch, params.w);
-    float tread_y2 = to_window(monster->y + tread_pitch, params.h);
-    float tread_y3 = to_window(monster->y + params.grid_pitch - tread_pitch, params.h);
+    float tread_boundary_1 = to_window(((monster.x() + tread_pitch) / tread_pitch) * tread_pitch, params.w);
+    float tread_boundary_2 = to_window(((monster.x() + 2 * tread_pitch) / tread_pitch) * tread_pitch, params.w);
+    float tread_boundary_3 = to_window(((monster.x() + 3 * tread_pitch) / tread_pitch) * tread_pitch, params.w);
+    float tread_boundary_4 = to_window(((monster.x() + 4 * tread_pitch) / tread_pitch) * tread_pitch, params.w);
+    float tread_y2 = to_window(monster.y() + tread_pitch, params.h);
+    float tread_y3 = to_window(monster.y() + params.grid_pitch - tread_pitch, params.h);
 
     // draw top treads
-    bool first_light = ((monster->x / tread_pitch) & 1);
+    bool first_light = ((monster.x() / tread_pitch) & 1);
     glGray2f(0.6 + first_light * 0.2, 1);
     aligned_rect(x1,               tread_boundary_1, y1, tread_y2);
     glGray2f(0.6 + !first_light * 0.2, 1);
@@ -156,15 +157,15 @@ static void render_monster(shared_ptr<const LevelState> game,
 
   } else {
     int64_t tread_pitch = params.grid_pitch / 4;
-    float tread_boundary_1 = to_window(((monster->y + tread_pitch) / tread_pitch) * tread_pitch, params.h);
-    float tread_boundary_2 = to_window(((monster->y + 2 * tread_pitch) / tread_pitch) * tread_pitch, params.h);
-    float tread_boundary_3 = to_window(((monster->y + 3 * tread_pitch) / tread_pitch) * tread_pitch, params.h);
-    float tread_boundary_4 = to_window(((monster->y + 4 * tread_pitch) / tread_pitch) * tread_pitch, params.h);
-    float tread_x2 = to_window(monster->x + tread_pitch, params.w);
-    float tread_x3 = to_window(monster->x + params.grid_pitch - tread_pitch, params.w);
+    float tread_boundary_1 = to_window(((monster.y() + tread_pitch) / tread_pitch) * tread_pitch, params.h);
+    float tread_boundary_2 = to_window(((monster.y() + 2 * tread_pitch) / tread_pitch) * tread_pitch, params.h);
+    float tread_boundary_3 = to_window(((monster.y() + 3 * tread_pitch) / tread_pitch) * tread_pitch, params.h);
+    float tread_boundary_4 = to_window(((monster.y() + 4 * tread_pitch) / tread_pitch) * tread_pitch, params.h);
+    float tread_x2 = to_window(monster.x() + tread_pitch, params.w);
+    float tread_x3 = to_window(monster.x() + params.grid_pitch - tread_pitch, params.w);
 
     // draw top treads
-    bool first_light = ((monster->y / tread_pitch) & 1);
+    bool first_light = ((monster.y() / tread_pitch) & 1);
     glGray2f(0.6 + first_light * 0.2, 1);
     aligned_rect(x1, tread_x2, y1,               tread_boundary_1);
     glGray2f(0.6 + !first_light * 0.2, 1);
@@ -189,61 +190,69 @@ static void render_monster(shared_ptr<const LevelState> game,
   }
 
   // draw body
-  if (monster->has_flags(Monster::Flag::IsPlayer)) {
-    glColor4f(0.2, 0.9, 0.0, monster->integrity);
-  } else if (monster->has_flags(Monster::Flag::IsPower)) {
-    glColor4f(0.9, 0, 0.9, monster->integrity);
+  if (monster.has_flags(Monster::Flag::IsPlayer)) {
+    glColor4f(0.2, 0.9, 0.0, monster.integrity());
+  } else if (monster.has_flags(Monster::Flag::IsPower)) {
+    glColor4f(0.9, 0, 0.9, monster.integrity());
   } else {
-    glColor4f(0.9, 0, 0, monster->integrity);
+    glColor4f(0.9, 0, 0, monster.integrity());
   }
-  float body_x1 = to_window(monster->x + params.grid_pitch / 8, params.w);
-  float body_x2 = to_window(monster->x + (params.grid_pitch * 7) / 8, params.w);
-  float body_y1 = to_window(monster->y + params.grid_pitch / 8, params.h);
-  float body_y2 = to_window(monster->y + (params.grid_pitch * 7) / 8, params.h);
+  float body_x1 = to_window(monster.x() + params.grid_pitch / 8, params.w);
+  float body_x2 = to_window(monster.x() + (params.grid_pitch * 7) / 8, params.w);
+  float body_y1 = to_window(monster.y() + params.grid_pitch / 8, params.h);
+  float body_y2 = to_window(monster.y() + (params.grid_pitch * 7) / 8, params.h);
   aligned_rect(body_x1, body_x2, body_y1, body_y2);
 
   // draw eyes
-  glColor4f(0, 0, 0, monster->integrity);
-  if (monster->facing_direction == Impulse::Left) {
-    float x1 = to_window(monster->x + 2 * params.grid_pitch / 8, params.w);
-    float x2 = to_window(monster->x + 3 * params.grid_pitch / 8, params.w);
-    aligned_rect(x1, x2, to_window(monster->y + 2 * params.grid_pitch / 8, params.h),
-        to_window(monster->y + 3 * params.grid_pitch / 8, params.h));
-    aligned_rect(x1, x2, to_window(monster->y + 5 * params.grid_pitch / 8, params.h),
-        to_window(monster->y + 6 * params.grid_pitch / 8, params.h));
-  } else if (monster->facing_direction == Impulse::Right) {
-    float x1 = to_window(monster->x + 5 * params.grid_pitch / 8, params.w);
-    float x2 = to_window(monster->x + 6 * params.grid_pitch / 8, params.w);
-    aligned_rect(x1, x2, to_window(monster->y + 2 * params.grid_pitch / 8, params.h),
-        to_window(monster->y + 3 * params.grid_pitch / 8, params.h));
-    aligned_rect(x1, x2, to_window(monster->y + 5 * params.grid_pitch / 8, params.h),
-        to_window(monster->y + 6 * params.grid_pitch / 8, params.h));
-  } else if (monster->facing_direction == Impulse::Up) {
-    float y1 = to_window(monster->y + 2 * params.grid_pitch / 8, params.h);
-    float y2 = to_window(monster->y + 3 * params.grid_pitch / 8, params.h);
-    aligned_rect(to_window(monster->x + 2 * params.grid_pitch / 8, params.w),
-        to_window(monster->x + 3 * params.grid_pitch / 8, params.w), y1, y2);
-    aligned_rect(to_window(monster->x + 5 * params.grid_pitch / 8, params.w),
-        to_window(monster->x + 6 * params.grid_pitch / 8, params.w), y1, y2);
-  } else if (monster->facing_direction == Impulse::Down) {
-    float y1 = to_window(monster->y + 5 * params.grid_pitch / 8, params.h);
-    float y2 = to_window(monster->y + 6 * params.grid_pitch / 8, params.h);
-    aligned_rect(to_window(monster->x + 2 * params.grid_pitch / 8, params.w),
-        to_window(monster->x + 3 * params.grid_pitch / 8, params.w), y1, y2);
-    aligned_rect(to_window(monster->x + 5 * params.grid_pitch / 8, params.w),
-        to_window(monster->x + 6 * params.grid_pitch / 8, params.w), y1, y2);
+  glColor4f(0, 0, 0, monster.integrity());
+  if (monster.facing_direction() == Impulse::Left) {
+    float x1 = to_window(monster.x() + 2 * params.grid_pitch / 8, params.w);
+    float x2 = to_window(monster.x() + 3 * params.grid_pitch / 8, params.w);
+    aligned_rect(x1, x2, to_window(monster.y() + 2 * params.grid_pitch / 8, params.h),
+        to_window(monster.y() + 3 * params.grid_pitch / 8, params.h));
+    aligned_rect(x1, x2, to_window(monster.y() + 5 * params.grid_pitch / 8, params.h),
+        to_window(monster.y() + 6 * params.grid_pitch / 8, params.h));
+  } else if (monster.facing_direction() == Impulse::Right) {
+    float x1 = to_window(monster.x() + 5 * params.grid_pitch / 8, params.w);
+    float x2 = to_window(monster.x() + 6 * params.grid_pitch / 8, params.w);
+    aligned_rect(x1, x2, to_window(monster.y() + 2 * params.grid_pitch / 8, params.h),
+        to_window(monster.y() + 3 * params.grid_pitch / 8, params.h));
+    aligned_rect(x1, x2, to_window(monster.y() + 5 * params.grid_pitch / 8, params.h),
+        to_window(monster.y() + 6 * params.grid_pitch / 8, params.h));
+  } else if (monster.facing_direction() == Impulse::Up) {
+    float y1 = to_window(monster.y() + 2 * params.grid_pitch / 8, params.h);
+    float y2 = to_window(monster.y() + 3 * params.grid_pitch / 8, params.h);
+    aligned_rect(to_window(monster.x() + 2 * params.grid_pitch / 8, params.w),
+        to_window(monster.x() + 3 * params.grid_pitch / 8, params.w), y1, y2);
+    aligned_rect(to_window(monster.x() + 5 * params.grid_pitch / 8, params.w),
+        to_window(monster.x() + 6 * params.grid_pitch / 8, params.w), y1, y2);
+  } else if (monster.facing_direction() == Impulse::Down) {
+    float y1 = to_window(monster.y() + 5 * params.grid_pitch / 8, params.h);
+    float y2 = to_window(monster.y() + 6 * params.grid_pitch / 8, params.h);
+    aligned_rect(to_window(monster.x() + 2 * params.grid_pitch / 8, params.w),
+        to_window(monster.x() + 3 * params.grid_pitch / 8, params.w), y1, y2);
+    aligned_rect(to_window(monster.x() + 5 * params.grid_pitch / 8, params.w),
+        to_window(monster.x() + 6 * params.grid_pitch / 8, params.w), y1, y2);
   }
 
   // if the monster has powerups, draw the bars half a cell above the monster.
   // but if it's in the top row, draw below instead
-  bool below = (monster->y < params.grid_pitch);
+  size_t num_specials = 0;
+  for (size_t slot = 0; slot < Monster::num_timed_specials; slot++) {
+    num_specials += (monster.special_mask() >> slot) & 1;
+  }
+  bool below = (monster.y() < params.grid_pitch);
   float bar_y = (below ? (y2 + (y2 - y1) / 2) : (y1 - (y2 - y1) / 2)) -
-      (monster->special_to_frames_remaining.size() * (y2 - y1) / 16);
+      (num_specials * (y2 - y1) / 16);
   float bar_center = (x1 + x2) / 2;
-  for (const auto& it : monster->special_to_frames_remaining) {
+  for (size_t slot = 0; slot < Monster::num_timed_specials; slot++) {
+    if (!(monster.special_mask() & (1 << slot))) {
+      continue;
+    }
     float bottom_y = bar_y + (y2 - y1) / 8;
-    float bar_halfwidth = (static_cast<float>(it.second) / 300) * (x2 - x1);
-    switch (it.first) {
+    float bar_halfwidth = (static_cast<float>(
+        monster.special_frames_remaining()[slot]) / 300) * (x2 - x1);
+    switch (Monster::timed_special_for_slot(slot)) {
       case BlockSpecial::Invincibility:
         glColor4f(0, 1, 0, 1); // green
         break;
@@ -270,7 +279,7 @@ static void render_monster(shared_ptr<const LevelState> game,
 
 static void render_explosions(shared_ptr<const LevelState> game, int window_w,
     int window_h) {
-  auto explosions = game->get_explosions();
+  const auto& explosions = game->get_explosions();
   if (explosions.empty()) {
     return;
   }
@@ -278,13 +287,13 @@ static void render_explosions(shared_ptr<const LevelState> game, int window_w,
   glBegin(GL_QUADS);
   const auto& params = game->get_params();
   for (const auto& explosion : explosions) {
-    float x1 = to_window(explosion->x, params.w);
-    float x2 = to_window(explosion->x + params.grid_pitch, params.w);
-    float y1 = to_window(explosion->y, params.h);
-    float y2 = to_window(explosion->y + params.grid_pitch, params.h);
+    float x1 = to_window(explosion.x(), params.w);
+    float x2 = to_window(explosion.x() + params.grid_pitch, params.w);
+    float y1 = to_window(explosion.y(), params.h);
+    float y2 = to_window(explosion.y() + params.grid_pitch, params.h);
 
     glColor4f(1.0, 0.5, 0.0,
-        (explosion->integrity > 1.0) ? 1.0 : explosion->integrity);
+        (explosion.integrity() > 1.0) ? 1.0 : explosion.integrity());
     aligned_rect(x1, x2, y1, y2);
   }
   glEnd();
@@ -292,9 +301,8 @@ static void render_explosions(shared_ptr<const LevelState> game, int window_w,
 
 
 
-static void render_level_state(shared_ptr<const LevelState> game,
-    int64_t level_index, int64_t player_lives, int64_t player_score,
-    int64_t player_skip_levels, int window_w, int window_h) {
+static void render_level(shared_ptr<const LevelState> game, int window_w,
+    int window_h) {
   // draw black background
   glClearColor(0, 0, 0, 0);
 
@@ -310,13 +318,19 @@ static void render_level_state(shared_ptr<const LevelState> game,
 
   // draw monsters red and the player yellow
   for (const auto& monster : game->get_monsters()) {
-    if (monster->death_frame >= 0) {
+    if (monster.death_frame() >= 0) {
       continue;
     }
     render_monster(game, monster, window_w, window_h);
   }
 
   glEnd();
+}
+
+static void render_level_state(shared_ptr<const LevelState> game,
+    int64_t level_index, int64_t player_lives, int64_t player_score,
+    int64_t player_skip_levels, int window_w, int window_h) {
+  render_level(game, window_w, window_h);
 
   // draw the player's score and lives
   float aspect_ratio = (float)window_w / window_h;
@@ -414,7 +428,7 @@ static void render_game_screen(
     aligned_rect(-progress, progress, -0.05, 0.05);
     glEnd();
 
-  } else if (game->get_player()->death_frame >= 0) {
+  } else if (game->get_player().death_frame() >= 0) {
     if (player_lives == 0) {
       render_stripe_animation(window_w, window_h, 100, 0.1f, 0.0f, 0.0f, 0.8f,
           1.0f, 0.0f, 0.0f, 0.1f);
@@ -467,6 +481,46 @@ static void render_paused_overlay(int window_w, int window_h, int level_index,
   draw_text(0, -0.8, 1, 1, 1, 1, aspect_ratio, 0.01, true, "esc: exit");
 }
 
+static void render_playback_overlay(int window_w, int window_h,
+    shared_ptr<const LevelState> game, const Replay& replay, int64_t speed,
+    bool paused) {
+  float aspect_ratio = (float)window_w / window_h;
+  int64_t frame = game->get_frames_executed();
+  int64_t secs = frame / game->get_updates_per_second();
+  int64_t total_secs = replay.num_frames / game->get_updates_per_second();
+
+  vector<string> lines;
+  lines.emplace_back(string_printf("Replay of level %" PRId64 ": %s",
+      replay.level_index, game->get_params().name.c_str()));
+  lines.emplace_back(string_printf("%" PRId64 ":%02" PRId64 " / %" PRId64
+      ":%02" PRId64 " (frame %" PRId64 " / %" PRId64 ")", secs / 60, secs % 60,
+      total_secs / 60, total_secs % 60, frame, replay.num_frames));
+  if (paused) {
+    lines.emplace_back("Paused");
+  } else {
+    lines.emplace_back(string_printf("Speed: %" PRId64 "x", speed));
+  }
+
+  glBlendFunc(GL_ONE_MINUS_DST_COLOR, GL_ZERO);
+  float y = -0.9;
+  for (const auto& s : lines) {
+    draw_text(-0.99, y, 0.0, 0.8, 0.0, 1.0, aspect_ratio, 0.01, false, "%s", s.c_str());
+    y += 0.1;
+  }
+  draw_text(-0.99, 0.9, 0.0, 0.8, 0.0, 1.0, aspect_ratio, 0.007, false,
+      "space: pause   left/right: seek 5s (shift: 30s)   ,/.: step   "
+      "up/down: speed   home/end: jump   esc: exit");
+  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+  // progress bar along the bottom edge
+  float progress = replay.num_frames ?
+      (static_cast<float>(frame) / replay.num_frames) : 1.0f;
+  glBegin(GL_QUADS);
+  glGray2f(1, 0.5);
+  aligned_rect(-1, -1 + 2 * progress, 0.98, 1.0);
+  glEnd();
+}
+
 
 
 vector<LevelState::GenerationParameters> generation_params;
@@ -481,171 +535,61 @@ Phase phase = Phase::Paused;
 bool should_play_sounds = true;
 uint64_t current_impulse = None;
 
+// every attempt at a level gets its own seeds from here, so the same --seed
+// always produces the same sequence of levels
+mt19937_64 level_seed_generator;
 
 
-static pair<int64_t, int64_t> parse_high_low(
-    const shared_ptr<JSONObject>& json) {
-  if (json->is_list()) {
-    return make_pair(json->at(0)->as_int(), json->at(1)->as_int());
-  } else {
-    int64_t count = json->as_int();
-    return make_pair(count, count);
-  }
-}
 
-static int64_t json_get_default_int(const shared_ptr<JSONObject>& json,
-    const std::string& key, int64_t default_value) {
-  try {
-    return json->at(key)->as_int();
-  } catch (const JSONObject::key_error& e) {
-    return default_value;
-  }
-}
+// with --record, every attempt at a level is recorded, and saved to
+// <record_prefix>.<attempt>.replay when the next attempt starts or the game
+// exits. attempts that didn't execute any frames aren't saved
+string record_prefix;
+int64_t num_recorded_attempts = 0;
+unique_ptr<Replay> replay;
 
-static pair<int64_t, int64_t> json_get_default_int_pair(
-    const shared_ptr<JSONObject>& json, const std::string& key,
-    const pair<int64_t, int64_t>& default_value) {
-  try {
-    return parse_high_low(json->at(key));
-  } catch (const JSONObject::key_error& e) {
-    return default_value;
+static void save_replay() {
+  if (replay && replay->num_frames) {
+    replay->save(string_printf("%s.%" PRId64 ".replay", record_prefix.c_str(),
+        num_recorded_attempts++));
   }
+  replay.reset();
 }
 
-static int64_t json_get_default_bool(const shared_ptr<JSONObject>& json,
-    const std::string& key, bool default_value) {
-  try {
-    return json->at(key)->as_bool();
-  } catch (const JSONObject::key_error& e) {
-    return default_value;
-  }
-}
-
-static double json_get_default_float(const shared_ptr<JSONObject>& json,
-    const std::string& key, double default_value) {
-  try {
-    return json->at(key)->as_float();
-  } catch (const JSONObject::key_error& e) {
-    return default_value;
-  }
-}
+// the whole level is checked once when it's created. in builds with
+// TREADS_VALIDATE, the entities that changed are also checked after every
+// frame (see LevelState::validate_frame). if a check fails, the game stops and
+// shows what went wrong
+string validation_failure;
 
-static Monster::MovementPolicy json_get_default_MovementPolicy(
-    const shared_ptr<JSONObject>& json, const std::string& key,
-    Monster::MovementPolicy default_value) {
+static void validate_level(bool whole_level) {
   try {
-    return Monster::movement_policy_for_name(json->at(key)->as_string().c_str());
-  } catch (const JSONObject::key_error& e) {
-    return default_value;
-  }
-}
-
-static unordered_map<BlockSpecial, pair<int64_t, int64_t>> parse_special_counts_dict(
-    const shared_ptr<JSONObject>& json) {
-  unordered_map<BlockSpecial, pair<int64_t, int64_t>> result;
-  for (const auto& it : json->as_dict()) {
-    result.emplace(special_for_name(it.first.c_str()), parse_high_low(it.second));
-  }
-  return result;
-}
-
-static vector<LevelState::GenerationParameters> load_generation_params(
-    const string& filename) {
-  auto json = JSONObject::load(filename);
-
-  LevelState::GenerationParameters defaults;
-  {
-    auto defaults_json = json->at("defaults");
-    defaults.grid_pitch = defaults_json->at("grid_pitch")->as_int();
-    defaults.w = defaults_json->at("width")->as_int();
-    defaults.h = defaults_json->at("height")->as_int();
-    defaults.player_x = defaults_json->at("player_x")->as_int();
-    defaults.player_y = defaults_json->at("player_y")->as_int();
-    defaults.player_squishable = defaults_json->at("player_squishable")->as_bool();
-    defaults.basic_monster_count = parse_high_low(defaults_json->at("basic_monster_count"));
-    defaults.power_monster_count = parse_high_low(defaults_json->at("power_monster_count"));
-    defaults.basic_monster_score = defaults_json->at("basic_monster_score")->as_int();
-    defaults.power_monster_score = defaults_json->at("power_monster_score")->as_int();
-    defaults.basic_monster_movement_policy = Monster::movement_policy_for_name(
-        defaults_json->at("basic_monster_movement")->as_string().c_str());
-    defaults.power_monster_movement_policy = Monster::movement_policy_for_name(
-        defaults_json->at("power_monster_movement")->as_string().c_str());
-    defaults.power_monsters_can_push = defaults_json->at("power_monsters_can_push")->as_bool();
-    defaults.power_monsters_become_creators = defaults_json->at("power_monsters_become_creators")->as_bool();
-    defaults.player_move_speed = defaults_json->at("player_move_speed")->as_int();
-    defaults.basic_monster_move_speed = defaults_json->at("basic_monster_move_speed")->as_int();
-    defaults.power_monster_move_speed = defaults_json->at("power_monster_move_speed")->as_int();
-    defaults.push_speed = defaults_json->at("push_speed")->as_int();
-    defaults.bomb_speed = defaults_json->at("bomb_speed")->as_int();
-    defaults.bounce_speed_absorption = defaults_json->at("bounce_speed_absorption")->as_int();
-    defaults.block_destroy_rate = defaults_json->at("block_destroy_rate")->as_float();
-    defaults.special_type_to_count = parse_special_counts_dict(
-        defaults_json->at("special_counts"));
-    defaults.fixed_block_map = false; // TODO: should block maps be defaultable?
-  }
-
-  vector<LevelState::GenerationParameters> all_params;
-  for (const auto& level_json : json->at("levels")->as_list()) {
-    all_params.emplace_back();
-    auto& params = all_params.back();
-
-    try {
-      params.name = level_json->at("name")->as_string();
-    } catch (const out_of_range&) { }
-    params.grid_pitch = json_get_default_int(level_json, "grid_pitch", defaults.grid_pitch);
-    params.w = json_get_default_int(level_json, "width", defaults.w);
-    params.h = json_get_default_int(level_json, "height", defaults.h);
-    params.player_x = json_get_default_int(level_json, "player_x", defaults.player_x);
-    params.player_y = json_get_default_int(level_json, "player_y", defaults.player_y);
-    params.basic_monster_count = json_get_default_int_pair(level_json, "basic_monster_count", defaults.basic_monster_count);
-    params.power_monster_count = json_get_default_int_pair(level_json, "power_monster_count", defaults.power_monster_count);
-    params.basic_monster_score = json_get_default_int(level_json, "basic_monster_score", defaults.basic_monster_score);
-    params.power_monster_score = json_get_default_int(level_json, "power_monster_score", defaults.power_monster_score);
-    params.basic_monster_movement_policy = json_get_default_MovementPolicy(level_json, "basic_monster_movement", defaults.basic_monster_movement_policy);
-    params.power_monster_movement_policy = json_get_default_MovementPolicy(level_json, "power_monster_movement", defaults.power_monster_movement_policy);
-    params.player_move_speed = json_get_default_int(level_json, "player_move_speed", defaults.player_move_speed);
-    params.basic_monster_move_speed = json_get_default_int(level_json, "basic_monster_move_speed", defaults.basic_monster_move_speed);
-    params.power_monster_move_speed = json_get_default_int(level_json, "power_monster_move_speed", defaults.power_monster_move_speed);
-    params.push_speed = json_get_default_int(level_json, "push_speed", defaults.push_speed);
-    params.bomb_speed = json_get_default_int(level_json, "bomb_speed", defaults.bomb_speed);
-    params.bounce_speed_absorption = json_get_default_int(level_json, "bounce_speed_absorption", defaults.bounce_speed_absorption);
-    params.player_squishable = json_get_default_bool(level_json, "player_squishable", defaults.player_squishable);
-    params.power_monsters_can_push = json_get_default_bool(level_json, "power_monsters_can_push", defaults.player_squishable);
-    params.power_monsters_become_creators = json_get_default_bool(level_json, "power_monsters_become_creators", defaults.player_squishable);
-    params.block_destroy_rate = json_get_default_float(level_json, "block_destroy_rate", defaults.block_destroy_rate);
-
-    // TODO: support block_map
-    params.fixed_block_map = false;
-
-    try {
-      params.special_type_to_count = parse_special_counts_dict(
-          level_json->at("special_counts"));
-    } catch (const JSONObject::key_error& e) {
-      params.special_type_to_count = defaults.special_type_to_count;
+    if (whole_level) {
+      game->validate();
+    } else {
+      game->validate_frame();
     }
+  } catch (const exception& e) {
+    fprintf(stderr, "validation failure: %s\n", e.what());
+    validation_failure = e.what();
   }
-
-  // postprocessing: multiple all w, h, player_x, player_y by grid_pitch (in the
-  // json file, they're specified in cells rather than map units)
-  for (auto& params : all_params) {
-    params.w *= params.grid_pitch;
-    params.h *= params.grid_pitch;
-    params.player_x *= params.grid_pitch;
-    params.player_y *= params.grid_pitch;
-  }
-
-  return all_params;
 }
 
-static void generate_random_elements(LevelState::GenerationParameters& params) {
-  if (!params.fixed_block_map) {
-    params.block_map = generate_maze(params.w / params.grid_pitch,
-        params.h / params.grid_pitch);
+static void start_level(int64_t level_index) {
+  auto& params = generation_params[level_index];
+  uint64_t elements_seed = level_seed_generator();
+  uint64_t level_seed = level_seed_generator();
+  generate_random_elements(params, elements_seed);
+  game.reset(new LevelState(params, level_seed));
+  validate_level(true);
+
+  if (!record_prefix.empty()) {
+    save_replay();
+    replay.reset(new Replay(level_index, elements_seed, level_seed,
+        params.hash()));
   }
 }
 
-
-
 static void glfw_key_cb(GLFWwindow* window, int key, int scancode,
     int action, int mods) {
 
@@ -662,7 +606,7 @@ static void glfw_key_cb(GLFWwindow* window, int key, int scancode,
 
     } else if (key == GLFW_KEY_ENTER) {
       if (phase == Phase::Playing) {
-        if ((game->get_player()->death_frame >= 0) && !frames_until_next_level) {
+        if ((game->get_player().death_frame() >= 0) && !frames_until_next_level) {
           if (level_index == 0) {
             // you have infinite lives on level 0 but can't keep your score
             player_lives = 3;
@@ -676,8 +620,7 @@ static void glfw_key_cb(GLFWwindow* window, int key, int scancode,
             player_lives--;
           }
           player_skip_levels = 0;
-          generate_random_elements(generation_params[level_index]);
-          game.reset(new LevelState(generation_params[level_index]));
+          start_level(level_index);
         }
         phase = Phase::Paused;
       } else if (phase == Phase::Paused) {
@@ -719,11 +662,65 @@ static void glfw_key_cb(GLFWwindow* window, int key, int scancode,
   }
 }
 
+// with --replay, the game shows a replay instead of letting the player play.
+// the viewer can pause, seek (which restores the closest keyframe before the
+// target and executes the frames after it; see Replay::seek), and play at up
+// to 64x speed. when it's playing faster than real time, it executes all the
+// frames that are due and then renders only the last one, so it isn't limited
+// by the display's refresh rate
+unique_ptr<Replay> viewed_replay;
+int64_t playback_speed = 1;
+static const int64_t max_playback_speed = 64;
+bool playback_paused = false;
+
+static void seek_viewed_replay(int64_t frame) {
+  if (frame < 0) {
+    frame = 0;
+  } else if (frame > viewed_replay->num_frames) {
+    frame = viewed_replay->num_frames;
+  }
+  viewed_replay->seek(*game, frame);
+}
+
+static void glfw_playback_key_cb(GLFWwindow* window, int key, int scancode,
+    int action, int mods) {
+  if ((action != GLFW_PRESS) && (action != GLFW_REPEAT)) {
+    return;
+  }
+
+  int64_t frame = game->get_frames_executed();
+  int64_t seek_frames = ((mods & GLFW_MOD_SHIFT) ? 30 : 5) *
+      game->get_updates_per_second();
+  if (key == GLFW_KEY_ESCAPE) {
+    glfwSetWindowShouldClose(window, 1);
+  } else if ((key == GLFW_KEY_SPACE) || (key == GLFW_KEY_ENTER)) {
+    playback_paused = !playback_paused;
+  } else if (key == GLFW_KEY_LEFT) {
+    seek_viewed_replay(frame - seek_frames);
+  } else if (key == GLFW_KEY_RIGHT) {
+    seek_viewed_replay(frame + seek_frames);
+  } else if (key == GLFW_KEY_COMMA) {
+    playback_paused = true;
+    seek_viewed_replay(frame - 1);
+  } else if (key == GLFW_KEY_PERIOD) {
+    playback_paused = true;
+    seek_viewed_replay(frame + 1);
+  } else if (key == GLFW_KEY_HOME) {
+    seek_viewed_replay(0);
+  } else if (key == GLFW_KEY_END) {
+    seek_viewed_replay(viewed_replay->num_frames);
+  } else if ((key == GLFW_KEY_UP) && (playback_speed < max_playback_speed)) {
+    playback_speed *= 2;
+  } else if ((key == GLFW_KEY_DOWN) && (playback_speed > 1)) {
+    playback_speed /= 2;
+  }
+}
+
 static void glfw_focus_cb(GLFWwindow* window, int focused) {
   // auto-pause when we lose focus, except if the player is dead (in this case
   // they will have to press enter to start playing again anyway)
   if ((focused == GL_FALSE) && (phase == Phase::Playing) &&
-      (game->get_player()->death_frame < 0)) {
+      (game->get_player().death_frame() < 0)) {
     phase = Phase::Paused;
 
     // refresh the "get ready" time
@@ -761,17 +758,206 @@ static void add_block_special_image(BlockSpecial special,
       forward_as_tuple(filename.c_str()));
 }
 
+static void run_game(GLFWwindow* window,
+    unordered_map<Event, unique_ptr<SampledSound>>& event_to_sound) {
+  uint64_t last_update_time = now();
+
+  unordered_set<unique_ptr<Annotation>> annotations;
+  while (!glfwWindowShouldClose(window)) {
+
+    int window_w, window_h;
+    glfwGetFramebufferSize(window, &window_w, &window_h);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    if (!validation_failure.empty()) {
+      render_stripe_animation(window_w, window_h, 100, 0.0f, 0.0f, 0.0f, 0.6f,
+          1.0, 0.0, 0.0, 0.3);
+      draw_text(0, 0.3, 1, 0, 0, 1, (float)window_w / window_h, 0.004, true,
+          validation_failure.c_str());
+      draw_text(0, 0.0, 1, 1, 1, 1, (float)window_w / window_h, 0.01, true,
+          "esc: exit");
+
+    } else {
+      uint64_t usec_per_update = 1000000.0 / game->get_updates_per_second();
+      uint64_t now_time = now();
+      uint64_t update_diff = now_time - last_update_time;
+      if (update_diff >= usec_per_update) {
+        if (phase == Phase::Playing) {
+          if (frames_until_next_level == 0) {
+            if (replay) {
+              replay->add_frame(*game, current_impulse);
+            }
+            const auto& events = game->exec_frame(current_impulse);
+            validate_level(false);
+            if (should_play_sounds) {
+              uint64_t events_mask = events.events_mask;
+              while (events_mask) {
+                uint64_t remaining_events = events_mask & (events_mask - 1);
+                Event this_event = static_cast<Event>(events_mask ^ remaining_events);
+                try {
+                  event_to_sound.at(this_event)->play();
+                } catch (const out_of_range& e) { }
+                events_mask = remaining_events;
+              }
+            }
+
+            for (const auto& score : events.scores) {
+              const auto& monsters = game->get_monsters();
+              int64_t monster_index = monsters.index_for_handle(score.monster);
+              int64_t killed_index = monsters.index_for_handle(score.killed);
+              if ((monster_index >= 0) &&
+                  monsters[monster_index].has_flags(Monster::Flag::IsPlayer)) {
+                player_score += score.score;
+                player_lives += score.lives;
+                player_skip_levels += score.skip_levels;
+              }
+
+              const auto& params = game->get_params();
+              if (killed_index < 0) {
+                // this score came from a bonus block
+                float annotation_x = to_window(score.block_x + params.grid_pitch / 2, params.w);
+                float annotation_y = -to_window(score.block_y + params.grid_pitch / 2, params.h);
+
+                if (score.bonus != BlockSpecial::None) {
+                  annotations.emplace(new Annotation(annotation_x, annotation_y,
+                      0, 1, 0, 2, 1, 0.007, display_name_for_special(score.bonus)));
+                } else if (score.lives) {
+                  annotations.emplace(new Annotation(annotation_x, annotation_y,
+                      0, 1, 0, 2, 1, 0.007, string_printf("%dUP", score.lives)));
+                } else if (score.score) {
+                  annotations.emplace(new Annotation(annotation_x, annotation_y,
+                      0, 1, 0, 2, 1, 0.007, string_printf("%d", score.score)));
+                }
+              } else if (monsters[killed_index].has_flags(Monster::Flag::IsPlayer) ||
+                  (score.killed == score.monster)) {
+                auto killed = monsters[killed_index];
+                float annotation_x = to_window(killed.x() + params.grid_pitch / 2, params.w);
+                float annotation_y = -to_window(killed.y() + params.grid_pitch / 2, params.h);
+                annotations.emplace(new Annotation(annotation_x, annotation_y,
+                    1, 0.5, 0, 2, 1, 0.007, "oh no!"));
+              } else {
+                auto position_monster = monsters[killed_index];
+                float annotation_x = to_window(position_monster.x() + params.grid_pitch / 2, params.w);
+                float annotation_y = -to_window(position_monster.y() + params.grid_pitch / 2, params.h);
+                if (score.lives) {
+                  annotations.emplace(new Annotation(annotation_x, annotation_y,
+                      0, 1, 0, 2, 1, 0.007, string_printf("%dUP", score.lives)));
+                } else if (score.score) {
+                  annotations.emplace(new Annotation(annotation_x, annotation_y,
+                      0, 1, 0, 2, 1, 0.007, string_printf("%d", score.score)));
+                }
+              }
+            }
+
+            // check if the player has completed the level
+            if (game->is_complete()) {
+              if ((game->get_player().death_frame() >= 0) && (player_lives >= 1)) {
+                // player is dead, but has extra lives - they can go to the next
+                // level and lose a life
+                if (level_index != 0) {
+                  player_lives--;
+                }
+                frames_until_next_level = 3 * game->get_updates_per_second();
+              } else if (game->get_player().death_frame() < 0) {
+                // player is alive
+                frames_until_next_level = 3 * game->get_updates_per_second();
+              }
+            }
+
+          } else if (frames_until_next_level == 1) {
+            level_index += (1 + player_skip_levels);
+            player_skip_levels = 0;
+            if (level_index >= generation_params.size()) {
+              level_index = 0; // TODO: this should probably be size/2 or something
+            }
+            start_level(level_index);
+            phase = Phase::Playing;
+            frames_until_next_level = 0;
+          } else if (frames_until_next_level > 0) {
+            frames_until_next_level--;
+          }
+        }
+        last_update_time = now_time;
+      }
+
+      render_game_screen(generation_params, game, window_w, window_h,
+          annotations, player_lives, player_score, player_skip_levels,
+          level_index, frames_until_next_level, phase);
+
+      if (phase == Phase::Paused) {
+        render_paused_overlay(window_w, window_h, level_index,
+            generation_params[level_index].name.c_str(),
+            game->get_frames_executed(), should_play_sounds);
+      }
+    }
+
+    glfwSwapBuffers(window);
+    glfwPollEvents();
+  }
+}
+
+static void run_playback(GLFWwindow* window) {
+  uint64_t last_update_time = now();
+  // fractions of a frame that were due but not executed yet, so that speeds
+  // that don't divide the refresh rate still play at the right rate on average
+  double frames_due = 0;
+
+  while (!glfwWindowShouldClose(window)) {
+
+    int window_w, window_h;
+    glfwGetFramebufferSize(window, &window_w, &window_h);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    uint64_t now_time = now();
+    int64_t frame = game->get_frames_executed();
+    if (frame >= viewed_replay->num_frames) {
+      playback_paused = true;
+    }
+    if (playback_paused) {
+      frames_due = 0;
+    } else {
+      frames_due += static_cast<double>(now_time - last_update_time) *
+          game->get_updates_per_second() * playback_speed / 1000000.0;
+      // don't try to catch up on more than a second of playback at once (e.g.
+      // if the window was being dragged), or the viewer would stall
+      double max_frames_due = game->get_updates_per_second() * playback_speed;
+      if (frames_due > max_frames_due) {
+        frames_due = max_frames_due;
+      }
+      int64_t frames_to_execute = frames_due;
+      frames_due -= frames_to_execute;
+      viewed_replay->play(*game, frame + frames_to_execute);
+    }
+    last_update_time = now_time;
+
+    render_level(game, window_w, window_h);
+    render_playback_overlay(window_w, window_h, game, *viewed_replay,
+        playback_speed, playback_paused);
+
+    glfwSwapBuffers(window);
+    glfwPollEvents();
+  }
+}
+
 int main(int argc, char* argv[]) {
 
+  uint64_t seed = time(NULL) ^ getpid();
   for (int x = 1; x < argc; x++) {
     if (!strncmp(argv[x], "--level-index=", 14)) {
       level_index = strtoull(&argv[x][14], NULL, 0);
+    } else if (!strncmp(argv[x], "--seed=", 7)) {
+      seed = strtoull(&argv[x][7], NULL, 0);
+    } else if (!strncmp(argv[x], "--record=", 9)) {
+      record_prefix = &argv[x][9];
+    } else if (!strncmp(argv[x], "--replay=", 9)) {
+      viewed_replay.reset(new Replay(Replay::load(&argv[x][9])));
     } else {
       throw invalid_argument("unknown command-line option");
     }
   }
 
-  srand(time(NULL) ^ getpid());
+  srand(seed);
+  level_seed_generator.seed(seed);
 
   string media_directory;
 #ifdef MACOSX
@@ -838,8 +1024,13 @@ int main(int argc, char* argv[]) {
 
   // generate the level
   generation_params = load_generation_params(media_directory + "/levels.json");
-  generate_random_elements(generation_params[level_index]);
-  game.reset(new LevelState(generation_params[level_index]));
+  if (viewed_replay) {
+    level_index = viewed_replay->level_index;
+    game.reset(new LevelState(viewed_replay->create_level(generation_params)));
+    validate_level(true);
+  } else {
+    start_level(level_index);
+  }
   uint64_t w_cells = generation_params[level_index].w / generation_params[level_index].grid_pitch;
   uint64_t h_cells = generation_params[level_index].h / generation_params[level_index].grid_pitch;
 
@@ -860,8 +1051,12 @@ int main(int argc, char* argv[]) {
   }
 
   glfwSetFramebufferSizeCallback(window, glfw_resize_cb);
-  glfwSetKeyCallback(window, glfw_key_cb);
-  glfwSetWindowFocusCallback(window, glfw_focus_cb);
+  if (viewed_replay) {
+    glfwSetKeyCallback(window, glfw_playback_key_cb);
+  } else {
+    glfwSetKeyCallback(window, glfw_key_cb);
+    glfwSetWindowFocusCallback(window, glfw_focus_cb);
+  }
 
   glfwMakeContextCurrent(window);
 
@@ -880,145 +1075,16 @@ int main(int argc, char* argv[]) {
   glEnable(GL_BLEND);
   glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-  uint64_t last_update_time = now();
-
-  unordered_set<unique_ptr<Annotation>> annotations;
-  while (!glfwWindowShouldClose(window)) {
-
-    int window_w, window_h;
-    glfwGetFramebufferSize(window, &window_w, &window_h);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-    string validation_failure;
-    try {
-      game->validate();
-    } catch (const exception& e) {
-      fprintf(stderr, "validation failure: %s\n", e.what());
-      validation_failure = e.what();
-    }
-
-    if (!validation_failure.empty()) {
-      render_stripe_animation(window_w, window_h, 100, 0.0f, 0.0f, 0.0f, 0.6f,
-          1.0, 0.0, 0.0, 0.3);
-      draw_text(0, 0.3, 1, 0, 0, 1, (float)window_w / window_h, 0.004, true,
-          validation_failure.c_str());
-      draw_text(0, 0.0, 1, 1, 1, 1, (float)window_w / window_h, 0.01, true,
-          "esc: exit");
-
-    } else {
-      uint64_t usec_per_update = 1000000.0 / game->get_updates_per_second();
-      uint64_t now_time = now();
-      uint64_t update_diff = now_time - last_update_time;
-      if (update_diff >= usec_per_update) {
-        if (phase == Phase::Playing) {
-          if (frames_until_next_level == 0) {
-            auto events = game->exec_frame(current_impulse);
-            if (should_play_sounds) {
-              while (events.events_mask) {
-                uint64_t remaining_events = events.events_mask & (events.events_mask - 1);
-                Event this_event = static_cast<Event>(events.events_mask ^ remaining_events);
-                try {
-                  event_to_sound.at(this_event)->play();
-                } catch (const out_of_range& e) { }
-                events.events_mask = remaining_events;
-              }
-            }
-
-            for (const auto& score : events.scores) {
-              if (score.monster->has_flags(Monster::Flag::IsPlayer)) {
-                player_score += score.score;
-                player_lives += score.lives;
-                player_skip_levels += score.skip_levels;
-              }
-
-              const auto& params = game->get_params();
-              if (!score.killed.get()) {
-                // this score came from a bonus block
-                float annotation_x = to_window(score.block_x + params.grid_pitch / 2, params.w);
-                float annotation_y = -to_window(score.block_y + params.grid_pitch / 2, params.h);
-
-                if (score.bonus != BlockSpecial::None) {
-                  annotations.emplace(new Annotation(annotation_x, annotation_y,
-                      0, 1, 0, 2, 1, 0.007, display_name_for_special(score.bonus)));
-                } else if (score.lives) {
-                  annotations.emplace(new Annotation(annotation_x, annotation_y,
-                      0, 1, 0, 2, 1, 0.007, string_printf("%dUP", score.lives)));
-                } else if (score.score) {
-                  annotations.emplace(new Annotation(annotation_x, annotation_y,
-                      0, 1, 0, 2, 1, 0.007, string_printf("%d", score.score)));
-                }
-              } else if (score.killed.get() && (
-                  (score.killed->has_flags(Monster::Flag::IsPlayer)) ||
-                  (score.killed == score.monster))) {
-                float annotation_x = to_window(score.killed->x + params.grid_pitch / 2, params.w);
-                float annotation_y = -to_window(score.killed->y + params.grid_pitch / 2, params.h);
-                annotations.emplace(new Annotation(annotation_x, annotation_y,
-                    1, 0.5, 0, 2, 1, 0.007, "oh no!"));
-              } else {
-                shared_ptr<Monster> position_monster = score.killed.get() ?
-                    score.killed : score.monster;
-                float annotation_x = to_window(position_monster->x + params.grid_pitch / 2, params.w);
-                float annotation_y = -to_window(position_monster->y + params.grid_pitch / 2, params.h);
-                if (score.lives) {
-                  annotations.emplace(new Annotation(annotation_x, annotation_y,
-                      0, 1, 0, 2, 1, 0.007, string_printf("%dUP", score.lives)));
-                } else if (score.score) {
-                  annotations.emplace(new Annotation(annotation_x, annotation_y,
-                      0, 1, 0, 2, 1, 0.007, string_printf("%d", score.score)));
-                }
-              }
-            }
-
-            // check if the player has completed the level
-            if ((game->count_monsters_with_flags(0, Monster::Flag::IsPlayer) == 0) &&
-                (game->count_blocks_with_special(BlockSpecial::CreatesMonsters) == 0)) {
-              if ((game->get_player()->death_frame >= 0) && (player_lives >= 1)) {
-                // player is dead, but has extra lives - they can go to the next
-                // level and lose a life
-                if (level_index != 0) {
-                  player_lives--;
-                }
-                frames_until_next_level = 3 * game->get_updates_per_second();
-              } else if (game->get_player()->death_frame < 0) {
-                // player is alive
-                frames_until_next_level = 3 * game->get_updates_per_second();
-              }
-            }
-
-          } else if (frames_until_next_level == 1) {
-            level_index += (1 + player_skip_levels);
-            player_skip_levels = 0;
-            if (level_index >= generation_params.size()) {
-              level_index = 0; // TODO: this should probably be size/2 or something
-            }
-            generate_random_elements(generation_params[level_index]);
-            game.reset(new LevelState(generation_params[level_index]));
-            phase = Phase::Playing;
-            frames_until_next_level = 0;
-          } else if (frames_until_next_level > 0) {
-            frames_until_next_level--;
-          }
-        }
-        last_update_time = now_time;
-      }
-
-      render_game_screen(generation_params, game, window_w, window_h,
-          annotations, player_lives, player_score, player_skip_levels,
-          level_index, frames_until_next_level, phase);
-
-      if (phase == Phase::Paused) {
-        render_paused_overlay(window_w, window_h, level_index,
-            generation_params[level_index].name.c_str(),
-            game->get_frames_executed(), should_play_sounds);
-      }
-    }
-
-    glfwSwapBuffers(window);
-    glfwPollEvents();
+  if (viewed_replay) {
+    run_playback(window);
+  } else {
+    run_game(window, event_to_sound);
   }
 
   glfwDestroyWindow(window);
   glfwTerminate();
 
+  save_replay();
+
   return 0;
 }
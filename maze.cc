@@ -6,6 +6,7 @@
 #include <algorithm>
 #include <deque>
 #include <random>
+#include <stdexcept>
 #include <vector>
 
 #include "level.hh" // for Impulse
@@ -54,46 +55,61 @@ struct DFSStep {
       directions_remaining(directions_remaining) { }
 };
 
-vector<bool> generate_maze(uint64_t w, uint64_t h) {
+vector<bool> generate_maze(uint64_t w, uint64_t h, uint64_t seed) {
   if (!(w & 1) || !(h & 1)) {
     throw invalid_argument("dimensions must be odd integers");
   }
 
+  // prepare for randomness
+  mt19937_64 rng(seed);
+
+  // the last coordinate in each dimension, signed like the node coordinates
+  int64_t max_x = w - 1;
+  int64_t max_y = h - 1;
+
   Map2D map(w, h, true);
   Map2D nodes_visited(w, h, false);
 
   // now choose a random node and start DFSing in a random direction from it
   deque<DFSStep> steps;
   {
-    int64_t start_x = (rand() % ((w + 1) / 2)) * 2;
-    int64_t start_y = (rand() % ((h + 1) / 2)) * 2;
+    int64_t start_x = (rng() % ((w + 1) / 2)) * 2;
+    int64_t start_y = (rng() % ((h + 1) / 2)) * 2;
     uint8_t start_directions =
         ((start_x == 0)     ? 0 : Impulse::Left) |
-        ((start_x == w - 1) ? 0 : Impulse::Right) |
+        ((start_x == max_x) ? 0 : Impulse::Right) |
         ((start_y == 0)     ? 0 : Impulse::Up) |
-        ((start_y == h - 1) ? 0 : Impulse::Down);
+        ((start_y == max_y) ? 0 : Impulse::Down);
     steps.emplace_back(start_x, start_y, start_directions);
     nodes_visited.put(start_x, start_y, true);
     map.put(start_x, start_y, false);
   }
 
-  // prepare for randomness
-  random_device rd;
-  mt19937 g(rd());
-
   // now do that DFS
-  Impulse direction_order[] = {Impulse::Left, Impulse::Right, Impulse::Up,
-      Impulse::Down};
+  static const Impulse all_directions[] = {Impulse::Left, Impulse::Right,
+      Impulse::Up, Impulse::Down};
   while (!steps.empty()) {
     auto& current_step = steps.back();
 
-    // pick a direction to go that we haven't already gone from this step
+    // pick a direction to go that we haven't already gone from this step. we
+    // don't use std::shuffle for this because its results differ between
+    // standard library implementations, and a seed should produce the same
+    // maze everywhere
     Impulse direction = Impulse::None;
-    shuffle(direction_order, direction_order + 4, g);
-    for (auto check_direction : direction_order) {
+    size_t num_remaining = 0;
+    for (auto check_direction : all_directions) {
       if (current_step.directions_remaining & check_direction) {
-        direction = check_direction;
-        break;
+        num_remaining++;
+      }
+    }
+    if (num_remaining) {
+      size_t which = rng() % num_remaining;
+      for (auto check_direction : all_directions) {
+        if ((current_step.directions_remaining & check_direction) &&
+            (which-- == 0)) {
+          direction = check_direction;
+          break;
+        }
       }
     }
 
@@ -141,9 +157,9 @@ vector<bool> generate_maze(uint64_t w, uint64_t h) {
     // add the new node to the stack
     uint8_t available_directions =
         ((dest_x == 0)     ? 0 : Impulse::Left) |
-        ((dest_x == w - 1) ? 0 : Impulse::Right) |
+        ((dest_x == max_x) ? 0 : Impulse::Right) |
         ((dest_y == 0)     ? 0 : Impulse::Up) |
-        ((dest_y == h - 1) ? 0 : Impulse::Down);
+        ((dest_y == max_y) ? 0 : Impulse::Down);
     steps.emplace_back(dest_x, dest_y, available_directions);
   }
 
@@ -1,4 +1,8 @@
+#pragma once
+
 #include <stdint.h>
 #include <vector>
 
-std::vector<bool> generate_maze(uint64_t w, uint64_t h);
+// generates a random maze with the given dimensions (which must be odd). the
+// same seed always produces the same maze
+std::vector<bool> generate_maze(uint64_t w, uint64_t h, uint64_t seed);
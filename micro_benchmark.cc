@@ -0,0 +1,562 @@
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "level.hh"
+#include "level_loader.hh"
+#include "maze.hh"
+
+using namespace std;
+
+
+// times the engine's primitives one at a time, on synthetic levels of various
+// sizes, block densities and monster counts, so a change to one hot path can
+// be measured (and a regression in it caught) without the noise of everything
+// else exec_frame does. each level is a grid of randomly-placed blocks (not a
+// maze) so the density can be anything; the player starts in the top-left
+// corner, which is always empty. the same seed always produces the same
+// levels and the same queries.
+
+// this is a friend of LevelState, so it can call the private primitives
+struct LevelStateMicroBenchmark {
+  static bool space_is_empty(const LevelState& level, int64_t x, int64_t y) {
+    return level.space_is_empty(x, y);
+  }
+
+  static int64_t find_block(const LevelState& level, int64_t x, int64_t y) {
+    return level.find_block(x, y);
+  }
+
+  static bool check_moving_collision(const LevelState& level, int64_t this_x,
+      int64_t this_y, int64_t this_x_speed, int64_t this_y_speed,
+      int64_t other_x, int64_t other_y) {
+    return level.check_moving_collision(this_x, this_y, this_x_speed,
+        this_y_speed, other_x, other_y);
+  }
+
+  static void apply_explosion(LevelState& level, size_t block_index) {
+    level.apply_explosion(level.blocks[block_index]);
+  }
+
+  static uint32_t match_lineup_formation(const LevelState& level,
+      int64_t x_cell, int64_t y_cell) {
+    return level.match_lineup_formation(x_cell, y_cell);
+  }
+};
+
+struct Configuration {
+  int64_t w_cells;
+  int64_t h_cells;
+  double density;
+  int64_t num_monsters;
+};
+
+static const int64_t grid_pitch = 48;
+
+// everything the benchmarks compute goes in here, so the compiler can't skip
+// computing it
+static volatile uint64_t sink = 0;
+
+static uint64_t now_nsecs() {
+  return chrono::duration_cast<chrono::nanoseconds>(
+      chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static vector<int64_t> parse_int_list(const char* s) {
+  vector<int64_t> ret;
+  for (;;) {
+    char* end;
+    ret.emplace_back(strtoll(s, &end, 0));
+    if (*end != ',') {
+      return ret;
+    }
+    s = end + 1;
+  }
+}
+
+static vector<double> parse_float_list(const char* s) {
+  vector<double> ret;
+  for (;;) {
+    char* end;
+    ret.emplace_back(strtod(s, &end));
+    if (*end != ',') {
+      return ret;
+    }
+    s = end + 1;
+  }
+}
+
+// sizes are given as WxH (in cells), separated by commas
+static vector<pair<int64_t, int64_t>> parse_size_list(const char* s) {
+  vector<pair<int64_t, int64_t>> ret;
+  for (;;) {
+    char* end;
+    int64_t w = strtoll(s, &end, 0);
+    if (*end != 'x') {
+      throw invalid_argument("sizes must be given as WxH");
+    }
+    int64_t h = strtoll(end + 1, &end, 0);
+    if (!(w & 1) || !(h & 1) || (w < 3) || (h < 3)) {
+      throw invalid_argument("level dimensions must be odd and at least 3");
+    }
+    ret.emplace_back(w, h);
+    if (*end != ',') {
+      return ret;
+    }
+    s = end + 1;
+  }
+}
+
+// if special isn't None, every block that doesn't become a monster gets it
+static LevelState::GenerationParameters params_for_configuration(
+    const Configuration& config, BlockSpecial special, uint64_t seed) {
+  LevelState::GenerationParameters params;
+  params.name = "micro";
+  params.grid_pitch = grid_pitch;
+  params.w = config.w_cells * grid_pitch;
+  params.h = config.h_cells * grid_pitch;
+  params.player_x = 0;
+  params.player_y = 0;
+  params.player_squishable = true;
+
+  mt19937_64 g(seed);
+  params.fixed_block_map = true;
+  params.block_map.resize(config.w_cells * config.h_cells);
+  int64_t num_blocks = 0;
+  for (size_t z = 1; z < params.block_map.size(); z++) {
+    params.block_map[z] = ((g() % 1000000) < config.density * 1000000);
+    num_blocks += params.block_map[z];
+  }
+
+  // the constructor turns blocks into monsters, so there can't be more
+  // monsters than blocks
+  if (num_blocks < config.num_monsters) {
+    throw invalid_argument("too many monsters for this size and density");
+  }
+  if (special != BlockSpecial::None) {
+    int64_t num_specials = num_blocks - config.num_monsters;
+    params.special_type_to_count.emplace(special,
+        make_pair(num_specials, num_specials));
+  }
+
+  params.basic_monster_count = make_pair(config.num_monsters,
+      config.num_monsters);
+  params.power_monster_count = make_pair(0, 0);
+  params.basic_monster_score = 100;
+  params.power_monster_score = 200;
+  params.basic_monster_movement_policy = Monster::MovementPolicy::Random;
+  params.power_monster_movement_policy = Monster::MovementPolicy::Random;
+  params.power_monsters_can_push = false;
+  params.power_monsters_become_creators = false;
+  params.player_move_speed = 6;
+  params.basic_monster_move_speed = 6;
+  params.power_monster_move_speed = 8;
+  params.push_speed = 8;
+  params.bomb_speed = 16;
+  params.bounce_speed_absorption = 2;
+  params.block_destroy_rate = 0.04;
+  return params;
+}
+
+static void print_header(bool json) {
+  if (!json) {
+    fprintf(stdout, "%-22s %7s %7s %8s %10s %12s  %s\n", "benchmark", "size",
+        "density", "monsters", "iterations", "nsec/op", "notes");
+  }
+}
+
+// notes_name and notes_value describe something about the work each operation
+// did (e.g. how many cells find_path expanded), if notes_name isn't NULL
+static void print_result(bool json, const char* name,
+    const Configuration& config, size_t iterations, uint64_t nsecs,
+    const char* notes_name = NULL, double notes_value = 0.0) {
+  double nsecs_per_op = iterations ? static_cast<double>(nsecs) / iterations : 0.0;
+  if (json) {
+    fprintf(stdout, "{\"benchmark\": \"%s\", \"w\": %" PRId64 ", \"h\": %" PRId64 ", "
+        "\"density\": %g, \"monsters\": %" PRId64 ", \"iterations\": %zu, "
+        "\"nsecs_per_op\": %.1f", name, config.w_cells, config.h_cells,
+        config.density, config.num_monsters, iterations, nsecs_per_op);
+    if (notes_name) {
+      fprintf(stdout, ", \"%s\": %.2f", notes_name, notes_value);
+    }
+    fputs("}\n", stdout);
+  } else {
+    string size_str = to_string(config.w_cells) + "x" + to_string(config.h_cells);
+    fprintf(stdout, "%-22s %7s %7.2f %8" PRId64 " %10zu %12.1f", name,
+        size_str.c_str(), config.density, config.num_monsters, iterations,
+        nsecs_per_op);
+    if (notes_name) {
+      fprintf(stdout, "  %.2f %s", notes_value, notes_name);
+    }
+    fputc('\n', stdout);
+  }
+}
+
+
+
+// these benchmarks depend only on the level's size
+
+static void benchmark_generate_maze(bool json, const Configuration& config,
+    size_t iterations, uint64_t seed) {
+  uint64_t start_nsecs = now_nsecs();
+  for (size_t x = 0; x < iterations; x++) {
+    sink += generate_maze(config.w_cells, config.h_cells, seed + x)[0];
+  }
+  print_result(json, "generate_maze", config, iterations,
+      now_nsecs() - start_nsecs);
+}
+
+static void benchmark_check_moving_collision(bool json,
+    const Configuration& config, const LevelState& level, size_t iterations,
+    mt19937_64& g) {
+  // the objects are at most two cells apart, so some of them collide
+  vector<int64_t> args(iterations * 6);
+  for (size_t x = 0; x < iterations; x++) {
+    int64_t* a = &args[x * 6];
+    a[0] = (g() % config.w_cells) * grid_pitch;
+    a[1] = (g() % config.h_cells) * grid_pitch;
+    a[2] = static_cast<int64_t>(g() % 3) * 8 - 8;
+    a[3] = (a[2] == 0) ? (static_cast<int64_t>(g() % 3) * 8 - 8) : 0;
+    a[4] = a[0] + static_cast<int64_t>(g() % (4 * grid_pitch)) - 2 * grid_pitch;
+    a[5] = a[1] + static_cast<int64_t>(g() % (4 * grid_pitch)) - 2 * grid_pitch;
+  }
+
+  uint64_t collisions = 0;
+  uint64_t start_nsecs = now_nsecs();
+  for (size_t x = 0; x < iterations; x++) {
+    const int64_t* a = &args[x * 6];
+    collisions += LevelStateMicroBenchmark::check_moving_collision(level, a[0],
+        a[1], a[2], a[3], a[4], a[5]);
+  }
+  uint64_t nsecs = now_nsecs() - start_nsecs;
+  sink += collisions;
+  print_result(json, "check_moving_collision", config, iterations, nsecs,
+      "hit rate", static_cast<double>(collisions) / iterations);
+}
+
+
+
+// these depend on where the blocks and monsters are
+
+static void benchmark_construct(bool json, const Configuration& config,
+    const LevelState::GenerationParameters& params, size_t iterations,
+    uint64_t seed) {
+  // this includes destroying the level, since that's part of what it costs
+  // to start a new one
+  uint64_t start_nsecs = now_nsecs();
+  for (size_t x = 0; x < iterations; x++) {
+    LevelState level(params, seed + x);
+    sink += level.get_blocks().size();
+  }
+  print_result(json, "construct", config, iterations,
+      now_nsecs() - start_nsecs);
+}
+
+static void benchmark_reset(bool json, const Configuration& config,
+    const LevelState::GenerationParameters& params, size_t iterations,
+    uint64_t seed) {
+  // this is the same as construct, but it reuses one level's memory and
+  // shares the parameters instead of copying them
+  auto shared_params = make_shared<const LevelState::GenerationParameters>(
+      params);
+  LevelState level(shared_params, seed);
+  uint64_t start_nsecs = now_nsecs();
+  for (size_t x = 0; x < iterations; x++) {
+    level.reset(shared_params, seed + x);
+    sink += level.get_blocks().size();
+  }
+  print_result(json, "reset", config, iterations, now_nsecs() - start_nsecs);
+}
+
+static void benchmark_new_attempt(bool json, const Configuration& config,
+    const LevelState::GenerationParameters& params, size_t iterations,
+    uint64_t seed) {
+  // this is what LevelBatch does when an episode ends: copy the level's
+  // parameters, generate a new maze for them, and reset the level. the mazes
+  // don't depend on the density, so this only varies with the size and the
+  // number of monsters
+  auto maze_params = params;
+  maze_params.fixed_block_map = false;
+  LevelState level(maze_params, seed);
+  uint64_t start_nsecs = now_nsecs();
+  for (size_t x = 0; x < iterations; x++) {
+    auto attempt_params = make_shared<LevelState::GenerationParameters>(
+        maze_params);
+    generate_random_elements(*attempt_params, seed + x);
+    level.reset(move(attempt_params), seed + x);
+    sink += level.get_blocks().size();
+  }
+  print_result(json, "new_attempt", config, iterations,
+      now_nsecs() - start_nsecs);
+}
+
+static void benchmark_space_is_empty(bool json, const Configuration& config,
+    const LevelState& level, size_t iterations, mt19937_64& g) {
+  // half the positions are aligned to the grid, and the rest are somewhere
+  // a moving object could be (a multiple of the movement speed)
+  vector<pair<int64_t, int64_t>> positions(iterations);
+  for (size_t x = 0; x < iterations; x++) {
+    int64_t px = (g() % config.w_cells) * grid_pitch;
+    int64_t py = (g() % config.h_cells) * grid_pitch;
+    if (x & 1) {
+      if (px + grid_pitch < config.w_cells * grid_pitch) {
+        px += (g() % (grid_pitch / 6)) * 6;
+      } else if (py + grid_pitch < config.h_cells * grid_pitch) {
+        py += (g() % (grid_pitch / 6)) * 6;
+      }
+    }
+    positions[x] = make_pair(px, py);
+  }
+
+  uint64_t num_empty = 0;
+  uint64_t start_nsecs = now_nsecs();
+  for (const auto& position : positions) {
+    num_empty += LevelStateMicroBenchmark::space_is_empty(level,
+        position.first, position.second);
+  }
+  uint64_t nsecs = now_nsecs() - start_nsecs;
+  sink += num_empty;
+  print_result(json, "space_is_empty", config, iterations, nsecs, "empty rate",
+      static_cast<double>(num_empty) / iterations);
+}
+
+static void benchmark_find_block(bool json, const Configuration& config,
+    const LevelState& level, size_t iterations, mt19937_64& g) {
+  vector<pair<int64_t, int64_t>> positions(iterations);
+  for (auto& position : positions) {
+    position = make_pair((g() % config.w_cells) * grid_pitch,
+        (g() % config.h_cells) * grid_pitch);
+  }
+
+  uint64_t num_found = 0;
+  uint64_t start_nsecs = now_nsecs();
+  for (const auto& position : positions) {
+    num_found += (LevelStateMicroBenchmark::find_block(level, position.first,
+        position.second) >= 0);
+  }
+  uint64_t nsecs = now_nsecs() - start_nsecs;
+  sink += num_found;
+  print_result(json, "find_block", config, iterations, nsecs, "hit rate",
+      static_cast<double>(num_found) / iterations);
+}
+
+static void benchmark_find_path(bool json, const Configuration& config,
+    const LevelState& level, size_t iterations, mt19937_64& g) {
+  // paths go between random empty cells, which may not be connected; those
+  // searches expand everything reachable from the start, like they would in
+  // the game
+  vector<pair<int64_t, int64_t>> empty_cells;
+  for (int64_t y = 0; y < config.h_cells; y++) {
+    for (int64_t x = 0; x < config.w_cells; x++) {
+      if (LevelStateMicroBenchmark::space_is_empty(level, x * grid_pitch,
+          y * grid_pitch)) {
+        empty_cells.emplace_back(x * grid_pitch, y * grid_pitch);
+      }
+    }
+  }
+  if (empty_cells.empty()) {
+    return;
+  }
+  vector<pair<size_t, size_t>> queries(iterations);
+  for (auto& query : queries) {
+    query = make_pair(g() % empty_cells.size(), g() % empty_cells.size());
+  }
+
+  uint64_t total_expansions = 0;
+  uint64_t start_nsecs = now_nsecs();
+  for (const auto& query : queries) {
+    const auto& from = empty_cells[query.first];
+    const auto& to = empty_cells[query.second];
+    size_t num_expansions;
+    sink += level.find_path(from.first, from.second, to.first, to.second, 0,
+        &num_expansions);
+    total_expansions += num_expansions;
+  }
+  uint64_t nsecs = now_nsecs() - start_nsecs;
+  print_result(json, "find_path", config, iterations, nsecs, "expansions",
+      static_cast<double>(total_expansions) / iterations);
+}
+
+static void benchmark_apply_explosion(bool json, const Configuration& config,
+    const LevelState& bomb_level, size_t iterations, mt19937_64& g) {
+  // every block in bomb_level is a bomb. each iteration sets off one of them
+  // in a fresh copy of the level; copying the level isn't timed. a bomb that
+  // can't be pushed is destroyed instead, which sets it off too, so in dense
+  // levels one call can set off many bombs
+  if (bomb_level.get_blocks().size() == 0) {
+    return;
+  }
+  LevelState level = bomb_level;
+  uint64_t nsecs = 0;
+  uint64_t explosions = 0;
+  for (size_t x = 0; x < iterations; x++) {
+    level = bomb_level;
+    size_t block_index = g() % level.get_blocks().size();
+    uint64_t start_nsecs = now_nsecs();
+    LevelStateMicroBenchmark::apply_explosion(level, block_index);
+    nsecs += now_nsecs() - start_nsecs;
+    explosions += level.get_explosions().size();
+  }
+  sink += explosions;
+  print_result(json, "apply_explosion", config, iterations, nsecs,
+      "explosion effects", static_cast<double>(explosions) / iterations);
+}
+
+static void benchmark_explosion_chain(bool json, const Configuration& config,
+    const LevelState& bomb_level, size_t iterations, mt19937_64& g) {
+  // sets off one bomb, then runs the level for two seconds, during which the
+  // pushed bombs hit other blocks and explode too. the time is per chain, and
+  // includes everything else that happens in those frames
+  static const size_t chain_frames = 60;
+  if (bomb_level.get_blocks().size() == 0) {
+    return;
+  }
+  LevelState level = bomb_level;
+  uint64_t nsecs = 0;
+  uint64_t blocks_destroyed = 0;
+  for (size_t x = 0; x < iterations; x++) {
+    level = bomb_level;
+    size_t block_index = g() % level.get_blocks().size();
+    uint64_t start_nsecs = now_nsecs();
+    LevelStateMicroBenchmark::apply_explosion(level, block_index);
+    for (size_t frame = 0; frame < chain_frames; frame++) {
+      level.exec_frame(Impulse::None);
+    }
+    nsecs += now_nsecs() - start_nsecs;
+    blocks_destroyed += bomb_level.get_blocks().size() - level.get_blocks().size();
+  }
+  sink += blocks_destroyed;
+  print_result(json, "explosion_chain", config, iterations, nsecs,
+      "blocks destroyed", static_cast<double>(blocks_destroyed) / iterations);
+}
+
+
+static void benchmark_lineup_match(bool json, const Configuration& config,
+    const LevelState& lineup_level, size_t iterations, mt19937_64& g) {
+  // every block in lineup_level is a LineUp, and each query is one of them,
+  // as if it had just stopped there
+  const auto& blocks = lineup_level.get_blocks();
+  if (blocks.size() == 0) {
+    return;
+  }
+  vector<pair<int64_t, int64_t>> cells(iterations);
+  for (auto& cell : cells) {
+    auto block = blocks[g() % blocks.size()];
+    cell = make_pair(block.x() / grid_pitch, block.y() / grid_pitch);
+  }
+
+  uint64_t num_matched = 0;
+  uint64_t start_nsecs = now_nsecs();
+  for (const auto& cell : cells) {
+    num_matched += (LevelStateMicroBenchmark::match_lineup_formation(
+        lineup_level, cell.first, cell.second) != 0);
+  }
+  uint64_t nsecs = now_nsecs() - start_nsecs;
+  sink += num_matched;
+  print_result(json, "lineup_match", config, iterations, nsecs, "match rate",
+      static_cast<double>(num_matched) / iterations);
+}
+
+
+
+static void print_usage(const char* argv0) {
+  fprintf(stderr, "\
+Usage: %s [options]\n\
+\n\
+Runs each benchmark on every combination of the given sizes, densities and\n\
+monster counts.\n\
+\n\
+Options:\n\
+  --sizes=WxH,...: level sizes in cells; both must be odd\n\
+      (default 23x19,47x39,95x79)\n\
+  --densities=D,...: fraction of cells that start with a block\n\
+      (default 0.25,0.5,0.75)\n\
+  --monsters=N,...: number of monsters, not counting the player\n\
+      (default 4,16,64)\n\
+  --iterations=N: number of calls to time for the cheap benchmarks; the\n\
+      expensive ones (construct, reset, new_attempt, generate_maze,\n\
+      find_path and the explosion benchmarks) use 1/100 as many\n\
+      (default 100000)\n\
+  --seed=N: generate levels and queries from this seed (default 1)\n\
+  --json: print one JSON object per line instead of a table\n\
+", argv0);
+}
+
+int main(int argc, char* argv[]) {
+  vector<pair<int64_t, int64_t>> sizes = {{23, 19}, {47, 39}, {95, 79}};
+  vector<double> densities = {0.25, 0.5, 0.75};
+  vector<int64_t> monster_counts = {4, 16, 64};
+  size_t iterations = 100000;
+  uint64_t seed = 1;
+  bool json = false;
+  for (int x = 1; x < argc; x++) {
+    if (!strncmp(argv[x], "--sizes=", 8)) {
+      sizes = parse_size_list(&argv[x][8]);
+    } else if (!strncmp(argv[x], "--densities=", 12)) {
+      densities = parse_float_list(&argv[x][12]);
+    } else if (!strncmp(argv[x], "--monsters=", 11)) {
+      monster_counts = parse_int_list(&argv[x][11]);
+    } else if (!strncmp(argv[x], "--iterations=", 13)) {
+      iterations = strtoull(&argv[x][13], NULL, 0);
+    } else if (!strncmp(argv[x], "--seed=", 7)) {
+      seed = strtoull(&argv[x][7], NULL, 0);
+    } else if (!strcmp(argv[x], "--json")) {
+      json = true;
+    } else if (!strcmp(argv[x], "--help")) {
+      print_usage(argv[0]);
+      return 0;
+    } else {
+      print_usage(argv[0]);
+      throw invalid_argument("unknown command-line option");
+    }
+  }
+  size_t expensive_iterations = (iterations >= 100) ? (iterations / 100) : 1;
+
+  print_header(json);
+  for (const auto& size : sizes) {
+    Configuration size_config = {size.first, size.second, 0.0, 0};
+    benchmark_generate_maze(json, size_config, expensive_iterations, seed);
+
+    for (double density : densities) {
+      for (int64_t num_monsters : monster_counts) {
+        Configuration config = {size.first, size.second, density, num_monsters};
+        mt19937_64 g(seed);
+
+        auto params = params_for_configuration(config, BlockSpecial::None,
+            seed);
+        auto bomb_params = params_for_configuration(config, BlockSpecial::Bomb,
+            seed);
+        auto lineup_params = params_for_configuration(config,
+            BlockSpecial::LineUp, seed);
+        LevelState level(params, seed);
+        LevelState bomb_level(bomb_params, seed);
+        LevelState lineup_level(lineup_params, seed);
+
+        benchmark_check_moving_collision(json, config, level, iterations, g);
+        benchmark_construct(json, config, params, expensive_iterations, seed);
+        benchmark_reset(json, config, params, expensive_iterations, seed);
+        benchmark_new_attempt(json, config, params, expensive_iterations,
+            seed);
+        benchmark_space_is_empty(json, config, level, iterations, g);
+        benchmark_find_block(json, config, level, iterations, g);
+        benchmark_find_path(json, config, level, expensive_iterations, g);
+        benchmark_apply_explosion(json, config, bomb_level,
+            expensive_iterations, g);
+        benchmark_explosion_chain(json, config, bomb_level,
+            expensive_iterations, g);
+        benchmark_lineup_match(json, config, lineup_level, iterations, g);
+      }
+    }
+  }
+
+  return 0;
+}
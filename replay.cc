@@ -0,0 +1,235 @@
+#include "replay.hh"
+
+#include <inttypes.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <phosg/Filesystem.hh>
+#include <phosg/Strings.hh>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "level.hh"
+#include "level_loader.hh"
+#include "serialization.hh"
+
+using namespace std;
+
+
+static const char replay_magic[4] = {'T', 'R', 'P', 'L'};
+static const uint64_t replay_format_version = 4;
+
+
+
+const int64_t Replay::default_keyframe_interval;
+
+Replay::Replay() : Replay(0, 0, 0, 0) { }
+
+Replay::Replay(int64_t level_index, uint64_t elements_seed,
+    uint64_t level_seed, uint64_t params_hash) : level_index(level_index),
+    elements_seed(elements_seed), level_seed(level_seed),
+    params_hash(params_hash), initial_bitboard_hash(0), num_frames(0),
+    keyframe_interval(default_keyframe_interval) { }
+
+void Replay::add_frame(const LevelState& level, uint64_t impulse) {
+  if (level.get_frames_executed() != this->num_frames) {
+    throw invalid_argument("level is not at the replay's next frame");
+  }
+  if (this->num_frames == 0) {
+    this->initial_bitboard_hash = level.hash_bitboards();
+  }
+  if ((this->keyframe_interval > 0) && (this->num_frames > 0) &&
+      ((this->num_frames % this->keyframe_interval) == 0)) {
+    this->keyframes.emplace_back();
+    this->keyframes.back().frame = this->num_frames;
+    this->keyframes.back().state = level.serialize_state();
+  }
+
+  if (!this->impulse_runs.empty() &&
+      (this->impulse_runs.back().first == impulse)) {
+    this->impulse_runs.back().second++;
+  } else {
+    this->impulse_runs.emplace_back(impulse, 1);
+  }
+  this->num_frames++;
+}
+
+string Replay::serialize() const {
+  BinaryWriter w;
+  w.put_bytes(replay_magic, sizeof(replay_magic));
+  w.put_varint(replay_format_version);
+  w.put_varint(this->level_index);
+  w.put_u64(this->elements_seed);
+  w.put_u64(this->level_seed);
+  w.put_u64(this->params_hash);
+  w.put_u64(this->initial_bitboard_hash);
+  w.put_varint(this->num_frames);
+  w.put_varint(this->impulse_runs.size());
+  for (const auto& run : this->impulse_runs) {
+    w.put_varint(run.first);
+    w.put_varint(run.second);
+  }
+  w.put_varint(this->keyframes.size());
+  for (const auto& keyframe : this->keyframes) {
+    w.put_varint(keyframe.frame);
+    w.put_string(keyframe.state);
+  }
+  return w.release();
+}
+
+Replay Replay::parse(const string& data) {
+  if ((data.size() < sizeof(replay_magic)) ||
+      data.compare(0, sizeof(replay_magic), replay_magic, sizeof(replay_magic))) {
+    throw runtime_error("data is not a replay");
+  }
+  BinaryReader r(data, sizeof(replay_magic));
+
+  uint64_t version = r.get_varint();
+  if (version != replay_format_version) {
+    throw runtime_error(string_printf(
+        "replay format version %" PRIu64 " is not supported", version));
+  }
+
+  Replay ret;
+  ret.level_index = r.get_varint();
+  ret.elements_seed = r.get_u64();
+  ret.level_seed = r.get_u64();
+  ret.params_hash = r.get_u64();
+  ret.initial_bitboard_hash = r.get_u64();
+  int64_t num_frames = r.get_varint();
+  uint64_t num_runs = r.get_varint();
+  for (uint64_t x = 0; x < num_runs; x++) {
+    uint64_t impulse = r.get_varint();
+    uint64_t count = r.get_varint();
+    if (count == 0) {
+      throw runtime_error("replay contains an empty run");
+    }
+    ret.impulse_runs.emplace_back(impulse, count);
+    ret.num_frames += count;
+  }
+  if (ret.num_frames != num_frames) {
+    throw runtime_error("replay frame count does not match its impulses");
+  }
+
+  uint64_t num_keyframes = r.get_varint();
+  for (uint64_t x = 0; x < num_keyframes; x++) {
+    int64_t frame = r.get_varint();
+    if ((frame <= (ret.keyframes.empty() ? 0 : ret.keyframes.back().frame)) ||
+        (frame > ret.num_frames)) {
+      throw runtime_error("replay keyframes are out of order");
+    }
+    ret.keyframes.emplace_back();
+    ret.keyframes.back().frame = frame;
+    ret.keyframes.back().state = r.get_string();
+  }
+
+  if (!r.done()) {
+    throw runtime_error("replay has extra data at the end");
+  }
+  return ret;
+}
+
+void Replay::save(const string& filename) const {
+  save_file(filename, this->serialize());
+}
+
+Replay Replay::load(const string& filename) {
+  return Replay::parse(load_file(filename));
+}
+
+LevelState Replay::create_level(
+    const vector<LevelState::GenerationParameters>& all_params) const {
+  if ((this->level_index < 0) ||
+      (this->level_index >= static_cast<int64_t>(all_params.size()))) {
+    throw invalid_argument("replay's level does not exist");
+  }
+  auto params = all_params[this->level_index];
+  generate_random_elements(params, this->elements_seed);
+  if (params.hash() != this->params_hash) {
+    throw invalid_argument("replay's level has changed since it was recorded");
+  }
+  LevelState level(params, this->level_seed);
+  if (this->num_frames &&
+      (level.hash_bitboards() != this->initial_bitboard_hash)) {
+    throw invalid_argument(
+        "replay's level was generated differently when it was recorded");
+  }
+  return level;
+}
+
+void Replay::play(LevelState& level, int64_t end_frame) const {
+  if ((end_frame < 0) || (end_frame > this->num_frames)) {
+    end_frame = this->num_frames;
+  }
+  ReplayReader reader(*this, level.get_frames_executed());
+  while (reader.get_frame() < end_frame) {
+    level.exec_frame(reader.next());
+  }
+}
+
+void Replay::seek(LevelState& level, int64_t frame) const {
+  if ((frame < 0) || (frame > this->num_frames)) {
+    throw out_of_range("seek frame is not in the replay");
+  }
+
+  // find the last keyframe at or before the target. if the level is already
+  // between it and the target, it's faster to keep going from there
+  auto keyframe_it = upper_bound(this->keyframes.begin(), this->keyframes.end(),
+      frame, [](int64_t frame, const Keyframe& keyframe) {
+        return frame < keyframe.frame;
+      });
+  int64_t start_frame = (keyframe_it == this->keyframes.begin()) ? 0 :
+      (keyframe_it - 1)->frame;
+  int64_t current_frame = level.get_frames_executed();
+  if ((current_frame > frame) || (current_frame < start_frame)) {
+    if (keyframe_it == this->keyframes.begin()) {
+      // the level's parameters are the ones it was created with, so this is
+      // the same as calling create_level again
+      level = LevelState(level.get_params(), this->level_seed);
+    } else {
+      level.restore_state((keyframe_it - 1)->state);
+    }
+  }
+  this->play(level, frame);
+}
+
+
+
+ReplayReader::ReplayReader(const Replay& replay, int64_t start_frame) :
+    replay(replay), frame(0), run_index(0), frames_into_run(0) {
+  if ((start_frame < 0) || (start_frame > replay.num_frames)) {
+    throw out_of_range("start frame is not in the replay");
+  }
+
+  // skip whole runs until we get to the one containing start_frame
+  while ((this->run_index < this->replay.impulse_runs.size()) &&
+      (this->frame + static_cast<int64_t>(this->replay.impulse_runs[this->run_index].second) <= start_frame)) {
+    this->frame += this->replay.impulse_runs[this->run_index].second;
+    this->run_index++;
+  }
+  this->frames_into_run = start_frame - this->frame;
+  this->frame = start_frame;
+}
+
+bool ReplayReader::done() const {
+  return this->frame >= this->replay.num_frames;
+}
+
+int64_t ReplayReader::get_frame() const {
+  return this->frame;
+}
+
+uint64_t ReplayReader::next() {
+  if (this->done()) {
+    throw out_of_range("replay has no more frames");
+  }
+  const auto& run = this->replay.impulse_runs[this->run_index];
+  uint64_t impulse = run.first;
+  this->frame++;
+  if (++this->frames_into_run >= run.second) {
+    this->run_index++;
+    this->frames_into_run = 0;
+  }
+  return impulse;
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "level.hh"
+
+// a recording of one attempt at a level. levels are deterministic, so this is
+// just what's needed to create the same level again (which level it was and
+// the two seeds it was generated with) and the player's impulse on every
+// frame. the impulses are run-length encoded, since players hold the same keys
+// for many frames at a time; recording a frame is usually just incrementing a
+// counter.
+//
+// a replay can also contain keyframes: the level's full state (see
+// LevelState::serialize_state) before every keyframe_interval-th frame. they
+// make seeking cheap, since seek only has to restore the closest keyframe
+// before the target frame and execute the frames after it, instead of
+// executing every frame from the beginning. they're much bigger than the
+// impulses, so the interval is long; the default is 30 seconds of game time.
+//
+// the file format is a header followed by the impulse runs and the keyframes,
+// with all integers as varints (7 bits per byte, low bits first) except the
+// seeds and the hashes:
+//   "TRPL" magic
+//   varint format version (4; older versions can't be loaded. before version
+//       3, levels placed their block specials in an order that depended on
+//       the standard library, so they can't be recreated reliably, and before
+//       version 4, keyframes saved the level's RNG in a form that depended on
+//       the standard library too)
+//   varint level index
+//   uint64 elements seed, level seed, parameters hash, initial bitboard hash
+//       (little-endian)
+//   varint number of frames
+//   varint number of runs, then each run as (varint impulse, varint count)
+//   varint number of keyframes, then each keyframe as (varint frame, varint
+//       state size, state)
+struct Replay {
+  int64_t level_index;
+  // the seed passed to generate_random_elements, then the one passed to the
+  // LevelState constructor
+  uint64_t elements_seed;
+  uint64_t level_seed;
+  // GenerationParameters::hash() of the parameters the level was created
+  // with, after generate_random_elements
+  uint64_t params_hash;
+  // LevelState::hash_bitboards() of the level before its first frame, so
+  // create_level can tell if the level it makes isn't the one that was
+  // recorded (the parameters can be the same, but the level generated from
+  // them different, e.g. if generation changes). add_frame records this when
+  // it records the first frame
+  uint64_t initial_bitboard_hash;
+
+  // each run is an impulse and the number of consecutive frames it was used
+  // for. consecutive runs never have the same impulse
+  std::vector<std::pair<uint64_t, uint64_t>> impulse_runs;
+  int64_t num_frames;
+
+  // the level's state before the given frame, sorted by frame. there's never
+  // one for frame 0, since that state is just the newly-created level
+  struct Keyframe {
+    int64_t frame;
+    std::string state;
+  };
+  std::vector<Keyframe> keyframes;
+
+  // add_frame records a keyframe before every frame that's a multiple of this
+  // (0 means it never does). this isn't saved in the file
+  int64_t keyframe_interval;
+  static const int64_t default_keyframe_interval = 900;
+
+  Replay();
+  Replay(int64_t level_index, uint64_t elements_seed, uint64_t level_seed,
+      uint64_t params_hash);
+
+  // records the impulse for the next frame. call this before executing the
+  // frame, since a keyframe (if one is due) saves the level as it is now.
+  // throws invalid_argument if the level isn't at the replay's next frame
+  void add_frame(const LevelState& level, uint64_t impulse);
+
+  std::string serialize() const;
+  // throws runtime_error if the data isn't a valid replay
+  static Replay parse(const std::string& data);
+  void save(const std::string& filename) const;
+  static Replay load(const std::string& filename);
+
+  // creates the level that the replay was recorded on, as it was before the
+  // first frame. all_params is the level list (from load_generation_params);
+  // throws invalid_argument if the level doesn't exist, or if its parameters
+  // or the level generated from them have changed since the replay was
+  // recorded
+  LevelState create_level(
+      const std::vector<LevelState::GenerationParameters>& all_params) const;
+
+  // executes the replay's frames on a level created by create_level, starting
+  // from whichever frame it's at, until it has executed end_frame frames (or
+  // the whole replay, if end_frame is -1)
+  void play(LevelState& level, int64_t end_frame = -1) const;
+
+  // brings a level created by create_level to the state it was in before the
+  // given frame (so it has executed exactly that many frames), from whichever
+  // frame it's at. if the level is already between the target and the closest
+  // keyframe before it, this just plays forward; otherwise it restores that
+  // keyframe (or recreates the level, if there isn't one) first. throws
+  // out_of_range if the frame isn't in the replay
+  void seek(LevelState& level, int64_t frame) const;
+};
+
+// reads the impulses from a replay one frame at a time, without having to go
+// through all the runs before the current one for every frame
+class ReplayReader {
+public:
+  explicit ReplayReader(const Replay& replay, int64_t start_frame = 0);
+
+  // returns true if there are no more frames
+  bool done() const;
+  // returns the frame that next() will return the impulse for
+  int64_t get_frame() const;
+  // returns the impulse for the current frame and moves to the next one
+  uint64_t next();
+
+private:
+  const Replay& replay;
+  int64_t frame;
+  size_t run_index;
+  uint64_t frames_into_run;
+};
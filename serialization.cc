@@ -0,0 +1,107 @@
+#include "serialization.hh"
+
+#include <stdint.h>
+#include <string.h>
+
+#include <stdexcept>
+#include <string>
+
+using namespace std;
+
+
+void BinaryWriter::put_u8(uint8_t value) {
+  this->contents.push_back(static_cast<char>(value));
+}
+
+void BinaryWriter::put_varint(uint64_t value) {
+  while (value >= 0x80) {
+    this->contents.push_back(static_cast<char>((value & 0x7F) | 0x80));
+    value >>= 7;
+  }
+  this->contents.push_back(static_cast<char>(value));
+}
+
+void BinaryWriter::put_u64(uint64_t value) {
+  for (size_t x = 0; x < 8; x++) {
+    this->contents.push_back(static_cast<char>(value >> (x * 8)));
+  }
+}
+
+void BinaryWriter::put_bytes(const void* data, size_t size) {
+  this->contents.append(reinterpret_cast<const char*>(data), size);
+}
+
+void BinaryWriter::put_string(const string& value) {
+  this->put_varint(value.size());
+  this->contents.append(value);
+}
+
+const string& BinaryWriter::data() const {
+  return this->contents;
+}
+
+string BinaryWriter::release() {
+  string ret = move(this->contents);
+  this->contents.clear();
+  return ret;
+}
+
+
+
+BinaryReader::BinaryReader(const string& data, size_t offset) :
+    contents(data), offset(offset) { }
+
+bool BinaryReader::done() const {
+  return this->offset >= this->contents.size();
+}
+
+size_t BinaryReader::remaining() const {
+  return this->done() ? 0 : (this->contents.size() - this->offset);
+}
+
+uint8_t BinaryReader::get_u8() {
+  if (this->offset >= this->contents.size()) {
+    throw runtime_error("data is truncated");
+  }
+  return static_cast<uint8_t>(this->contents[this->offset++]);
+}
+
+uint64_t BinaryReader::get_varint() {
+  uint64_t ret = 0;
+  for (size_t shift = 0; shift < 64; shift += 7) {
+    uint8_t byte = this->get_u8();
+    ret |= static_cast<uint64_t>(byte & 0x7F) << shift;
+    if (!(byte & 0x80)) {
+      return ret;
+    }
+  }
+  throw runtime_error("data contains an invalid varint");
+}
+
+uint64_t BinaryReader::get_u64() {
+  uint64_t ret = 0;
+  for (size_t x = 0; x < 8; x++) {
+    ret |= static_cast<uint64_t>(this->get_u8()) << (x * 8);
+  }
+  return ret;
+}
+
+void BinaryReader::get_bytes(void* data, size_t size) {
+  if (size > this->remaining()) {
+    throw runtime_error("data is truncated");
+  }
+  if (size) {
+    memcpy(data, this->contents.data() + this->offset, size);
+  }
+  this->offset += size;
+}
+
+string BinaryReader::get_string() {
+  uint64_t size = this->get_varint();
+  if (size > this->remaining()) {
+    throw runtime_error("data is truncated");
+  }
+  string ret = this->contents.substr(this->offset, size);
+  this->offset += size;
+  return ret;
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// helpers for the engine's binary formats (replays and saved level states).
+// integers are written as varints (7 bits per byte, low bits first), except
+// the ones written with put_u64, which are 8 little-endian bytes. vectors of
+// plain values are written as a varint count followed by their raw bytes, so
+// those are only readable on machines with the same byte order and float
+// format as the one that wrote them
+
+class BinaryWriter {
+public:
+  BinaryWriter() = default;
+
+  void put_u8(uint8_t value);
+  void put_varint(uint64_t value);
+  void put_u64(uint64_t value);
+  void put_bytes(const void* data, size_t size);
+  // writes the string's size as a varint, then its contents
+  void put_string(const std::string& value);
+
+  // writes a single value's raw bytes
+  template <typename T>
+  void put_value(const T& value) {
+    static_assert(std::is_trivially_copyable<T>::value,
+        "only plain values can be written directly");
+    this->put_bytes(&value, sizeof(T));
+  }
+
+  template <typename T>
+  void put_vector(const std::vector<T>& values) {
+    static_assert(std::is_trivially_copyable<T>::value,
+        "only vectors of plain values can be written directly");
+    this->put_varint(values.size());
+    this->put_bytes(values.data(), values.size() * sizeof(T));
+  }
+
+  // pairs aren't trivially copyable, so they're written one member at a time
+  template <typename A, typename B>
+  void put_vector(const std::vector<std::pair<A, B>>& values) {
+    this->put_varint(values.size());
+    for (const auto& value : values) {
+      this->put_value(value.first);
+      this->put_value(value.second);
+    }
+  }
+
+  const std::string& data() const;
+  // returns the written data, leaving the writer empty
+  std::string release();
+
+private:
+  std::string contents;
+};
+
+// reads data written by BinaryWriter. all the get_ functions throw
+// runtime_error if there isn't enough data left
+class BinaryReader {
+public:
+  explicit BinaryReader(const std::string& data, size_t offset = 0);
+
+  bool done() const;
+  size_t remaining() const;
+
+  uint8_t get_u8();
+  uint64_t get_varint();
+  uint64_t get_u64();
+  void get_bytes(void* data, size_t size);
+  std::string get_string();
+
+  template <typename T>
+  T get_value() {
+    static_assert(std::is_trivially_copyable<T>::value,
+        "only plain values can be read directly");
+    T ret;
+    this->get_bytes(&ret, sizeof(T));
+    return ret;
+  }
+
+  template <typename T>
+  void get_vector(std::vector<T>& values) {
+    static_assert(std::is_trivially_copyable<T>::value,
+        "only vectors of plain values can be read directly");
+    uint64_t count = this->get_varint();
+    if (count > this->remaining() / sizeof(T)) {
+      throw std::runtime_error("data is truncated");
+    }
+    values.resize(count);
+    this->get_bytes(values.data(), count * sizeof(T));
+  }
+
+  template <typename A, typename B>
+  void get_vector(std::vector<std::pair<A, B>>& values) {
+    uint64_t count = this->get_varint();
+    if (count > this->remaining() / (sizeof(A) + sizeof(B))) {
+      throw std::runtime_error("data is truncated");
+    }
+    values.resize(count);
+    for (auto& value : values) {
+      value.first = this->get_value<A>();
+      value.second = this->get_value<B>();
+    }
+  }
+
+private:
+  const std::string& contents;
+  size_t offset;
+};
@@ -0,0 +1,82 @@
+#include "snapshot_ring.hh"
+
+#include <stdint.h>
+
+#include <stdexcept>
+#include <vector>
+
+#include "level.hh"
+
+using namespace std;
+
+
+SnapshotRing::SnapshotRing(const LevelState& initial_state, size_t capacity) :
+    snapshots(capacity, initial_state), slot_frames(capacity, -1) {
+  if (capacity == 0) {
+    throw invalid_argument("snapshot ring must have at least one slot");
+  }
+}
+
+size_t SnapshotRing::capacity() const {
+  return this->snapshots.size();
+}
+
+void SnapshotRing::save(const LevelState& state) {
+  int64_t frame = state.get_frames_executed();
+  for (auto& slot_frame : this->slot_frames) {
+    if (slot_frame > frame) {
+      slot_frame = -1;
+    }
+  }
+
+  size_t slot = frame % this->snapshots.size();
+  this->snapshots[slot] = state;
+  this->slot_frames[slot] = frame;
+}
+
+bool SnapshotRing::has_frame(int64_t frame) const {
+  return (frame >= 0) &&
+      (this->slot_frames[frame % this->slot_frames.size()] == frame);
+}
+
+int64_t SnapshotRing::oldest_frame() const {
+  int64_t ret = -1;
+  for (int64_t slot_frame : this->slot_frames) {
+    if ((slot_frame >= 0) && ((ret < 0) || (slot_frame < ret))) {
+      ret = slot_frame;
+    }
+  }
+  return ret;
+}
+
+int64_t SnapshotRing::newest_frame() const {
+  int64_t ret = -1;
+  for (int64_t slot_frame : this->slot_frames) {
+    if (slot_frame > ret) {
+      ret = slot_frame;
+    }
+  }
+  return ret;
+}
+
+void SnapshotRing::restore(int64_t frame, LevelState& state) const {
+  if (!this->has_frame(frame)) {
+    throw out_of_range("frame is not in the snapshot ring");
+  }
+  state = this->snapshots[frame % this->snapshots.size()];
+}
+
+void SnapshotRing::resimulate(int64_t frame, LevelState& state,
+    const int64_t* impulses, size_t num_frames) {
+  this->restore(frame, state);
+  for (size_t x = 0; x < num_frames; x++) {
+    state.exec_frame(impulses[x]);
+    this->save(state);
+  }
+}
+
+void SnapshotRing::clear() {
+  for (auto& slot_frame : this->slot_frames) {
+    slot_frame = -1;
+  }
+}
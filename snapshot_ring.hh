@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "level.hh"
+
+// keeps copies of a level's state from its most recent frames, so the game
+// can be rewound (e.g. to undo a mistake, or to roll back and replay frames
+// when late inputs arrive over the network). a snapshot includes everything
+// that affects future frames, including the random number generator, so
+// restoring one and executing the same impulses again gives the same results.
+//
+// all the snapshots are allocated up front; saving one assigns over an old
+// snapshot, which reuses its memory, so saving and restoring are about as
+// fast as copying a LevelState can be.
+class SnapshotRing {
+public:
+  // capacity is the number of frames that can be rewound. all the snapshots
+  // start out as copies of initial_state, but none of them count as saved
+  SnapshotRing(const LevelState& initial_state, size_t capacity);
+  SnapshotRing(const SnapshotRing&) = delete;
+  SnapshotRing(SnapshotRing&&) = delete;
+  SnapshotRing& operator=(const SnapshotRing&) = delete;
+  SnapshotRing& operator=(SnapshotRing&&) = delete;
+  ~SnapshotRing() = default;
+
+  size_t capacity() const;
+
+  // saves a snapshot of the given state under its current frame number (the
+  // number of frames it has executed). if the ring is full, this replaces the
+  // oldest snapshot. saving a frame also discards any snapshots of later
+  // frames, since they came from a different future
+  void save(const LevelState& state);
+
+  // returns true if there's a snapshot for the given frame
+  bool has_frame(int64_t frame) const;
+  // returns the earliest and latest saved frames, or -1 if nothing is saved
+  int64_t oldest_frame() const;
+  int64_t newest_frame() const;
+
+  // replaces state with the snapshot from the given frame. throws
+  // out_of_range if that frame isn't saved. this doesn't discard any
+  // snapshots; the ones after frame are discarded when the next frame is
+  // saved
+  void restore(int64_t frame, LevelState& state) const;
+
+  // restores state to the given frame, then executes num_frames frames with
+  // the given impulses, saving a snapshot after each one. this is how a
+  // rollback works: the frames after frame are executed again with
+  // different impulses
+  void resimulate(int64_t frame, LevelState& state, const int64_t* impulses,
+      size_t num_frames);
+
+  // forgets all saved snapshots (but keeps their memory)
+  void clear();
+
+private:
+  // the snapshot for frame f is in slot (f % capacity); slot_frames says
+  // which frame each slot holds, or -1 if it's empty
+  std::vector<LevelState> snapshots;
+  std::vector<int64_t> slot_frames;
+};
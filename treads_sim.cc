@@ -0,0 +1,253 @@
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <phosg/Time.hh>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "level.hh"
+#include "level_loader.hh"
+#include "replay.hh"
+
+using namespace std;
+
+
+// plays levels from levels.json without a window or an audio device, so the
+// engine can run on servers. this only links against libtreads_core (and
+// phosg), never against GLFW, OpenGL, OpenAL or the macOS frameworks.
+//
+// each level is played until the player clears it, the player dies, or the
+// frame limit runs out, and the result is printed as one line per level. the
+// player's inputs come from the chosen policy; the same seed always produces
+// the same levels and the same inputs, so the final state hashes from two
+// builds should match unless the engine's behavior changed. each level is
+// validated when it's created, and in builds with VALIDATE=1, after every
+// frame too.
+//
+// it can also record what it plays as replays (see replay.hh), and play back
+// replays recorded here or by the game, as fast as it can. with --seek, it
+// jumps to a frame in the replay using its keyframes instead of playing the
+// whole thing, which is how the game's replay viewer scrubs.
+
+enum class Policy {
+  Idle,
+  Random,
+};
+
+static Policy policy_for_name(const char* name) {
+  if (!strcmp(name, "idle")) {
+    return Policy::Idle;
+  } else if (!strcmp(name, "random")) {
+    return Policy::Random;
+  }
+  throw invalid_argument("unknown policy");
+}
+
+static uint64_t random_impulse(mt19937& g) {
+  static const uint64_t directions[] = {Impulse::None, Impulse::Left,
+      Impulse::Right, Impulse::Up, Impulse::Down};
+  uint64_t impulse = directions[g() % 5];
+  if ((g() % 4) == 0) {
+    impulse |= Impulse::Push;
+  }
+  return impulse;
+}
+
+// adds the points and lives the player earned on this frame
+static void add_player_scores(const LevelState& game,
+    const LevelState::FrameEvents& events, int64_t* score, int64_t* lives) {
+  const auto& monsters = game.get_monsters();
+  for (const auto& score_info : events.scores) {
+    int64_t monster_index = monsters.index_for_handle(score_info.monster);
+    if ((monster_index >= 0) &&
+        monsters[monster_index].has_flags(Monster::Flag::IsPlayer)) {
+      *score += score_info.score;
+      *lives += score_info.lives;
+    }
+  }
+}
+
+static void print_result_header() {
+  fprintf(stdout, "%5s %-24s %-8s %7s %7s %6s %9s %18s %10s\n", "level",
+      "name", "result", "frames", "score", "lives", "monsters", "bitboard hash",
+      "usec");
+}
+
+static void print_result(int64_t level_index, const LevelState& game,
+    const char* result, int64_t score, int64_t lives, uint64_t usecs) {
+  int64_t monsters_alive = 0;
+  for (const auto& monster : game.get_monsters()) {
+    monsters_alive += (monster.death_frame() < 0) &&
+        !monster.has_flags(Monster::Flag::IsPlayer);
+  }
+
+  fprintf(stdout, "%5" PRId64 " %-24s %-8s %7" PRId64 " %7" PRId64 " %6" PRId64 " %9" PRId64 "   %016" PRIX64 " %10" PRIu64 "\n",
+      level_index, game.get_params().name.c_str(), result,
+      game.get_frames_executed(), score, lives, monsters_alive,
+      game.hash_bitboards(), usecs);
+}
+
+// plays a replay from start to finish. unlike the policies, a replay doesn't
+// stop when the player dies or the level is cleared, since the game keeps
+// running for a few frames after that, and the replay includes them. if
+// seek_frame isn't -1, this seeks to that frame instead; the score and lives
+// aren't known then, since the frames before the keyframe aren't executed
+static void play_replay(const vector<LevelState::GenerationParameters>& generation_params,
+    const string& filename, int64_t seek_frame) {
+  Replay replay = Replay::load(filename);
+  LevelState game = replay.create_level(generation_params);
+  game.validate();
+
+  int64_t score = 0;
+  int64_t lives = 0;
+  uint64_t start_time = now();
+  if (seek_frame >= 0) {
+    replay.seek(game, seek_frame);
+  } else {
+    for (ReplayReader reader(replay); !reader.done();) {
+      const auto& events = game.exec_frame(reader.next());
+      game.validate_frame();
+      add_player_scores(game, events, &score, &lives);
+    }
+  }
+  uint64_t usecs = now() - start_time;
+
+  const char* result = "ended";
+  if (game.get_player().death_frame() >= 0) {
+    result = "died";
+  } else if (game.is_complete()) {
+    result = "cleared";
+  }
+  print_result_header();
+  print_result(replay.level_index, game, result, score, lives, usecs);
+}
+
+static void print_usage(const char* argv0) {
+  fprintf(stderr, "\
+Usage: %s [options]\n\
+\n\
+Options:\n\
+  --levels=FILE: load levels from this file (default media/levels.json)\n\
+  --level=N: play only this level (default: play all of them in order)\n\
+  --frames=N: give up on each level after this many frames (default 3000)\n\
+  --seed=N: generate levels and inputs from this seed (default 1)\n\
+  --policy=NAME: how to control the player; \"random\" changes direction\n\
+      about twice a second and sometimes pushes, \"idle\" does nothing\n\
+      (default random)\n\
+  --record=PREFIX: save a replay of each level to PREFIX.N.replay, where N is\n\
+      the level index\n\
+  --keyframe-interval=N: when recording, save the level's full state every N\n\
+      frames, so the replay can be seeked quickly (default 900; 0 disables)\n\
+  --replay=FILE: play the given replay instead of using a policy, and print\n\
+      how it ended; --level, --frames, --seed and --policy are ignored\n\
+  --seek=N: with --replay, jump to frame N using the replay's keyframes\n\
+      instead of playing the whole replay\n\
+", argv0);
+}
+
+int main(int argc, char* argv[]) {
+  string levels_filename = "media/levels.json";
+  int64_t only_level_index = -1;
+  int64_t max_frames = 3000;
+  uint64_t seed = 1;
+  Policy policy = Policy::Random;
+  string record_prefix;
+  int64_t keyframe_interval = Replay::default_keyframe_interval;
+  string replay_filename;
+  int64_t seek_frame = -1;
+  for (int x = 1; x < argc; x++) {
+    if (!strncmp(argv[x], "--levels=", 9)) {
+      levels_filename = &argv[x][9];
+    } else if (!strncmp(argv[x], "--level=", 8)) {
+      only_level_index = strtoll(&argv[x][8], NULL, 0);
+    } else if (!strncmp(argv[x], "--frames=", 9)) {
+      max_frames = strtoll(&argv[x][9], NULL, 0);
+    } else if (!strncmp(argv[x], "--seed=", 7)) {
+      seed = strtoull(&argv[x][7], NULL, 0);
+    } else if (!strncmp(argv[x], "--policy=", 9)) {
+      policy = policy_for_name(&argv[x][9]);
+    } else if (!strncmp(argv[x], "--record=", 9)) {
+      record_prefix = &argv[x][9];
+    } else if (!strncmp(argv[x], "--keyframe-interval=", 20)) {
+      keyframe_interval = strtoll(&argv[x][20], NULL, 0);
+    } else if (!strncmp(argv[x], "--replay=", 9)) {
+      replay_filename = &argv[x][9];
+    } else if (!strncmp(argv[x], "--seek=", 7)) {
+      seek_frame = strtoll(&argv[x][7], NULL, 0);
+    } else if (!strcmp(argv[x], "--help")) {
+      print_usage(argv[0]);
+      return 0;
+    } else {
+      print_usage(argv[0]);
+      throw invalid_argument("unknown command-line option");
+    }
+  }
+
+  auto generation_params = load_generation_params(levels_filename);
+  if (!replay_filename.empty()) {
+    play_replay(generation_params, replay_filename, seek_frame);
+    return 0;
+  }
+  if (only_level_index >= static_cast<int64_t>(generation_params.size())) {
+    throw out_of_range("level index is out of range");
+  }
+
+  print_result_header();
+  for (size_t level_index = 0; level_index < generation_params.size(); level_index++) {
+    if ((only_level_index >= 0) &&
+        (level_index != static_cast<size_t>(only_level_index))) {
+      continue;
+    }
+
+    mt19937 g(seed + level_index);
+    auto params = generation_params[level_index];
+    uint64_t elements_seed = g();
+    uint64_t level_seed = g();
+    generate_random_elements(params, elements_seed);
+    LevelState game(params, level_seed);
+    game.validate();
+    Replay replay(level_index, elements_seed, level_seed, params.hash());
+    replay.keyframe_interval = keyframe_interval;
+
+    // the score and lives only count what the player earned on this level,
+    // not what it would carry over from previous ones
+    int64_t score = 0;
+    int64_t lives = 0;
+    const char* result = "timeout";
+    uint64_t impulse = Impulse::None;
+    uint64_t start_time = now();
+    while (game.get_frames_executed() < max_frames) {
+      if ((policy == Policy::Random) && ((game.get_frames_executed() % 15) == 0)) {
+        impulse = random_impulse(g);
+      }
+
+      replay.add_frame(game, impulse);
+      const auto& events = game.exec_frame(impulse);
+      game.validate_frame();
+      add_player_scores(game, events, &score, &lives);
+
+      if (game.get_player().death_frame() >= 0) {
+        result = "died";
+        break;
+      }
+      if (game.is_complete()) {
+        result = "cleared";
+        break;
+      }
+    }
+    uint64_t usecs = now() - start_time;
+    print_result(level_index, game, result, score, lives, usecs);
+
+    if (!record_prefix.empty()) {
+      replay.save(string_printf("%s.%zu.replay", record_prefix.c_str(),
+          level_index));
+    }
+  }
+
+  return 0;
+}